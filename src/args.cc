@@ -300,6 +300,122 @@ std::variant<Parser::State, ParseError> Parser::ParseTweak(
         return kNone;
     }
 
+    if (key == "low-memory") {
+        auto v = ParseBool(value);
+        if (!v.has_value()) {
+            return ParseError(absl::StrFormat(
+                "low-memory must be a boolean value ('%s' given)", value));
+        }
+        opts_.tweak.low_memory = *v;
+        return kNone;
+    }
+
+    if (key == "watch-file") {
+        auto v = ParseBool(value);
+        if (!v.has_value()) {
+            return ParseError(absl::StrFormat(
+                "watch-file must be a boolean value ('%s' given)", value));
+        }
+        opts_.tweak.watch_file = *v;
+        return kNone;
+    }
+
+    if (key == "directory-reload") {
+        auto v = ParseBool(value);
+        if (!v.has_value()) {
+            return ParseError(absl::StrFormat(
+                "directory-reload must be a boolean value ('%s' given)",
+                value));
+        }
+        opts_.tweak.directory_reload = *v;
+        return kNone;
+    }
+
+    if (key == "library-cache") {
+        auto v = ParseBool(value);
+        if (!v.has_value()) {
+            return ParseError(absl::StrFormat(
+                "library-cache must be a boolean value ('%s' given)", value));
+        }
+        opts_.tweak.library_cache = *v;
+        return kNone;
+    }
+
+    if (key == "seed") {
+        uint64_t seed;
+        if (!absl::SimpleAtoi(value, &seed)) {
+            return ParseError(absl::StrFormat(
+                "seed must be a non-negative integer ('%s' given)", value));
+        }
+        opts_.tweak.seed = seed;
+        return kNone;
+    }
+
+    if (key == "weight-sticker") {
+        opts_.tweak.weight_sticker = value;
+        return kNone;
+    }
+
+    if (key == "state-file") {
+        opts_.tweak.state_file = value;
+        return kNone;
+    }
+
+    if (key == "spread-by") {
+        std::optional<enum mpd_tag_type> tag = tag_parser_.Parse(value);
+        if (!tag) {
+            return ParseError(absl::StrFormat("invalid tag name '%s'", value));
+        }
+        opts_.tweak.spread_by = *tag;
+        return kNone;
+    }
+
+    if (key == "list-chunk-size") {
+        if (!absl::SimpleAtoi(value, &opts_.tweak.list_chunk_size)) {
+            return ParseError(absl::StrFormat(
+                "couldn't convert list-chunk-size value '%s'", value));
+        }
+        return kNone;
+    }
+
+    if (key == "load-threads") {
+        if (!absl::SimpleAtoi(value, &opts_.tweak.load_threads) ||
+            opts_.tweak.load_threads < 1) {
+            return ParseError(absl::StrFormat(
+                "load-threads must be a positive integer ('%s' given)",
+                value));
+        }
+        return kNone;
+    }
+
+    if (key == "progressive-load") {
+        if (!absl::SimpleAtoi(value, &opts_.tweak.progressive_load)) {
+            return ParseError(absl::StrFormat(
+                "couldn't convert progressive-load value '%s'", value));
+        }
+        return kNone;
+    }
+
+    if (key == "spread") {
+        if (!absl::SimpleAtoi(value, &opts_.tweak.spread)) {
+            return ParseError(
+                absl::StrFormat("couldn't convert spread value '%s'", value));
+        }
+        return kNone;
+    }
+
+    if (key == "default-weight") {
+        if (!absl::SimpleAtoi(value, &opts_.tweak.default_weight)) {
+            return ParseError(absl::StrFormat(
+                "couldn't convert default-weight value '%s'", value));
+        }
+        if (opts_.tweak.default_weight < 1) {
+            return ParseError(absl::StrFormat(
+                "tweak default-weight must be >= 1 (%s given)", value));
+        }
+        return kNone;
+    }
+
     return ParseError(absl::StrFormat("unrecognized tweak '%s'", arg));
 }
 
@@ -431,9 +547,9 @@ std::variant<Parser::State, ParseError> Parser::ConsumeInternal(
             if (arg == "-") {
                 opts_.file_in = &std::cin;
             } else {
-                std::string filepath(arg);
+                opts_.file_in_path = arg;
                 opts_.InternalTakeIstream(
-                    std::make_unique<std::ifstream>(filepath));
+                    std::make_unique<std::ifstream>(opts_.file_in_path));
             }
             return kNone;
         case kHost:
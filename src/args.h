@@ -1,6 +1,7 @@
 #ifndef __ASHUFFLE_ARGS_H__
 #define __ASHUFFLE_ARGS_H__
 
+#include <cstdint>
 #include <istream>
 #include <optional>
 #include <string>
@@ -35,6 +36,8 @@ class Options {
     std::vector<Rule> ruleset;
     unsigned queue_only = 0;
     std::istream *file_in = nullptr;
+    // The path given to --file, or empty if songs are read from stdin.
+    std::string file_in_path;
     std::ostream *log_file = nullptr;
     bool check_uris = true;
     unsigned queue_buffer = 0;
@@ -58,10 +61,45 @@ class Options {
         // intented to be used in cases where the user is passing in a
         // list of songs via -f, and they may want to re-generate that list.
         bool exit_on_db_update = false;
+        // If true, reload the library after a database update by only
+        // re-listing the directories that changed.
+        bool directory_reload = false;
         // Duration to attempt to reconnect to MPD after a disconnection.
         // After this time, ashuffle will assume it cannot reconnect and
         // will quit.
         absl::Duration reconnect_timeout = absl::Seconds(10);
+        // If set, the seed used for the shuffle chain's random number
+        // generator, so the sequence of picked songs is reproducible.
+        std::optional<uint64_t> seed = {};
+        // If non-empty, the name of the song sticker (e.g., "rating") to
+        // weight songs by.
+        std::string weight_sticker = "";
+        // The weight of songs without the weight sticker.
+        unsigned default_weight = 5;
+        // If set, avoid picking songs with the same value of this tag
+        // (e.g., artist) within `spread` picks of each other.
+        std::optional<enum mpd_tag_type> spread_by = {};
+        unsigned spread = 3;
+        // If non-empty, the path of a file used to persist the shuffle
+        // chain across restarts.
+        std::string state_file = "";
+        // If true, cache the loaded library on disk, so startup can skip
+        // listing it when MPD's database has not changed.
+        bool library_cache = false;
+        // The number of songs to list from MPD per request, or zero to list
+        // the whole library in a single request.
+        unsigned list_chunk_size = 0;
+        // The number of threads used to check songs against the rules
+        // while loading.
+        unsigned load_threads = 1;
+        // If non-zero, start picking songs once this many songs (or groups)
+        // are loaded, and load the rest of the library in the background.
+        unsigned progressive_load = 0;
+        // If true, never load the library: pick songs straight from MPD's
+        // database by their position in it.
+        bool low_memory = false;
+        // If true, re-read the `--file` list whenever the file changes.
+        bool watch_file = true;
     } tweak = {};
     std::vector<enum mpd_tag_type> group_by = {};
 
@@ -4,13 +4,18 @@
 #include <cassert>
 #include <chrono>
 #include <cstdlib>
+#include <filesystem>
 #include <functional>
 #include <iostream>
 #include <optional>
 #include <string>
 #include <string_view>
+#include <system_error>
 #include <thread>
+#include <unordered_map>
+#include <vector>
 
+#include <absl/functional/function_ref.h>
 #include <absl/strings/str_format.h>
 #include <absl/time/clock.h>
 #include <absl/time/time.h>
@@ -18,12 +23,16 @@
 
 #include "args.h"
 #include "ashuffle.h"
+#include "file_watcher.h"
+#include "index_picker.h"
 #include "load.h"
 #include "log.h"
+#include "mapped_file.h"
 #include "mpd.h"
 #include "mpd_client.h"
 #include "rule.h"
 #include "shuffle.h"
+#include "snapshot.h"
 #include "util.h"
 
 namespace ashuffle {
@@ -35,7 +44,15 @@ constexpr std::array<std::string_view, 5> kRequiredCommands = {
     "add", "status", "play", "pause", "idle",
 };
 
-absl::Status TryFirst(mpd::MPD *mpd, ShuffleChain *songs) {
+// The shortest time between two saves of the shuffle state that are only
+// made because songs were picked. At most this long of shuffle history is
+// lost when ashuffle is stopped.
+constexpr absl::Duration kStateSaveInterval = absl::Seconds(30);
+
+// Picker returns the next item to enqueue.
+using Picker = absl::FunctionRef<absl::StatusOr<ItemView>()>;
+
+absl::Status TryFirst(mpd::MPD *mpd, Picker pick) {
     absl::StatusOr<std::unique_ptr<mpd::Status>> status = mpd->CurrentStatus();
     if (!status.ok()) {
         Log().Error("Failed to query current MPD Status: %s",
@@ -49,7 +66,12 @@ absl::Status TryFirst(mpd::MPD *mpd, ShuffleChain *songs) {
     }
 
     // If we're not playing, then add a song, and start playing it.
-    if (auto s = mpd->Add(songs->Pick()); !s.ok()) {
+    absl::StatusOr<ItemView> picked = pick();
+    if (!picked.ok()) {
+        Log().Error("Failed to pick song: %s", picked.status().ToString());
+        return picked.status();
+    }
+    if (auto s = mpd->Add(*picked); !s.ok()) {
         Log().Error("Failed to add song to MPD: %s", s.ToString());
         return s;
     }
@@ -61,8 +83,7 @@ absl::Status TryFirst(mpd::MPD *mpd, ShuffleChain *songs) {
     return absl::OkStatus();
 }
 
-absl::Status TryEnqueue(mpd::MPD *mpd, ShuffleChain *songs,
-                        const Options &options) {
+absl::Status TryEnqueue(mpd::MPD *mpd, Picker pick, const Options &options) {
     absl::StatusOr<std::unique_ptr<mpd::Status>> status_or =
         mpd->CurrentStatus();
     if (!status_or.ok()) {
@@ -108,16 +129,27 @@ absl::Status TryEnqueue(mpd::MPD *mpd, ShuffleChain *songs,
                 needed += 1;
             }
             while (needed > 0) {
-                std::vector<std::string> picked = songs->Pick();
-                needed -= static_cast<int>(picked.size());
-                if (auto status = mpd->Add(picked); !status.ok()) {
+                absl::StatusOr<ItemView> picked = pick();
+                if (!picked.ok()) {
+                    Log().Error("Failed to pick song: %s",
+                                picked.status().ToString());
+                    return picked.status();
+                }
+                needed -= static_cast<int>(picked->size());
+                if (auto status = mpd->Add(*picked); !status.ok()) {
                     Log().Error("Failed to add picked song: %s",
                                 status.ToString());
                     return status;
                 }
             }
         } else {
-            if (auto status = mpd->Add(songs->Pick()); !status.ok()) {
+            absl::StatusOr<ItemView> picked = pick();
+            if (!picked.ok()) {
+                Log().Error("Failed to pick song: %s",
+                            picked.status().ToString());
+                return picked.status();
+            }
+            if (auto status = mpd->Add(*picked); !status.ok()) {
                 Log().Error("Failed to add picked song: %s", status.ToString());
                 return status;
             }
@@ -180,8 +212,292 @@ struct MPDHost {
     }
 };
 
+// Returns the host, possibly prefixed by a password, given on the command
+// line, or in MPD_HOST, or 'localhost' by default.
+std::string RawHost(const Options &options) {
+    if (options.host.has_value()) {
+        return *options.host;
+    }
+    const char *env_host = getenv("MPD_HOST");
+    return env_host != nullptr ? env_host : "localhost";
+}
+
+// Returns the address of the MPD server to connect to. As with the host,
+// the port given on the command line is preferred over MPD_PORT.
+mpd::Address ServerAddress(const Options &options) {
+    unsigned port =
+        options.port
+            ? options.port
+            : (unsigned)(getenv("MPD_PORT") ? atoi(getenv("MPD_PORT")) : 6600);
+    return mpd::Address{
+        .host = MPDHost(RawHost(options)).host,
+        .port = port,
+    };
+}
+
+// Add everything that determines the items in the shuffle chain (the MPD
+// server and its database, and the options that select, weight, and group
+// songs) to the given key, so a stale snapshot is never restored.
+absl::Status AddLibraryKey(mpd::MPD *mpd, const Options &options,
+                           Fingerprint *key) {
+    absl::StatusOr<mpd::DBStats> stats = mpd->DatabaseStats();
+    if (!stats.ok()) {
+        return stats.status();
+    }
+    // Two servers can have databases with the same stats (e.g., a mirror
+    // that was updated in the same second).
+    mpd::Address addr = ServerAddress(options);
+    key->Add(addr.host);
+    key->Add(static_cast<uint64_t>(addr.port));
+    // The update time only has a resolution of seconds, so the other stats
+    // are included to tell apart databases updated in the same second.
+    key->Add(static_cast<uint64_t>(absl::ToUnixSeconds(stats->last_update)));
+    key->Add(stats->songs);
+    key->Add(static_cast<uint64_t>(absl::ToInt64Seconds(stats->playtime)));
+    key->Add(static_cast<uint64_t>(options.check_uris));
+    key->Add(options.ruleset.size());
+    for (const Rule &rule : options.ruleset) {
+        key->Add(static_cast<uint64_t>(rule.GetType()));
+        key->Add(rule.Size());
+        for (const Pattern &pattern : rule.Patterns()) {
+            key->Add(static_cast<uint64_t>(pattern.tag));
+            key->Add(pattern.value);
+        }
+    }
+    key->Add(options.group_by.size());
+    for (enum mpd_tag_type tag : options.group_by) {
+        key->Add(static_cast<uint64_t>(tag));
+    }
+    key->Add(options.tweak.weight_sticker);
+    key->Add(options.tweak.default_weight);
+    if (!options.tweak.weight_sticker.empty()) {
+        // Setting a sticker does not change the database stats, so the
+        // stickers themselves are part of the key. They are fetched in one
+        // request, which is much cheaper than listing the library.
+        absl::StatusOr<std::unordered_map<std::string, std::string>>
+            stickers = mpd->SongStickers(options.tweak.weight_sticker);
+        if (!stickers.ok()) {
+            return stickers.status();
+        }
+        // The stickers are unordered, so each one is fingerprinted on its
+        // own, and the fingerprints are summed.
+        uint64_t sum = 0;
+        for (const auto &[uri, value] : *stickers) {
+            Fingerprint sticker;
+            sticker.Add(uri);
+            sticker.Add(value);
+            sum += sticker.Value();
+        }
+        key->Add(stickers->size());
+        key->Add(sum);
+    }
+    key->Add(static_cast<uint64_t>(options.tweak.spread_by.has_value()));
+    key->Add(static_cast<uint64_t>(
+        options.tweak.spread_by.value_or(MPD_TAG_UNKNOWN)));
+    return absl::OkStatus();
+}
+
+// Returns the key a library cache snapshot must have to be restored.
+absl::StatusOr<uint64_t> LibraryKey(mpd::MPD *mpd, const Options &options) {
+    Fingerprint key;
+    if (auto status = AddLibraryKey(mpd, options, &key); !status.ok()) {
+        return status;
+    }
+    return key.Value();
+}
+
+// Returns the path of the library cache for the server in `options`, under
+// the XDG cache directory, or an empty path if there is no cache directory.
+// Each server has its own cache, so switching between servers does not
+// overwrite the other's cache. The host may be a socket path, so the file
+// is named by a fingerprint of the address, rather than the address itself.
+std::filesystem::path LibraryCachePath(const Options &options) {
+    std::filesystem::path dir;
+    if (const char *xdg = getenv("XDG_CACHE_HOME");
+        xdg != nullptr && *xdg != '\0') {
+        dir = std::filesystem::path(xdg) / "ashuffle";
+    } else if (const char *home = getenv("HOME");
+               home != nullptr && *home != '\0') {
+        dir = std::filesystem::path(home) / ".cache" / "ashuffle";
+    } else {
+        return {};
+    }
+    mpd::Address addr = ServerAddress(options);
+    Fingerprint server;
+    server.Add(addr.host);
+    server.Add(static_cast<uint64_t>(addr.port));
+    return dir / absl::StrFormat("library-%016x", server.Value());
+}
+
+bool LibraryCacheEnabled(const Options &options) {
+    return options.tweak.library_cache && options.file_in == nullptr;
+}
+
+bool StateEnabled(const Options &options) {
+    return !options.tweak.state_file.empty() && options.file_in == nullptr;
+}
+
+// Re-read the `--file` list after it has changed, and apply the difference
+// to `songs`, so the shuffle history of songs still in the list is kept.
+// The list is read, rather than mapped, since it may be rewritten again
+// while it is loaded.
+absl::Status ReloadFile(mpd::MPD *mpd, ShuffleChain *songs,
+                        const Options &options) {
+    absl::StatusOr<std::string> file = ReadFile(options.file_in_path);
+    if (!file.ok()) {
+        return file.status();
+    }
+    std::unique_ptr<Loader> loader;
+    if (options.check_uris) {
+        loader = std::make_unique<FileMPDLoader>(mpd, options.ruleset,
+                                                 options.group_by, *file);
+    } else {
+        loader = std::make_unique<FileLoader>(std::move(*file));
+    }
+    ShuffleChain next;
+    loader->Load(&next);
+    if (next.Len() == 0) {
+        // Keep the songs we have, rather than leaving nothing to pick.
+        return absl::FailedPreconditionError("no songs left in the list");
+    }
+    ChainDiff diff = songs->Update(std::move(next));
+    Log().Info("'%s' changed: %u added, %u removed", options.file_in_path,
+               diff.added, diff.removed);
+    PrintChainLength(std::cout, *songs);
+    return absl::OkStatus();
+}
+
 }  // namespace
 
+absl::StatusOr<uint64_t> StateKey(mpd::MPD *mpd, const Options &options) {
+    Fingerprint key;
+    if (auto status = AddLibraryKey(mpd, options, &key); !status.ok()) {
+        return status;
+    }
+    // The state also depends on the options that shape the shuffle history.
+    key.Add(static_cast<uint64_t>(options.tweak.window_size));
+    key.Add(static_cast<uint64_t>(options.tweak.seed.has_value()));
+    key.Add(options.tweak.seed.value_or(0));
+    return key.Value();
+}
+
+absl::Status SaveState(mpd::MPD *mpd, const ShuffleChain &songs,
+                       const Options &options) {
+    if (!StateEnabled(options)) {
+        return absl::OkStatus();
+    }
+    absl::StatusOr<uint64_t> key = StateKey(mpd, options);
+    if (!key.ok()) {
+        return key.status();
+    }
+    return SaveState(songs, options, *key);
+}
+
+absl::Status SaveState(const ShuffleChain &songs, const Options &options,
+                       uint64_t key) {
+    if (!StateEnabled(options)) {
+        return absl::OkStatus();
+    }
+    absl::StatusOr<SnapshotWriter> writer =
+        SnapshotWriter::Create(options.tweak.state_file, key);
+    if (!writer.ok()) {
+        return writer.status();
+    }
+    songs.Save(&*writer);
+    return writer->Commit();
+}
+
+absl::Status RestoreState(mpd::MPD *mpd, ShuffleChain *songs,
+                          const Options &options) {
+    if (!StateEnabled(options)) {
+        return absl::NotFoundError("no state file configured");
+    }
+    absl::StatusOr<uint64_t> key = StateKey(mpd, options);
+    if (!key.ok()) {
+        return key.status();
+    }
+    absl::StatusOr<SnapshotReader> reader =
+        SnapshotReader::Open(options.tweak.state_file, *key);
+    if (!reader.ok()) {
+        return reader.status();
+    }
+    if (!songs->Restore(&*reader) || !reader->Done()) {
+        songs->Clear();
+        return absl::DataLossError(absl::StrFormat(
+            "state file '%s' is corrupt", options.tweak.state_file));
+    }
+    return absl::OkStatus();
+}
+
+bool CheckLibraryCache(mpd::MPD *mpd, Options *options) {
+    if (!LibraryCacheEnabled(*options)) {
+        return false;
+    }
+    // The cache key is built from the database stats, so without them the
+    // cache could never be saved or restored.
+    absl::StatusOr<mpd::MPD::Authorization> auth =
+        mpd->CheckCommands({"stats"});
+    if (auth.ok() && auth->authorized) {
+        return true;
+    }
+    if (auth.ok()) {
+        Log().InfoStr(
+            "Not using library cache: the MPD 'stats' command is not "
+            "allowed");
+    } else {
+        Log().Info("Not using library cache: %s", auth.status().ToString());
+    }
+    options->tweak.library_cache = false;
+    return false;
+}
+
+absl::Status SaveLibrary(mpd::MPD *mpd, const ShuffleChain &songs,
+                         const Options &options) {
+    std::filesystem::path path = LibraryCachePath(options);
+    if (!LibraryCacheEnabled(options) || path.empty()) {
+        return absl::OkStatus();
+    }
+    absl::StatusOr<uint64_t> key = LibraryKey(mpd, options);
+    if (!key.ok()) {
+        return key.status();
+    }
+    std::error_code err;
+    std::filesystem::create_directories(path.parent_path(), err);
+    if (err) {
+        return absl::UnavailableError(
+            absl::StrFormat("failed to create cache directory '%s': %s",
+                            path.parent_path().string(), err.message()));
+    }
+    absl::StatusOr<SnapshotWriter> writer = SnapshotWriter::Create(path, *key);
+    if (!writer.ok()) {
+        return writer.status();
+    }
+    songs.SaveItems(&*writer);
+    return writer->Commit();
+}
+
+absl::Status RestoreLibrary(mpd::MPD *mpd, ShuffleChain *songs,
+                            const Options &options) {
+    std::filesystem::path path = LibraryCachePath(options);
+    if (!LibraryCacheEnabled(options) || path.empty()) {
+        return absl::NotFoundError("library cache disabled");
+    }
+    absl::StatusOr<uint64_t> key = LibraryKey(mpd, options);
+    if (!key.ok()) {
+        return key.status();
+    }
+    absl::StatusOr<SnapshotReader> reader = SnapshotReader::Open(path, *key);
+    if (!reader.ok()) {
+        return reader.status();
+    }
+    if (!songs->RestoreItems(&*reader) || !reader->Done()) {
+        songs->Clear();
+        return absl::DataLossError(absl::StrFormat(
+            "library cache '%s' is corrupt", path.string()));
+    }
+    return absl::OkStatus();
+}
+
 std::optional<std::unique_ptr<Loader>> Reloader(mpd::MPD *mpd,
                                                 const Options &options) {
     // Nothing we can do when `--file` is provided. The user is just stuck
@@ -189,40 +505,169 @@ std::optional<std::unique_ptr<Loader>> Reloader(mpd::MPD *mpd,
     if (options.file_in != nullptr) {
         return std::nullopt;
     }
-    return std::make_unique<MPDLoader>(mpd, options.ruleset, options.group_by);
+    Weighting weighting{options.tweak.weight_sticker,
+                        options.tweak.default_weight};
+    if (options.tweak.directory_reload) {
+        return std::make_unique<IncrementalMPDLoader>(
+            mpd, options.ruleset, options.group_by, std::move(weighting),
+            options.tweak.spread_by);
+    }
+    Listing listing{options.tweak.list_chunk_size, options.tweak.load_threads};
+    return std::make_unique<MPDLoader>(mpd, options.ruleset, options.group_by,
+                                       std::move(weighting),
+                                       options.tweak.spread_by, listing);
 }
 
 /* Keep adding songs when the queue runs out */
 absl::Status Loop(mpd::MPD *mpd, ShuffleChain *songs, const Options &options,
-                  TestDelegate test_d) {
+                  TestDelegate test_d, ProgressiveLoad *loading) {
     static_assert(MPD_IDLE_QUEUE == MPD_IDLE_PLAYLIST,
                   "QUEUE Now different signal.");
     mpd::IdleEventSet set(MPD_IDLE_DATABASE, MPD_IDLE_QUEUE, MPD_IDLE_PLAYER);
 
+    // In low-memory mode, songs are picked straight from MPD's database, and
+    // `songs` is not used.
+    std::optional<IndexPicker> picker;
+    if (options.tweak.low_memory) {
+        picker.emplace(options.ruleset, options.tweak.window_size,
+                       StreamSeed(options.tweak.seed.value_or(RandomSeed()),
+                                  SeedStream::kIndexPicker));
+    }
+    auto pick = [&]() -> absl::StatusOr<ItemView> {
+        if (picker) {
+            return picker->Pick(mpd);
+        }
+        return songs->Pick();
+    };
+
+    // Save the shuffle state when songs have been picked since it was last
+    // saved, so a restart picks up where we left off. Saving rewrites the
+    // whole chain, so unforced saves are made at most once every
+    // kStateSaveInterval, and the state key is only fetched from MPD again
+    // after the database changes. Failing to save is not fatal, we just
+    // lose the state.
+    uint64_t saved_picks = songs->Stats().picks;
+    absl::Time saved_at = absl::InfinitePast();
+    std::optional<uint64_t> state_key;
+    auto save_state = [&](bool force) {
+        // Until a progressive load finishes, the chain is incomplete, and
+        // must not be restored on the next startup. In low-memory mode,
+        // there is no chain to save.
+        if (loading != nullptr || picker || !StateEnabled(options)) {
+            return;
+        }
+        uint64_t picks = songs->Stats().picks;
+        absl::Time now = absl::Now();
+        if (!force &&
+            (picks == saved_picks || now - saved_at < kStateSaveInterval)) {
+            return;
+        }
+        if (!state_key.has_value()) {
+            absl::StatusOr<uint64_t> key = StateKey(mpd, options);
+            if (!key.ok()) {
+                Log().Error("Failed to save shuffle state: %s",
+                            key.status().ToString());
+                return;
+            }
+            state_key = *key;
+        }
+        saved_picks = picks;
+        saved_at = now;
+        if (auto status = SaveState(*songs, options, *state_key);
+            !status.ok()) {
+            Log().Error("Failed to save shuffle state: %s", status.ToString());
+        }
+    };
+
+    // Saves the library cache after the library has been (re-)loaded.
+    auto save_library = [&] {
+        if (auto status = SaveLibrary(mpd, *songs, options); !status.ok()) {
+            Log().Error("Failed to save library cache: %s", status.ToString());
+        }
+    };
+
     // If the test delegate's `skip_init` is set to true, then skip the
     // initializer.
     if (options.tweak.play_on_startup) {
-        if (auto status = TryFirst(mpd, songs); !status.ok()) {
+        if (auto status = TryFirst(mpd, pick); !status.ok()) {
             return status;
         }
-        if (auto status = TryEnqueue(mpd, songs, options); !status.ok()) {
+        if (auto status = TryEnqueue(mpd, pick, options); !status.ok()) {
             return status;
         }
+        save_state(false);
     }
 
     // Tracks if we should be enqueuing new songs.
     bool active = true;
 
+    // Watch the `--file` list (unless it was read from stdin), so changes
+    // to it are applied without restarting. Changes are noticed while
+    // idling, along with MPD's events.
+    std::optional<FileWatcher> watcher;
+    if (!options.file_in_path.empty() && options.tweak.watch_file) {
+        absl::StatusOr<FileWatcher> w =
+            FileWatcher::Create(options.file_in_path);
+        if (w.ok()) {
+            watcher.emplace(std::move(*w));
+        } else if (absl::IsUnimplemented(w.status())) {
+            // Not fatal, the list is just not reloaded when it changes.
+            Log().Info("Not watching '%s' for changes: %s",
+                       options.file_in_path, w.status().ToString());
+        } else {
+            Log().Error("Failed to watch '%s' for changes: %s",
+                        options.file_in_path, w.status().ToString());
+        }
+    }
+
+    // Loads the library after a database update. Created on first use.
+    std::unique_ptr<Loader> reloader;
+
     // Loop forever if test delegates are not set.
     while (test_d.until_f == nullptr || test_d.until_f()) {
+        // Besides MPD's events, idling stops when the file list changes, or
+        // when a progressive load finishes.
+        std::vector<int> fds;
+        if (watcher) {
+            fds.push_back(watcher->Fd());
+        }
+        if (loading != nullptr) {
+            fds.push_back(loading->Fd());
+        }
+
         /* wait till the player state changes */
-        absl::StatusOr<mpd::IdleEventSet> events = mpd->Idle(set);
+        absl::StatusOr<mpd::IdleEventSet> events =
+            fds.empty() ? mpd->Idle(set) : mpd->IdleOrReadable(set, fds);
         if (!events.ok()) {
             Log().Error("Failed to idle for MPD events: %s",
                         events.status().ToString());
             return events.status();
         }
 
+        // Songs are only picked after an event, so checking for the rest of
+        // a progressive load here means every pick sees all songs loaded.
+        if (loading != nullptr) {
+            absl::StatusOr<bool> finished = loading->Finish(songs);
+            if (!finished.ok()) {
+                Log().Error("Failed to load songs: %s",
+                            finished.status().ToString());
+                return finished.status();
+            }
+            if (*finished) {
+                loading = nullptr;
+                PrintChainLength(std::cout, *songs);
+                save_library();
+                save_state(true);
+            }
+        }
+
+        if (watcher && watcher->Changed()) {
+            if (auto status = ReloadFile(mpd, songs, options); !status.ok()) {
+                Log().Error("Failed to reload '%s': %s", options.file_in_path,
+                            status.ToString());
+            }
+        }
+
         if (events->Has(MPD_IDLE_DATABASE) && options.tweak.exit_on_db_update) {
             std::cout << "Database updated, exiting." << std::endl;
             std::exit(0);
@@ -230,13 +675,52 @@ absl::Status Loop(mpd::MPD *mpd, ShuffleChain *songs, const Options &options,
 
         /* Only update the database if our original list was built from
          * MPD. */
-        if (events->Has(MPD_IDLE_DATABASE) && options.file_in == nullptr) {
-            std::optional<std::unique_ptr<Loader>> reloader =
-                Reloader(mpd, options);
-            if (reloader.has_value()) {
-                songs->Clear();
-                (*reloader)->Load(songs);
+        if (events->Has(MPD_IDLE_DATABASE) && picker) {
+            // Nothing is loaded, the songs just need to be counted again.
+            picker->Reset();
+        } else if (events->Has(MPD_IDLE_DATABASE) &&
+                   options.file_in == nullptr) {
+            // The reloader is kept for the rest of the loop, so loaders that
+            // remember what they loaded (e.g., IncrementalMPDLoader) can
+            // reload incrementally.
+            if (reloader == nullptr) {
+                if (auto r = Reloader(mpd, options); r.has_value()) {
+                    reloader = std::move(*r);
+                }
+            }
+            if (reloader != nullptr) {
+                // A progressive load may have listed the library from
+                // before the update, so it must be applied first.
+                if (loading != nullptr) {
+                    absl::StatusOr<bool> finished =
+                        loading->Finish(songs, true);
+                    if (!finished.ok()) {
+                        Log().Error("Failed to load songs: %s",
+                                    finished.status().ToString());
+                        return finished.status();
+                    }
+                    loading = nullptr;
+                }
+                // Load into a separate chain, and apply only the difference,
+                // so the shuffle history of unchanged songs is kept.
+                ShuffleChain next;
+                reloader->Load(&next);
+                if (next.Len() == 0) {
+                    // Keep the songs we have, rather than leaving nothing to
+                    // pick. They are replaced by the next update with songs.
+                    Log().Error(
+                        "Not applying database update: no songs left in the "
+                        "library");
+                    continue;
+                }
+                ChainDiff diff = songs->Update(std::move(next));
+                Log().Info("Database updated: %u added, %u removed",
+                           diff.added, diff.removed);
                 PrintChainLength(std::cout, *songs);
+                save_library();
+                // The key depends on the database, which just changed.
+                state_key.reset();
+                save_state(true);
             }
         } else if (events->Has(MPD_IDLE_QUEUE) ||
                    events->Has(MPD_IDLE_PLAYER)) {
@@ -262,10 +746,11 @@ absl::Status Loop(mpd::MPD *mpd, ShuffleChain *songs, const Options &options,
             if (!active) {
                 continue;
             }
-            if (auto status = TryEnqueue(mpd, songs, options); !status.ok()) {
+            if (auto status = TryEnqueue(mpd, pick, options); !status.ok()) {
                 Log().Error("Failed regular enqueue");
                 return status;
             }
+            save_state(false);
         }
     }
     return absl::OkStatus();
@@ -274,25 +759,9 @@ absl::Status Loop(mpd::MPD *mpd, ShuffleChain *songs, const Options &options,
 absl::StatusOr<std::unique_ptr<mpd::MPD>> Connect(
     const mpd::Dialer &d, const Options &options,
     std::function<std::string()> *getpass_f) {
-    /* Attempt to get host from command line if available. Otherwise use
-     * MPD_HOST variable if available. Otherwise use 'localhost'. */
-    const char *env_host =
-        getenv("MPD_HOST") != nullptr ? getenv("MPD_HOST") : "localhost";
-    std::string mpd_host_raw =
-        options.host.has_value() ? *options.host : env_host;
-    MPDHost mpd_host(mpd_host_raw);
-
-    /* Same thing for the port, use the command line defined port, environment
-     * defined, or the default port */
-    unsigned mpd_port =
-        options.port
-            ? options.port
-            : (unsigned)(getenv("MPD_PORT") ? atoi(getenv("MPD_PORT")) : 6600);
-
-    mpd::Address addr = {
-        .host = mpd_host.host,
-        .port = mpd_port,
-    };
+    // The host may carry a password, which is applied once connected.
+    MPDHost mpd_host(RawHost(options));
+    mpd::Address addr = ServerAddress(options);
 
     absl::StatusOr<std::unique_ptr<mpd::MPD>> r = d.Dial(addr);
     if (!r.ok()) {
@@ -352,19 +821,20 @@ absl::StatusOr<std::unique_ptr<mpd::MPD>> Connect(
 
 // Print the size of the database to the given stream, accounting for grouping.
 void PrintChainLength(std::ostream &stream, const ShuffleChain &songs) {
-    if (songs.Len() == 0) {
+    ChainStats stats = songs.Stats();
+    if (stats.items == 0) {
         stream << "Song pool is empty." << std::endl;
         return;
     }
 
     // If we're grouping.
-    if (songs.Len() != songs.LenURIs()) {
+    if (stats.items != stats.uris) {
         stream << absl::StrFormat("Picking from %u groups (%u songs).",
-                                  songs.Len(), songs.LenURIs())
+                                  stats.items, stats.uris)
                << std::endl;
     } else {
-        stream << "Picking random songs out of a pool of " << songs.Len() << "."
-               << std::endl;
+        stream << "Picking random songs out of a pool of " << stats.items
+               << "." << std::endl;
     }
 }
 
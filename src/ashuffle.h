@@ -42,15 +42,61 @@ struct TestDelegate {
 // Use the MPD `idle` command to queue songs random songs when the current
 // queue finishes playing. This is the core loop of `ashuffle`. The tests
 // delegate is used during tests to observe loop effects. It should be set to
-// NULL during normal operations.
+// NULL during normal operations. If `loading` is set, `songs` holds only the
+// first songs of a progressive load, and is updated with the rest of the
+// library once it has finished loading.
 absl::Status Loop(mpd::MPD* mpd, ShuffleChain* songs, const Options& options,
-                  TestDelegate d = TestDelegate());
+                  TestDelegate d = TestDelegate(),
+                  ProgressiveLoad* loading = nullptr);
 
 // Return a loader capable of re-loading the current shuffle chain given
 // a particular set of options. If it's not possible to create such a
 // loader, returns an empty option.
 std::optional<std::unique_ptr<Loader>> Reloader(mpd::MPD* mpd,
                                                 const Options& options);
+// Save the given shuffle chain to the state file given by the `state-file`
+// tweak, so it can be restored by RestoreState when ashuffle restarts. Does
+// nothing if no state file is configured, or songs were loaded from a file.
+absl::Status SaveState(mpd::MPD* mpd, const ShuffleChain& songs,
+                       const Options& options);
+
+// As above, but with a `key` fetched earlier by StateKey, so saving does not
+// need to query MPD.
+absl::Status SaveState(const ShuffleChain& songs, const Options& options,
+                       uint64_t key);
+
+// Returns the key the state file is saved with. It depends on MPD's database,
+// so it must be fetched again after the database changes.
+absl::StatusOr<uint64_t> StateKey(mpd::MPD* mpd, const Options& options);
+
+// Restore the shuffle chain saved by SaveState into `songs`. Returns an
+// error (NOT_FOUND if there is no usable state file) if the state could not
+// be restored, in which case the chain must be loaded as usual. State is only
+// restored if MPD's database, and all options that affect which songs are
+// loaded, are unchanged since it was saved.
+absl::Status RestoreState(mpd::MPD* mpd, ShuffleChain* songs,
+                          const Options& options);
+
+// Save the items in the given shuffle chain to the library cache, under
+// $XDG_CACHE_HOME (or ~/.cache), so RestoreLibrary can skip listing the
+// library on the next startup. Does nothing if the cache is disabled by the
+// `library-cache` tweak, or songs were loaded from a file.
+absl::Status SaveLibrary(mpd::MPD* mpd, const ShuffleChain& songs,
+                         const Options& options);
+
+// Restore the items saved by SaveLibrary into `songs`. As with RestoreState,
+// this fails (with NOT_FOUND if there is no usable cache) unless MPD's
+// database, and the options that affect which songs are loaded, are
+// unchanged since the cache was saved.
+absl::Status RestoreLibrary(mpd::MPD* mpd, ShuffleChain* songs,
+                            const Options& options);
+
+// Check that the library cache can be used on the given MPD connection,
+// and if it cannot (e.g., because the `stats` command is not allowed),
+// disable it in `options`, so it is skipped without an error on every save.
+// Returns true if the cache is enabled.
+bool CheckLibraryCache(mpd::MPD* mpd, Options* options);
+
 // Print the size of the database to the given stream, accounting for
 // grouping.
 void PrintChainLength(std::ostream& stream, const ShuffleChain& chain);
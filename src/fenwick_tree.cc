@@ -0,0 +1,71 @@
+#include "fenwick_tree.h"
+
+#include <cassert>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace ashuffle {
+
+namespace {
+
+size_t LowBit(size_t i) { return i & (~i + 1); }
+
+}  // namespace
+
+void FenwickTree::Assign(std::vector<uint64_t> weights) {
+    tree_ = std::move(weights);
+    total_ = 0;
+    for (uint64_t weight : tree_) {
+        total_ += weight;
+    }
+    for (size_t i = 0; i < tree_.size(); i++) {
+        // Push each partial sum up to its parent, using 1-based indexing.
+        size_t parent = (i + 1) + LowBit(i + 1);
+        if (parent <= tree_.size()) {
+            tree_[parent - 1] += tree_[i];
+        }
+    }
+}
+
+void FenwickTree::Add(size_t index, uint64_t delta) {
+    assert(index < tree_.size() && "index out of range");
+    total_ += delta;
+    for (size_t i = index + 1; i <= tree_.size(); i += LowBit(i)) {
+        tree_[i - 1] += delta;
+    }
+}
+
+void FenwickTree::Sub(size_t index, uint64_t delta) {
+    assert(index < tree_.size() && "index out of range");
+    total_ -= delta;
+    for (size_t i = index + 1; i <= tree_.size(); i += LowBit(i)) {
+        tree_[i - 1] -= delta;
+    }
+}
+
+size_t FenwickTree::Find(uint64_t offset) const {
+    assert(offset < total_ && "offset out of range");
+    size_t step = 1;
+    while (step * 2 <= tree_.size()) {
+        step *= 2;
+    }
+    // Walk down the implicit tree, skipping over every node whose range
+    // ends before `offset`. `pos` is the number of items skipped so far.
+    size_t pos = 0;
+    for (; step > 0; step /= 2) {
+        size_t next = pos + step;
+        if (next <= tree_.size() && tree_[next - 1] <= offset) {
+            pos = next;
+            offset -= tree_[next - 1];
+        }
+    }
+    return pos;
+}
+
+void FenwickTree::Clear() {
+    tree_.clear();
+    total_ = 0;
+}
+
+}  // namespace ashuffle
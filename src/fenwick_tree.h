@@ -0,0 +1,52 @@
+#ifndef __ASHUFFLE_FENWICK_TREE_H__
+#define __ASHUFFLE_FENWICK_TREE_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace ashuffle {
+
+// FenwickTree (a.k.a. binary indexed tree) stores a list of non-negative
+// integer weights, and supports updating a weight, computing the total
+// weight, and finding the index that a given offset into the cumulative
+// weights falls on, all in O(log n). This makes it a good fit for sampling
+// items in proportion to their weights while the weights change.
+class FenwickTree {
+   public:
+    FenwickTree() = default;
+
+    // Replace the contents of this tree with the given weights. This is O(n).
+    void Assign(std::vector<uint64_t> weights);
+
+    // Add `delta` to the weight of the item at `index`.
+    void Add(size_t index, uint64_t delta);
+
+    // Subtract `delta` from the weight of the item at `index`. The weight
+    // must be at least `delta`.
+    void Sub(size_t index, uint64_t delta);
+
+    // Return the sum of all weights in this tree.
+    uint64_t Total() const { return total_; }
+
+    // Return the index of the item whose cumulative weight range contains
+    // `offset`. That is, the smallest index i such that the sum of weights
+    // [0, i] is greater than `offset`. `offset` must be less than Total().
+    size_t Find(uint64_t offset) const;
+
+    // Return the number of items in this tree.
+    size_t Size() const { return tree_.size(); }
+
+    // Remove all items from this tree.
+    void Clear();
+
+   private:
+    // tree_[i] holds the sum of the weights of the items in the range
+    // (i + 1 - lowbit(i + 1), i].
+    std::vector<uint64_t> tree_;
+    uint64_t total_ = 0;
+};
+
+}  // namespace ashuffle
+
+#endif  // __ASHUFFLE_FENWICK_TREE_H__
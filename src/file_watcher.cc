@@ -0,0 +1,84 @@
+#include "file_watcher.h"
+
+#ifdef ASHUFFLE_HAVE_INOTIFY
+#include <sys/inotify.h>
+#endif
+#include <unistd.h>
+
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <utility>
+
+#include <absl/strings/str_format.h>
+
+namespace ashuffle {
+
+absl::StatusOr<FileWatcher> FileWatcher::Create(
+    const std::filesystem::path& path) {
+#ifndef ASHUFFLE_HAVE_INOTIFY
+    (void)path;
+    return absl::UnimplementedError(
+        "watching files requires inotify, which this platform does not have");
+#else
+    std::filesystem::path dir = path.parent_path();
+    if (dir.empty()) {
+        dir = ".";
+    }
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0) {
+        return absl::UnavailableError(absl::StrFormat(
+            "failed to initialize inotify: %s", std::strerror(errno)));
+    }
+    // Rewrites in place end with the writer closing the file, replacements
+    // end with the new file being moved over the old one.
+    if (inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        close(fd);
+        return absl::UnavailableError(
+            absl::StrFormat("failed to watch '%s': %s", dir.string(),
+                            std::strerror(errno)));
+    }
+    return FileWatcher(fd, path.filename().string());
+#endif  // ASHUFFLE_HAVE_INOTIFY
+}
+
+FileWatcher::FileWatcher(FileWatcher&& other)
+    : fd_(std::exchange(other.fd_, -1)), name_(std::move(other.name_)) {}
+
+FileWatcher::~FileWatcher() {
+    if (fd_ >= 0) {
+        close(fd_);
+    }
+}
+
+bool FileWatcher::Changed() {
+#ifndef ASHUFFLE_HAVE_INOTIFY
+    // Watchers are never created without inotify.
+    return false;
+#else
+    bool changed = false;
+    alignas(struct inotify_event) char buf[sizeof(struct inotify_event) +
+                                           NAME_MAX + 1];
+    // Drain every pending event, so the descriptor is not readable again
+    // until the next change.
+    while (true) {
+        ssize_t n = read(fd_, buf, sizeof(buf));
+        if (n <= 0) {
+            return changed;
+        }
+        for (ssize_t pos = 0; pos < n;) {
+            const auto* event =
+                reinterpret_cast<const struct inotify_event*>(buf + pos);
+            // Other files in the same directory are ignored. If events were
+            // dropped, assume the file was one of them.
+            if ((event->len > 0 && name_ == event->name) ||
+                (event->mask & IN_Q_OVERFLOW)) {
+                changed = true;
+            }
+            pos += sizeof(struct inotify_event) + event->len;
+        }
+    }
+#endif  // ASHUFFLE_HAVE_INOTIFY
+}
+
+}  // namespace ashuffle
@@ -0,0 +1,48 @@
+#ifndef __ASHUFFLE_FILE_WATCHER_H__
+#define __ASHUFFLE_FILE_WATCHER_H__
+
+#include <filesystem>
+#include <string>
+#include <utility>
+
+#include <absl/status/statusor.h>
+
+namespace ashuffle {
+
+// FileWatcher uses inotify to notice when a file is rewritten. The directory
+// holding the file is watched, rather than the file itself, so the watch
+// keeps working when the file is replaced (e.g., by an editor saving it
+// through a rename). Writes are only noticed once the writer closes the
+// file, so the file is never seen half-written.
+class FileWatcher {
+   public:
+    // Start watching the file at `path`. The file does not need to exist.
+    // Returns an UNIMPLEMENTED error on platforms without inotify.
+    static absl::StatusOr<FileWatcher> Create(
+        const std::filesystem::path& path);
+
+    FileWatcher(FileWatcher&& other);
+    FileWatcher& operator=(FileWatcher&&) = delete;
+    FileWatcher(const FileWatcher&) = delete;
+    FileWatcher& operator=(const FileWatcher&) = delete;
+    ~FileWatcher();
+
+    // Return a file descriptor that becomes readable when the file may have
+    // changed, so it can be waited on along with other descriptors.
+    int Fd() const { return fd_; }
+
+    // Return true if the file has been rewritten or replaced since the last
+    // call. Never blocks.
+    bool Changed();
+
+   private:
+    FileWatcher(int fd, std::string name) : fd_(fd), name_(std::move(name)){};
+
+    int fd_;
+    // The name of the watched file within its directory.
+    std::string name_;
+};
+
+}  // namespace ashuffle
+
+#endif  // __ASHUFFLE_FILE_WATCHER_H__
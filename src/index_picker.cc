@@ -0,0 +1,152 @@
+#include "index_picker.h"
+
+#include <algorithm>
+#include <memory>
+#include <utility>
+
+#include <absl/status/status.h>
+
+namespace ashuffle {
+
+namespace {
+
+// The number of random positions to try before giving up on finding a song
+// accepted by the rules, and picking from a listing of every song instead.
+// This is only reached if the rules reject nearly every song.
+constexpr int kMaxAttempts = 100;
+
+}  // namespace
+
+IndexPicker::IndexPicker(const std::vector<Rule>& ruleset, size_t window,
+                         uint64_t seed)
+    : rules_(ruleset), window_(window), rng_(seed) {}
+
+void IndexPicker::Reset() {
+    count_.reset();
+    recent_.clear();
+    sparse_ = false;
+}
+
+bool IndexPicker::Accepts(const mpd::Song& song) const {
+    return std::all_of(rules_.begin(), rules_.end(),
+                       [&](const Rule& rule) { return rule.Accepts(song); });
+}
+
+absl::StatusOr<ItemView> IndexPicker::Pick(mpd::MPD* mpd) {
+    auto picked = [this](unsigned position, const mpd::Song& song) {
+        recent_.push_back(position);
+        if (recent_.size() > window_) {
+            recent_.pop_front();
+        }
+        picked_.assign(1, song.URI());
+        return ItemView(picked_);
+    };
+
+    for (int attempt = 0; attempt < kMaxAttempts && !sparse_; attempt++) {
+        if (!count_) {
+            absl::StatusOr<mpd::DBStats> stats = mpd->DatabaseStats();
+            if (!stats.ok()) {
+                return stats.status();
+            }
+            count_ = stats->songs;
+        }
+        if (*count_ == 0) {
+            return absl::FailedPreconditionError("no songs to pick from");
+        }
+
+        unsigned position =
+            static_cast<unsigned>(UniformBelow(rng_, *count_));
+        // Recent picks can only be avoided if there are other songs.
+        if (recent_.size() < *count_ &&
+            std::find(recent_.begin(), recent_.end(), position) !=
+                recent_.end()) {
+            continue;
+        }
+
+        absl::StatusOr<std::unique_ptr<mpd::Song>> song = SongAt(mpd, position);
+        if (!song.ok()) {
+            return song.status();
+        }
+        if (*song == nullptr) {
+            // Songs were removed since they were counted.
+            Reset();
+            continue;
+        }
+        if (!Accepts(**song)) {
+            continue;
+        }
+        return picked(position, **song);
+    }
+
+    sparse_ = true;
+    unsigned position = 0;
+    absl::StatusOr<std::unique_ptr<mpd::Song>> song =
+        PickFromListing(mpd, &position);
+    if (!song.ok()) {
+        return song.status();
+    }
+    if (*song == nullptr) {
+        return absl::FailedPreconditionError(
+            "no songs accepted by the rules to pick from");
+    }
+    return picked(position, **song);
+}
+
+absl::StatusOr<std::unique_ptr<mpd::Song>> IndexPicker::PickFromListing(
+    mpd::MPD* mpd, unsigned* position) {
+    absl::StatusOr<std::unique_ptr<mpd::SongReader>> reader =
+        mpd->ListMatching(mpd::kAllSongsFilter);
+    if (!reader.ok()) {
+        return reader.status();
+    }
+    // Accepted songs are sampled as they are listed, so only the current
+    // pick is held: the n-th candidate replaces it with probability 1/n.
+    // Recently picked songs are sampled separately, and only used if every
+    // accepted song was picked recently.
+    struct Sample {
+        std::unique_ptr<mpd::Song> song;
+        unsigned position = 0;
+        uint64_t seen = 0;
+    } fresh, recent;
+    for (unsigned at = 0; !(*reader)->Done(); at++) {
+        absl::StatusOr<std::unique_ptr<mpd::Song>> next = (*reader)->Next();
+        if (!next.ok()) {
+            return next.status();
+        }
+        if (!Accepts(**next)) {
+            continue;
+        }
+        Sample& sample =
+            std::find(recent_.begin(), recent_.end(), at) == recent_.end()
+                ? fresh
+                : recent;
+        if (UniformBelow(rng_, ++sample.seen) == 0) {
+            sample.song = std::move(*next);
+            sample.position = at;
+        }
+    }
+    Sample& sample = fresh.song != nullptr ? fresh : recent;
+    *position = sample.position;
+    return std::move(sample.song);
+}
+
+absl::StatusOr<std::unique_ptr<mpd::Song>> IndexPicker::SongAt(
+    mpd::MPD* mpd, unsigned position) {
+    absl::StatusOr<std::unique_ptr<mpd::SongReader>> reader =
+        mpd->ListMatching(mpd::kAllSongsFilter,
+                          mpd::Window{position, position + 1});
+    if (!reader.ok()) {
+        return reader.status();
+    }
+    std::unique_ptr<mpd::Song> song;
+    while (!(*reader)->Done()) {
+        absl::StatusOr<std::unique_ptr<mpd::Song>> next = (*reader)->Next();
+        if (!next.ok()) {
+            return next.status();
+        }
+        song = std::move(*next);
+    }
+    return song;
+}
+
+}  // namespace ashuffle
@@ -0,0 +1,80 @@
+#ifndef __ASHUFFLE_INDEX_PICKER_H__
+#define __ASHUFFLE_INDEX_PICKER_H__
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <absl/status/statusor.h>
+
+#include "mpd.h"
+#include "rng.h"
+#include "rule.h"
+#include "shuffle.h"
+
+namespace ashuffle {
+
+// IndexPicker picks random songs straight from MPD's database, rather than
+// from a loaded ShuffleChain. It counts the songs in the database once, and
+// then fetches each picked song by its position in MPD's listing, so it
+// never holds the library. Songs rejected by the rules are drawn again. Only the positions of the last
+// few picks are kept, to avoid repeating them. Every pick costs a round
+// trip to MPD, in which MPD searches its database up to the picked position,
+// so a pick takes time linear in the size of the library on the server.
+// MPD 0.21 or newer is required.
+//
+// If the rules reject nearly every song, picks that keep landing on rejected
+// songs fall back to listing every song, and picking among those accepted.
+//
+// Songs are picked uniformly: grouping, weights, and spread are not
+// supported.
+class IndexPicker {
+   public:
+    // Create a picker for the songs accepted by `ruleset`, which avoids
+    // repeating any of the last `window` picks.
+    IndexPicker(const std::vector<Rule>& ruleset, size_t window,
+                uint64_t seed);
+
+    // Pick a random song. The returned view is only valid until the next
+    // pick. Returns FAILED_PRECONDITION if no song is accepted by the rules.
+    absl::StatusOr<ItemView> Pick(mpd::MPD* mpd);
+
+    // Forget the number of songs (e.g., after a database update), so they
+    // are counted again on the next pick.
+    void Reset();
+
+   private:
+    // Return the song at the given position of MPD's listing, or nullptr
+    // if there is no such song.
+    absl::StatusOr<std::unique_ptr<mpd::Song>> SongAt(mpd::MPD* mpd,
+                                                      unsigned position);
+
+    // Pick a song accepted by the rules from a listing of every song,
+    // preferring songs that were not picked recently.
+    // Returns nullptr if no song is accepted.
+    absl::StatusOr<std::unique_ptr<mpd::Song>> PickFromListing(
+        mpd::MPD* mpd, unsigned* position);
+
+    // Returns true if `song` is accepted by every rule.
+    bool Accepts(const mpd::Song& song) const;
+
+    const std::vector<Rule>& rules_;
+    const size_t window_;
+    Xoshiro256 rng_;
+    // The number of songs in the database, once counted.
+    std::optional<unsigned> count_;
+    // Set once random positions failed to find a song accepted by the rules,
+    // so later picks go straight to PickFromListing, until Reset.
+    bool sparse_ = false;
+    // The positions of the last window_ picks, oldest first.
+    std::deque<unsigned> recent_;
+    // The most recently picked song.
+    std::vector<std::string> picked_;
+};
+
+}  // namespace ashuffle
+
+#endif  // __ASHUFFLE_INDEX_PICKER_H__
@@ -1,69 +1,836 @@
 #include "load.h"
 
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <functional>
 #include <iostream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <queue>
+#include <string_view>
+#include <thread>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
+#include <absl/container/flat_hash_map.h>
+#include <absl/container/inlined_vector.h>
 #include <absl/hash/hash.h>
+#include <absl/status/status.h>
+#include <absl/status/statusor.h>
+#include <absl/strings/numbers.h>
 #include <absl/strings/str_format.h>
+#include <absl/time/time.h>
+
+#include "log.h"
+#include "rng.h"
+#include "spsc_queue.h"
+#include "thread_pool.h"
 
 namespace ashuffle {
 
 namespace {
 
-// A Group is a vector of field values, present or not.
-typedef std::vector<std::optional<std::string>> Group;
+// TagInterner maps tag values to small integer ids, so songs can be grouped
+// by a few integers rather than by copies of their tag strings. Values are
+// split into shards by hash, each with its own lock, so values can be
+// interned from several threads at once.
+class TagInterner {
+   public:
+    // The id of a missing tag. No value is given this id.
+    static constexpr uint32_t kMissing = 0;
+
+    // Return the id of the given value, or kMissing if there is no value.
+    uint32_t Intern(const std::optional<std::string> &value) {
+        if (!value) {
+            return kMissing;
+        }
+        size_t shard_index = absl::Hash<std::string>{}(*value) % kShards;
+        Shard &shard = shards_[shard_index];
+        std::lock_guard<std::mutex> lock(shard.mu);
+        // Ids are unique across shards, since the low bits are the shard.
+        auto [it, _] = shard.ids.try_emplace(
+            *value,
+            static_cast<uint32_t>((shard.ids.size() * kShards + shard_index) +
+                                  1));
+        return it->second;
+    }
+
+   private:
+    static constexpr size_t kShards = 16;
+
+    struct Shard {
+        std::mutex mu;
+        absl::flat_hash_map<std::string, uint32_t> ids;
+    };
+
+    std::array<Shard, kShards> shards_;
+};
+
+// A GroupKey is the interned values of a song's group-by tags.
+typedef absl::InlinedVector<uint32_t, 4> GroupKey;
+
+// GroupedSong is an accepted song, waiting to be added to its group.
+struct GroupedSong {
+    GroupKey key;
+    // The hash of `key`, which picks the shard the song is aggregated in.
+    size_t hash;
+    std::string uri;
+    uint32_t weight;
+    // The interned value of the song's spread-by tag.
+    uint32_t spread_value;
+};
+
+// GroupSongs holds the URIs of the songs in a group, the sum of their
+// weights, and the spread-by tag of the first song.
+struct GroupSongs {
+    // The index of the first song in the group, among all grouped songs.
+    size_t first;
+    std::vector<std::string> uris;
+    uint64_t weight = 0;
+    uint32_t spread_value = TagInterner::kMissing;
+};
+
+// Aggregate the given songs into groups of songs with equal keys. Songs are
+// split into `shards` shards by the hash of their key, and each shard is
+// aggregated independently, on `pool` if set. Groups are returned in the
+// order of their first song, regardless of the number of shards.
+std::vector<GroupSongs> Aggregate(std::vector<GroupedSong> &grouped,
+                                  size_t shards, ThreadPool *pool) {
+    // Songs are partitioned in a single pass, so each shard only visits its
+    // own songs, in order.
+    std::vector<std::vector<size_t>> buckets(shards);
+    if (shards > 1) {
+        for (std::vector<size_t> &bucket : buckets) {
+            bucket.reserve(grouped.size() / shards);
+        }
+        for (size_t i = 0; i < grouped.size(); i++) {
+            buckets[grouped[i].hash % shards].push_back(i);
+        }
+    }
+    std::vector<std::vector<GroupSongs>> sharded(shards);
+    std::function<void(size_t, size_t)> aggregate = [&](size_t begin,
+                                                        size_t end) {
+        for (size_t shard = begin; shard < end; shard++) {
+            absl::flat_hash_map<GroupKey, size_t> index;
+            std::vector<GroupSongs> &groups = sharded[shard];
+            auto add = [&](size_t i) {
+                GroupedSong &song = grouped[i];
+                auto [it, inserted] =
+                    index.try_emplace(song.key, groups.size());
+                if (inserted) {
+                    GroupSongs &group = groups.emplace_back();
+                    group.first = i;
+                    group.spread_value = song.spread_value;
+                }
+                GroupSongs &group = groups[it->second];
+                group.weight += song.weight;
+                group.uris.push_back(std::move(song.uri));
+            };
+            if (shards == 1) {
+                for (size_t i = 0; i < grouped.size(); i++) {
+                    add(i);
+                }
+            } else {
+                for (size_t i : buckets[shard]) {
+                    add(i);
+                }
+                std::vector<size_t>().swap(buckets[shard]);
+            }
+        }
+    };
+    if (pool != nullptr) {
+        pool->ParallelFor(shards, 1, aggregate);
+    } else {
+        aggregate(0, shards);
+    }
+
+    std::vector<GroupSongs> groups;
+    for (std::vector<GroupSongs> &shard : sharded) {
+        std::move(shard.begin(), shard.end(), std::back_inserter(groups));
+    }
+    std::sort(groups.begin(), groups.end(),
+              [](const GroupSongs &a, const GroupSongs &b) {
+                  return a.first < b.first;
+              });
+    return groups;
+}
+
+// A SampleGroup is the values of a song's group-by tags, present or not.
+typedef std::vector<std::optional<std::string>> SampleGroup;
+
+// GroupSample is a group of songs sampled by SampleMPDLoader.
+struct GroupSample {
+    std::vector<std::string> uris;
+    uint64_t weight = 0;
+    // The spread-by tag of the first song.
+    std::optional<std::string> spread_value;
+};
+
+// SampledSong is a song sampled by SampleMPDLoader, with its sample key.
+struct SampledSong {
+    double key;
+    std::string uri;
+    std::optional<std::string> spread_value;
+
+    // Songs are ordered by key, so a priority queue has the largest key on
+    // top.
+    bool operator<(const SampledSong &other) const { return key < other.key; }
+};
+
+// Mix the bits of `x`, so similar inputs give unrelated outputs. This is
+// the splitmix64 finalizer.
+uint64_t Mix(uint64_t x) {
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+    return x ^ (x >> 31);
+}
+
+// Parse a sticker value as a song weight. Weights are clamped to at least 1,
+// so every song can still be picked.
+std::optional<uint32_t> ParseWeight(std::string_view value) {
+    uint32_t weight;
+    if (!absl::SimpleAtoi(value, &weight)) {
+        return std::nullopt;
+    }
+    return std::max<uint32_t>(weight, 1);
+}
+
+// Return `status` with `context` prepended to its message.
+absl::Status Annotate(const absl::Status &status, std::string_view context) {
+    return absl::Status(status.code(),
+                        absl::StrFormat("%s: %s", context, status.message()));
+}
+
+// CachedSong is a copy of a song's URI, and the tags the loader uses. Unlike
+// songs received from MPD, it does not refer to any libmpdclient objects,
+// so it can be read from several threads at once.
+struct CachedSong {
+    std::string uri;
+    // Every value of each tag, in order, so tags with several values are
+    // matched by rules the same way as the song they were copied from.
+    std::vector<std::pair<enum mpd_tag_type, std::string>> tags;
+};
+
+// Copy the URI and the given tags of `song`.
+CachedSong CopySong(const mpd::Song &song,
+                    const std::vector<enum mpd_tag_type> &tags) {
+    CachedSong cached;
+    cached.uri = song.URI();
+    for (enum mpd_tag_type tag : tags) {
+        for (std::string &value : song.TagValues(tag)) {
+            cached.tags.emplace_back(tag, std::move(value));
+        }
+    }
+    return cached;
+}
+
+// A SongBatch is a batch of songs passed from the thread receiving songs to
+// the thread loading them.
+typedef std::vector<CachedSong> SongBatch;
 
-// A GroupMap is a mapping from Groups to song URI vectors of the URIs in the
-// given group.
-typedef std::unordered_map<Group, std::vector<std::string>, absl::Hash<Group>>
-    GroupMap;
+// The number of songs in a SongBatch, and the number of batches that can be
+// queued before the receiving thread waits.
+constexpr size_t kBatchSize = 256;
+constexpr size_t kQueuedBatches = 16;
+
+// The number of songs in each task when songs are verified in parallel.
+constexpr size_t kVerifyGrain = 32;
+
+// SongRef is a Song that refers to a CachedSong, so cached songs can be
+// loaded without copying them.
+class SongRef : public mpd::Song {
+   public:
+    SongRef(const CachedSong *song) : song_(song){};
+
+    std::optional<std::string> Tag(enum mpd_tag_type tag) const override {
+        for (const auto &[t, value] : song_->tags) {
+            if (t == tag) {
+                return value;
+            }
+        }
+        return std::nullopt;
+    }
+
+    std::vector<std::string> TagValues(enum mpd_tag_type tag) const override {
+        std::vector<std::string> values;
+        for (const auto &[t, value] : song_->tags) {
+            if (t == tag) {
+                values.push_back(value);
+            }
+        }
+        return values;
+    }
+
+    std::string URI() const override { return song_->uri; }
+
+   private:
+    const CachedSong *song_;
+};
+
+}  // namespace
+
+// DirectoryCache holds the songs and directories found by the last load of
+// an IncrementalMPDLoader.
+class DirectoryCache {
+   public:
+    struct Directory {
+        absl::Time last_modified = absl::InfinitePast();
+        // The paths of the directories directly inside this directory.
+        std::vector<std::string> directories;
+        // The songs directly inside this directory that passed Verify.
+        std::vector<CachedSong> songs;
+        // The load this directory was last seen in, zero if never.
+        uint64_t load = 0;
+    };
+
+    std::unordered_map<std::string, Directory> dirs;
+    // The directories seen by the last load, in the order they were visited,
+    // so songs are always loaded in the same order.
+    std::vector<const Directory *> order;
+    uint64_t load = 0;
+};
+
+namespace {
+
+// CachedSongReader is a SongReader over all songs in a DirectoryCache.
+class CachedSongReader : public mpd::SongReader {
+   public:
+    CachedSongReader(const DirectoryCache &cache) : cache_(cache) { Skip(); };
+
+    absl::StatusOr<std::unique_ptr<mpd::Song>> Next() override {
+        if (Done()) {
+            return absl::OutOfRangeError("song reader done");
+        }
+        auto song =
+            std::make_unique<SongRef>(&cache_.order[dir_]->songs[song_]);
+        song_++;
+        Skip();
+        return song;
+    }
+
+    bool Done() override { return dir_ == cache_.order.size(); }
+
+   private:
+    // Advance past directories that have no songs left.
+    void Skip() {
+        while (dir_ < cache_.order.size() &&
+               song_ == cache_.order[dir_]->songs.size()) {
+            dir_++;
+            song_ = 0;
+        }
+    }
+
+    const DirectoryCache &cache_;
+    size_t dir_ = 0;
+    size_t song_ = 0;
+};
+
+// ChunkedSongReader is a SongReader over the songs matching a filter, that
+// lists them `chunk_size` songs at a time. Each chunk is a separate request,
+// so MPD only has to buffer the response for one chunk at a time.
+class ChunkedSongReader : public mpd::SongReader {
+   public:
+    static absl::StatusOr<std::unique_ptr<mpd::SongReader>> Open(
+        mpd::MPD *mpd, std::string filter, unsigned chunk_size) {
+        auto reader = std::unique_ptr<ChunkedSongReader>(
+            new ChunkedSongReader(mpd, std::move(filter), chunk_size));
+        if (absl::Status status = reader->ListChunk(); !status.ok()) {
+            return status;
+        }
+        return reader;
+    }
+
+    absl::StatusOr<std::unique_ptr<mpd::Song>> Next() override {
+        if (Done()) {
+            return absl::OutOfRangeError("song reader done");
+        }
+        if (!status_.ok()) {
+            return status_;
+        }
+        listed_++;
+        return chunk_->Next();
+    }
+
+    bool Done() override {
+        // If listing the next chunk failed, the reader is not done: the
+        // error is returned by the next call to Next.
+        if (!status_.ok()) {
+            return false;
+        }
+        if (!chunk_->Done()) {
+            return false;
+        }
+        // A short chunk is the last one.
+        if (listed_ < chunk_size_) {
+            return true;
+        }
+        start_ += chunk_size_;
+        listed_ = 0;
+        if (absl::Status status = ListChunk(); !status.ok()) {
+            status_ = std::move(status);
+            return false;
+        }
+        return chunk_->Done();
+    }
+
+   private:
+    ChunkedSongReader(mpd::MPD *mpd, std::string filter, unsigned chunk_size)
+        : mpd_(mpd), filter_(std::move(filter)), chunk_size_(chunk_size){};
+
+    // List the chunk starting at `start_`.
+    absl::Status ListChunk() {
+        // Release the previous chunk first, it has been fully read.
+        chunk_.reset();
+        auto chunk_or = mpd_->ListMatching(
+            filter_, mpd::Window{start_, start_ + chunk_size_});
+        if (!chunk_or.ok()) {
+            return chunk_or.status();
+        }
+        chunk_ = std::move(*chunk_or);
+        return absl::OkStatus();
+    }
+
+    mpd::MPD *mpd_;
+    const std::string filter_;
+    const unsigned chunk_size_;
+    // The position of the first song in the current chunk.
+    unsigned start_ = 0;
+    // The number of songs read from the current chunk.
+    unsigned listed_ = 0;
+    std::unique_ptr<mpd::SongReader> chunk_;
+    // The error from listing the current chunk, if any.
+    absl::Status status_;
+};
 
 }  // namespace
 
 /* build the list of songs to shuffle from using MPD */
 void MPDLoader::Load(ShuffleChain *songs) {
-    GroupMap groups;
+    if (absl::Status status = TryLoad(songs); !status.ok()) {
+        Die("Failed to load songs: %s", status.ToString());
+    }
+}
+
+absl::Status MPDLoader::TryLoad(ShuffleChain *songs) {
+    // Stickers must be fetched before the listing is started, since MPD
+    // cannot handle another request while the listing is streamed.
+    absl::StatusOr<std::unordered_map<std::string, std::string>> stickers =
+        Stickers();
+    if (!stickers.ok()) {
+        return stickers.status();
+    }
+    mpd::MPD::MetadataOption metadata = Metadata();
 
-    mpd::MPD::MetadataOption metadata = mpd::MPD::MetadataOption::kInclude;
-    if (rules_.empty() && group_by_.empty()) {
+    // Chunked listings always include metadata, so restrict it to the
+    // tags we use, even if that is none at all.
+    bool restricted = false;
+    if (metadata == mpd::MPD::MetadataOption::kInclude ||
+        listing_.chunk_size > 0) {
+        restricted = RestrictTagTypes();
+    }
+
+    absl::Status status;
+    if (absl::StatusOr<std::unique_ptr<mpd::SongReader>> reader =
+            List(metadata);
+        reader.ok()) {
+        status = LoadFrom(reader->get(), *stickers, songs);
+    } else {
+        status = reader.status();
+    }
+    if (restricted) {
+        ResetTagTypes();
+    }
+    return status;
+}
+
+mpd::MPD::MetadataOption MPDLoader::Metadata() const {
+    if (rules_.empty() && group_by_.empty() && !spread_by_) {
         // If we don't need to process any rules, or group tracks, then we
         // can omit metadata from the query. This is an optimization,
         // mainly to avoid
         // https://github.com/MusicPlayerDaemon/libmpdclient/issues/69
-        metadata = mpd::MPD::MetadataOption::kOmit;
+        return mpd::MPD::MetadataOption::kOmit;
+    }
+    return mpd::MPD::MetadataOption::kInclude;
+}
+
+absl::StatusOr<std::unique_ptr<mpd::SongReader>> MPDLoader::List(
+    mpd::MPD::MetadataOption metadata) {
+    if (listing_.chunk_size > 0) {
+        absl::StatusOr<std::unique_ptr<mpd::SongReader>> reader_or =
+            ChunkedSongReader::Open(mpd_, mpd::kAllSongsFilter,
+                                    listing_.chunk_size);
+        if (reader_or.ok()) {
+            return std::move(*reader_or);
+        }
+        if (!absl::IsUnimplemented(reader_or.status())) {
+            return Annotate(reader_or.status(), "failed to get reader");
+        }
+        Log().Info("Listing all songs at once: %s",
+                   reader_or.status().ToString());
     }
 
     auto reader_or = mpd_->ListAll(metadata);
     if (!reader_or.ok()) {
-        Die("Failed to get reader: %s", reader_or.status().ToString());
+        return Annotate(reader_or.status(), "failed to get reader");
+    }
+    return std::move(*reader_or);
+}
+
+absl::StatusOr<std::unordered_map<std::string, std::string>>
+MPDLoader::Stickers() {
+    if (weighting_.sticker.empty()) {
+        return std::unordered_map<std::string, std::string>();
+    }
+    // Fetch all weights up-front in a single request, rather than asking
+    // MPD for the sticker of each song as it is listed.
+    auto stickers_or = mpd_->SongStickers(weighting_.sticker);
+    if (!stickers_or.ok()) {
+        return Annotate(stickers_or.status(),
+                        absl::StrFormat("failed to get '%s' stickers",
+                                        weighting_.sticker));
+    }
+    return std::move(*stickers_or);
+}
+
+uint32_t MPDLoader::WeightOf(
+    const std::unordered_map<std::string, std::string> &stickers,
+    const std::string &uri) const {
+    if (weighting_.sticker.empty()) {
+        return kDefaultWeight;
+    }
+    if (auto it = stickers.find(uri); it != stickers.end()) {
+        if (std::optional<uint32_t> weight = ParseWeight(it->second)) {
+            return *weight;
+        }
+    }
+    return std::max<uint32_t>(weighting_.missing, 1);
+}
+
+void SampleMPDLoader::Load(ShuffleChain *songs) {
+    if (n_ == 0) {
+        return;
+    }
+    absl::StatusOr<std::unordered_map<std::string, std::string>> stickers_or =
+        Stickers();
+    if (!stickers_or.ok()) {
+        Die("Failed to load songs: %s", stickers_or.status().ToString());
+    }
+    std::unordered_map<std::string, std::string> stickers =
+        std::move(*stickers_or);
+    mpd::MPD::MetadataOption metadata = Metadata();
+    bool restricted = false;
+    if (metadata == mpd::MPD::MetadataOption::kInclude ||
+        listing_.chunk_size > 0) {
+        restricted = RestrictTagTypes();
+    }
+    absl::StatusOr<std::unique_ptr<mpd::SongReader>> reader_or =
+        List(metadata);
+    if (!reader_or.ok()) {
+        Die("Failed to load songs: %s", reader_or.status().ToString());
     }
     std::unique_ptr<mpd::SongReader> reader = std::move(*reader_or);
 
+    // Every song (or group) is given a random key, and the n_ songs with
+    // the smallest keys are kept. Songs are keyed by an exponentially
+    // distributed value with a rate equal to their weight, which samples
+    // them in proportion to their weight (Efraimidis and Spirakis). Groups
+    // are keyed by a salted hash of their tags, so all songs of a group
+    // get the same key, and a group that is dropped is never added back.
+    Xoshiro256 rng(seed_);
+    const uint64_t salt = rng();
+    auto group_key = [salt](const SampleGroup &group) {
+        uint64_t key = salt;
+        for (const std::optional<std::string> &value : group) {
+            key = Mix(key ^ (value ? std::hash<std::string>{}(*value) : 0));
+            key = Mix(key ^ value.has_value());
+        }
+        return key;
+    };
+
+    // Ungrouped songs, with the largest key first.
+    std::priority_queue<SampledSong> sampled;
+    // Groups, ordered by key, then tags, so the group with the largest key
+    // is last.
+    std::map<std::pair<uint64_t, SampleGroup>, GroupSample> groups;
+
     while (!reader->Done()) {
-        std::unique_ptr<mpd::Song> song = *reader->Next();
-        if (!Verify(*song)) {
+        absl::StatusOr<std::unique_ptr<mpd::Song>> song_or = reader->Next();
+        if (!song_or.ok()) {
+            Die("Failed to read songs: %s", song_or.status().ToString());
+        }
+        const mpd::Song &song = **song_or;
+        if (!Verify(song)) {
             continue;
         }
+        std::optional<std::string> spread_value;
+        if (spread_by_) {
+            spread_value = song.Tag(*spread_by_);
+        }
 
         if (group_by_.empty()) {
-            songs->Add(song->URI());
+            std::string uri = song.URI();
+            // 53 random bits, as a double in (0, 1].
+            double u = static_cast<double>((rng() >> 11) + 1) * 0x1p-53;
+            double key = -std::log(u) / WeightOf(stickers, uri);
+            if (sampled.size() == n_ && key >= sampled.top().key) {
+                continue;
+            }
+            sampled.push(SampledSong{key, std::move(uri),
+                                     std::move(spread_value)});
+            if (sampled.size() > n_) {
+                sampled.pop();
+            }
             continue;
         }
-        Group group;
-        for (auto &field : group_by_) {
-            group.emplace_back(song->Tag(field));
+
+        SampleGroup group;
+        for (enum mpd_tag_type field : group_by_) {
+            group.emplace_back(song.Tag(field));
+        }
+        uint64_t key = group_key(group);
+        if (groups.size() == n_ && key > std::prev(groups.end())->first.first) {
+            continue;
+        }
+        std::string uri = song.URI();
+        auto [it, inserted] =
+            groups.try_emplace(std::make_pair(key, std::move(group)));
+        if (inserted) {
+            it->second.spread_value = std::move(spread_value);
+        }
+        it->second.weight += WeightOf(stickers, uri);
+        it->second.uris.push_back(std::move(uri));
+        if (groups.size() > n_) {
+            groups.erase(std::prev(groups.end()));
         }
-        groups[group].push_back(song->URI());
     }
-
-    if (group_by_.empty()) {
-        return;
+    if (restricted) {
+        ResetTagTypes();
     }
 
+    // Spread keys are numbered in the order items are added.
+    std::unordered_map<std::string, uint32_t> spread_ids;
+    auto set_spread_key = [&](const std::optional<std::string> &value) {
+        if (!value) {
+            return;
+        }
+        // Ids start at 1, since 0 is kNoSpreadKey.
+        auto [it, _] = spread_ids.try_emplace(
+            *value, static_cast<uint32_t>(spread_ids.size() + 1));
+        songs->SetSpreadKey(songs->Len() - 1, it->second);
+    };
+
+    // Songs are added in order of their keys, so the chain does not depend
+    // on the order of the heap.
+    std::vector<SampledSong> ordered;
+    for (; !sampled.empty(); sampled.pop()) {
+        ordered.push_back(sampled.top());
+    }
+    for (auto it = ordered.rbegin(); it != ordered.rend(); ++it) {
+        // Songs are already sampled by weight, so the sample is picked from
+        // uniformly.
+        songs->Add(it->uri);
+        set_spread_key(it->spread_value);
+    }
     for (auto &&[_, group] : groups) {
-        songs->Add(group);
+        size_t n = group.uris.size();
+        uint64_t weight = std::max<uint64_t>((group.weight + n / 2) / n, 1);
+        songs->Add(ShuffleItem(std::move(group.uris),
+                               static_cast<uint32_t>(weight)));
+        set_spread_key(group.spread_value);
+    }
+}
+
+absl::Status MPDLoader::LoadFrom(
+    mpd::SongReader *reader,
+    const std::unordered_map<std::string, std::string> &stickers,
+    ShuffleChain *songs, bool verified) {
+    auto weight_of = [&](const std::string &uri) {
+        return WeightOf(stickers, uri);
+    };
+
+    // Tag values are dictionary-encoded into small integers, so the chain
+    // can check the spread constraint without comparing strings.
+    std::unordered_map<std::string, uint32_t> spread_ids;
+    auto spread_key_of = [&](const mpd::Song &song) -> uint32_t {
+        if (!spread_by_) {
+            return kNoSpreadKey;
+        }
+        std::optional<std::string> value = song.Tag(*spread_by_);
+        if (!value) {
+            return kNoSpreadKey;
+        }
+        // Ids start at 1, since 0 is kNoSpreadKey.
+        auto [it, _] = spread_ids.try_emplace(
+            std::move(*value), static_cast<uint32_t>(spread_ids.size() + 1));
+        return it->second;
+    };
+
+    // Grouped songs are keyed by interned tag values, which is much cheaper
+    // than keying them by copies of the values. Keys are computed along with
+    // Verify, so they can be computed in parallel.
+    const bool grouping = !group_by_.empty();
+    TagInterner interner;
+    auto group_song = [&](const mpd::Song &song) -> GroupedSong {
+        GroupedSong grouped;
+        for (enum mpd_tag_type field : group_by_) {
+            grouped.key.push_back(interner.Intern(song.Tag(field)));
+        }
+        grouped.hash = absl::Hash<GroupKey>{}(grouped.key);
+        grouped.uri = song.URI();
+        grouped.weight = weight_of(grouped.uri);
+        if (spread_by_) {
+            grouped.spread_value = interner.Intern(song.Tag(*spread_by_));
+        } else {
+            grouped.spread_value = TagInterner::kMissing;
+        }
+        return grouped;
+    };
+    std::vector<GroupedSong> grouped;
+
+    auto add = [&](const mpd::Song &song) {
+        std::string uri = song.URI();
+        songs->Add(uri, weight_of(uri));
+        if (uint32_t key = spread_key_of(song); key != kNoSpreadKey) {
+            songs->SetSpreadKey(songs->Len() - 1, key);
+        }
+    };
+
+    // Without rules to check or songs to group, there is no work to overlap
+    // with receiving songs, so they are added straight from the reader.
+    // Verify is still called, but is cheap without rules.
+    if ((rules_.empty() || verified) && !grouping) {
+        size_t received = 0;
+        while (!reader->Done()) {
+            absl::StatusOr<std::unique_ptr<mpd::Song>> song = reader->Next();
+            if (!song.ok()) {
+                return Annotate(song.status(), "failed to read songs");
+            }
+            if (verified || Verify(**song)) {
+                add(**song);
+            }
+            if (progress_ && ++received % kBatchSize == 0) {
+                progress_(*songs);
+            }
+        }
+        // Progress is reported once per batch of songs, as below.
+        if (progress_ && received % kBatchSize != 0) {
+            progress_(*songs);
+        }
+        return absl::OkStatus();
+    }
+
+    // Songs are received on a separate thread, so waiting for MPD overlaps
+    // with checking and grouping the songs already received. Songs are
+    // passed in batches, in the order they were received. Only the tags
+    // we use are copied, and the songs from MPD are freed right away.
+    std::vector<enum mpd_tag_type> tags = UsedTags();
+    SPSCQueue<SongBatch> queue(kQueuedBatches);
+    absl::Status receive_status;
+    std::thread receiver([&] {
+        SongBatch batch;
+        while (!reader->Done()) {
+            absl::StatusOr<std::unique_ptr<mpd::Song>> song = reader->Next();
+            if (!song.ok()) {
+                receive_status = song.status();
+                break;
+            }
+            batch.push_back(CopySong(**song, tags));
+            if (batch.size() == kBatchSize) {
+                queue.Push(std::move(batch));
+                batch = SongBatch();
+            }
+        }
+        if (!batch.empty()) {
+            queue.Push(std::move(batch));
+        }
+        // An empty batch marks the end of the songs.
+        queue.Push(SongBatch());
+    });
+    // Large rulesets make Verify the most expensive step, and grouping
+    // many songs is expensive too, so both are run on a pool of threads.
+    // Songs are still added in order, on this thread.
+    std::optional<ThreadPool> pool;
+    if (listing_.threads > 1 && ((!rules_.empty() && !verified) || grouping)) {
+        pool.emplace(listing_.threads);
     }
+    std::vector<char> accepted;
+    std::vector<GroupedSong> batch_grouped;
+    for (SongBatch batch = queue.Pop(); !batch.empty(); batch = queue.Pop()) {
+        accepted.assign(batch.size(), false);
+        if (grouping) {
+            batch_grouped.resize(batch.size());
+        }
+        std::function<void(size_t, size_t)> verify = [&](size_t begin,
+                                                         size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                SongRef song(&batch[i]);
+                accepted[i] = verified || Verify(song);
+                if (accepted[i] && grouping) {
+                    batch_grouped[i] = group_song(song);
+                }
+            }
+        };
+        if (pool) {
+            pool->ParallelFor(batch.size(), kVerifyGrain, verify);
+        } else {
+            verify(0, batch.size());
+        }
+        for (size_t i = 0; i < batch.size(); i++) {
+            if (!accepted[i]) {
+                continue;
+            }
+            if (grouping) {
+                grouped.push_back(std::move(batch_grouped[i]));
+            } else {
+                add(SongRef(&batch[i]));
+            }
+        }
+        if (!grouping && progress_) {
+            progress_(*songs);
+        }
+    }
+    receiver.join();
+    if (!receive_status.ok()) {
+        return Annotate(receive_status, "failed to read songs");
+    }
+
+    if (!grouping) {
+        return absl::OkStatus();
+    }
+
+    std::vector<GroupSongs> groups =
+        Aggregate(grouped, pool ? listing_.threads : 1,
+                  pool ? &*pool : nullptr);
+    // Spread keys are numbered in the order the groups are added, so they
+    // do not depend on the number of threads.
+    absl::flat_hash_map<uint32_t, uint32_t> spread_keys;
+    for (GroupSongs &group : groups) {
+        // A group is weighted by the average weight of its songs, so large
+        // groups are not favored over small ones.
+        uint64_t weight = std::max<uint64_t>(
+            (group.weight + group.uris.size() / 2) / group.uris.size(), 1);
+        songs->Add(ShuffleItem(std::move(group.uris),
+                               static_cast<uint32_t>(weight)));
+        if (group.spread_value != TagInterner::kMissing) {
+            // Ids start at 1, since 0 is kNoSpreadKey.
+            auto [it, _] = spread_keys.try_emplace(
+                group.spread_value,
+                static_cast<uint32_t>(spread_keys.size() + 1));
+            songs->SetSpreadKey(songs->Len() - 1, it->second);
+        }
+    }
+    return absl::OkStatus();
 }
 
 bool MPDLoader::Verify(const mpd::Song &song) {
@@ -75,19 +842,140 @@ bool MPDLoader::Verify(const mpd::Song &song) {
     return true;
 }
 
+std::vector<enum mpd_tag_type> MPDLoader::UsedTags() const {
+    std::vector<enum mpd_tag_type> tags = group_by_;
+    for (const Rule &rule : rules_) {
+        for (const Pattern &pattern : rule.Patterns()) {
+            tags.push_back(pattern.tag);
+        }
+    }
+    if (spread_by_) {
+        tags.push_back(*spread_by_);
+    }
+    std::sort(tags.begin(), tags.end());
+    tags.erase(std::unique(tags.begin(), tags.end()), tags.end());
+    return tags;
+}
+
+bool MPDLoader::RestrictTagTypes() {
+    absl::Status status = mpd_->RestrictTagTypes(UsedTags());
+    if (!status.ok()) {
+        Log().Info("Not restricting MPD tag types: %s", status.ToString());
+        return false;
+    }
+    return true;
+}
+
+void MPDLoader::ResetTagTypes() {
+    if (absl::Status status = mpd_->AllTagTypes(); !status.ok()) {
+        Log().Error("Failed to reset MPD tag types: %s", status.ToString());
+    }
+}
+
+IncrementalMPDLoader::IncrementalMPDLoader(
+    mpd::MPD *mpd, const std::vector<Rule> &ruleset,
+    const std::vector<enum mpd_tag_type> &group_by, Weighting weighting,
+    std::optional<enum mpd_tag_type> spread_by)
+    : MPDLoader(mpd, ruleset, group_by, std::move(weighting), spread_by),
+      cache_(std::make_unique<DirectoryCache>()) {}
+
+IncrementalMPDLoader::~IncrementalMPDLoader() = default;
+
+void IncrementalMPDLoader::Load(ShuffleChain *songs) {
+    absl::StatusOr<std::unordered_map<std::string, std::string>> stickers =
+        Stickers();
+    if (!stickers.ok()) {
+        Die("Failed to load songs: %s", stickers.status().ToString());
+    }
+    std::vector<enum mpd_tag_type> tags = UsedTags();
+    bool restricted = RestrictTagTypes();
+
+    uint64_t load = ++cache_->load;
+    cache_->order.clear();
+    // Directories are visited depth-first. Every directory but the root
+    // is pushed along with the last-modified time from its parent's listing.
+    std::vector<std::pair<std::string, std::optional<absl::Time>>> stack;
+    stack.emplace_back("", std::nullopt);
+    while (!stack.empty()) {
+        auto [path, last_modified] = std::move(stack.back());
+        stack.pop_back();
+
+        // References to map values stay valid as the map grows.
+        DirectoryCache::Directory &dir = cache_->dirs[path];
+        bool unchanged = dir.load != 0 && last_modified.has_value() &&
+                         dir.last_modified == *last_modified;
+        dir.load = load;
+        cache_->order.push_back(&dir);
+        if (unchanged && dir.directories.empty()) {
+            continue;
+        }
+
+        absl::StatusOr<mpd::DirectoryListing> listing =
+            mpd_->ListDirectory(path);
+        if (!listing.ok()) {
+            Die("Failed to list directory '%s': %s", path,
+                listing.status().ToString());
+        }
+        dir.last_modified = last_modified.value_or(absl::InfinitePast());
+        dir.songs.clear();
+        for (const std::unique_ptr<mpd::Song> &song : listing->songs) {
+            if (!Verify(*song)) {
+                continue;
+            }
+            dir.songs.push_back(CopySong(*song, tags));
+        }
+        dir.directories.clear();
+        for (const mpd::Directory &sub : listing->directories) {
+            dir.directories.push_back(sub.path);
+        }
+        // Push in reverse, so sub-directories are visited in listing order.
+        for (auto it = listing->directories.rbegin();
+             it != listing->directories.rend(); ++it) {
+            stack.emplace_back(it->path, it->last_modified);
+        }
+    }
+
+    if (restricted) {
+        ResetTagTypes();
+    }
+
+    // Forget directories that were removed since the last load.
+    for (auto it = cache_->dirs.begin(); it != cache_->dirs.end();) {
+        if (it->second.load != load) {
+            it = cache_->dirs.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    // Songs were checked with Verify as their directories were listed.
+    CachedSongReader reader(*cache_);
+    if (absl::Status status = LoadFrom(&reader, *stickers, songs, true);
+        !status.ok()) {
+        Die("Failed to load songs: %s", status.ToString());
+    }
+}
+
 FileMPDLoader::FileMPDLoader(mpd::MPD *mpd, const std::vector<Rule> &ruleset,
                              const std::vector<enum mpd_tag_type> &group_by,
                              std::istream *file)
-    : MPDLoader(mpd, ruleset, group_by), file_(file) {
-    for (std::string uri; std::getline(*file_, uri);) {
-        valid_uris_.emplace_back(uri);
+    : MPDLoader(mpd, ruleset, group_by) {
+    for (std::string uri; std::getline(*file, uri);) {
+        valid_uris_.Insert(uri);
     }
-    std::sort(valid_uris_.begin(), valid_uris_.end());
+}
+
+FileMPDLoader::FileMPDLoader(mpd::MPD *mpd, const std::vector<Rule> &ruleset,
+                             const std::vector<enum mpd_tag_type> &group_by,
+                             std::string_view contents)
+    : MPDLoader(mpd, ruleset, group_by) {
+    valid_uris_.Reserve(std::count(contents.begin(), contents.end(), '\n') + 1);
+    ForEachLine(contents,
+                [this](std::string_view uri) { valid_uris_.Insert(uri); });
 }
 
 bool FileMPDLoader::Verify(const mpd::Song &song) {
-    if (!std::binary_search(valid_uris_.begin(), valid_uris_.end(),
-                            song.URI())) {
+    if (!valid_uris_.Contains(song.URI())) {
         // If the URI for this song is not in the list of valid_uris_, then
         // it shouldn't be loaded by this loader.
         return false;
@@ -98,9 +986,116 @@ bool FileMPDLoader::Verify(const mpd::Song &song) {
 }
 
 void FileLoader::Load(ShuffleChain *songs) {
+    if (mapped_.has_value() || contents_.has_value()) {
+        std::string_view contents =
+            mapped_.has_value() ? mapped_->Contents() : *contents_;
+        ForEachLine(contents,
+                    [songs](std::string_view uri) { songs->Add(uri); });
+        return;
+    }
     for (std::string uri; std::getline(*file_, uri);) {
         songs->Add(uri);
     }
 }
 
+ProgressiveLoad::ProgressiveLoad(std::unique_ptr<mpd::MPD> mpd,
+                                 std::unique_ptr<Loader> loader,
+                                 size_t first_items)
+    : mpd_(std::move(mpd)),
+      loader_(std::move(loader)),
+      first_items_(first_items) {
+    if (pipe(wake_fds_) != 0) {
+        // Not fatal, the loaded library is just picked up on the next MPD
+        // event, rather than as soon as it is loaded.
+        Log().Error("Failed to create pipe: %s", std::strerror(errno));
+        wake_fds_[0] = wake_fds_[1] = -1;
+    }
+    // The thread is only started once the pipe exists.
+    thread_ = std::thread(&ProgressiveLoad::Run, this);
+}
+
+ProgressiveLoad::~ProgressiveLoad() {
+    thread_.join();
+    for (int fd : wake_fds_) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+}
+
+void ProgressiveLoad::Run() {
+    loader_->OnProgress([this](const ShuffleChain &loaded) {
+        if (first_taken_ || loaded.Len() < first_items_) {
+            return;
+        }
+        first_taken_ = true;
+        // The first items are copied, since loading continues into the
+        // original. This is cheap, since there are only a few of them.
+        std::lock_guard<std::mutex> lock(mu_);
+        first_.emplace(loaded);
+        wake_.notify_all();
+    });
+    // Errors are handed to the caller's thread, rather than exiting from
+    // this one while the caller is still running.
+    absl::Status status = loader_->TryLoad(&loaded_);
+    // Loaders hold their connection for as long as they exist, so free both
+    // as soon as they are no longer needed.
+    loader_.reset();
+    mpd_.reset();
+
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        done_.emplace(std::move(loaded_));
+        status_ = std::move(status);
+        wake_.notify_all();
+    }
+    if (wake_fds_[1] >= 0) {
+        char done = 0;
+        while (write(wake_fds_[1], &done, 1) < 0 && errno == EINTR) {
+        }
+    }
+}
+
+absl::StatusOr<bool> ProgressiveLoad::First(ShuffleChain *songs) {
+    std::unique_lock<std::mutex> lock(mu_);
+    wake_.wait(lock, [this] { return first_ || done_; });
+    if (done_) {
+        // Loading finished before there were enough items, so there is
+        // nothing left to add later.
+        finished_ = true;
+        if (status_.ok()) {
+            songs->Update(std::move(*done_));
+        }
+        done_.reset();
+        if (!status_.ok()) {
+            return status_;
+        }
+        return true;
+    }
+    songs->Update(std::move(*first_));
+    first_.reset();
+    return false;
+}
+
+absl::StatusOr<bool> ProgressiveLoad::Finish(ShuffleChain *songs,
+                                             bool wait) {
+    std::unique_lock<std::mutex> lock(mu_);
+    if (finished_) {
+        return false;
+    }
+    if (wait) {
+        wake_.wait(lock, [this] { return done_.has_value(); });
+    } else if (!done_) {
+        return false;
+    }
+    finished_ = true;
+    if (!status_.ok()) {
+        done_.reset();
+        return status_;
+    }
+    songs->Update(std::move(*done_));
+    done_.reset();
+    return true;
+}
+
 }  // namespace ashuffle
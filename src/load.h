@@ -1,16 +1,28 @@
 #ifndef __ASHUFFLE_LOAD_H__
 #define __ASHUFFLE_LOAD_H__
 
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
 #include <istream>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <string>
 #include <string_view>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
+#include <absl/status/status.h>
+#include <absl/status/statusor.h>
 #include <mpd/tag.h>
 
+#include "mapped_file.h"
 #include "mpd.h"
 #include "rule.h"
 #include "shuffle.h"
+#include "uri_set.h"
 #include "util.h"
 
 namespace ashuffle {
@@ -21,6 +33,47 @@ class Loader {
    public:
     virtual ~Loader(){};
     virtual void Load(ShuffleChain* into) = 0;
+
+    // Same as Load, but returns an error instead of exiting if the songs
+    // cannot be loaded, for callers that must handle the error themselves
+    // (e.g., when loading on a background thread). By default, this is just
+    // Load, for loaders that cannot fail.
+    virtual absl::Status TryLoad(ShuffleChain* into) {
+        Load(into);
+        return absl::OkStatus();
+    }
+
+    // Call `progress` with the chain being loaded into each time songs are
+    // added to it during Load, on the thread running Load. Loaders that
+    // only add songs at the end of a load (e.g., when grouping) may not call
+    // it at all.
+    void OnProgress(std::function<void(const ShuffleChain&)> progress) {
+        progress_ = std::move(progress);
+    }
+
+   protected:
+    std::function<void(const ShuffleChain&)> progress_;
+};
+
+// Weighting configures how MPDLoader weights the songs it loads.
+struct Weighting {
+    // The name of the song sticker to read weights from (e.g., "rating").
+    // If empty, all songs are given the default weight.
+    std::string sticker = "";
+    // The weight of songs that do not have the sticker, or whose sticker
+    // value is not a non-negative integer.
+    uint32_t missing = kDefaultWeight;
+};
+
+// Listing configures how MPDLoader lists songs from MPD.
+struct Listing {
+    // If non-zero, songs are listed this many at a time, so MPD never has
+    // to buffer a response for the whole library. MPD scans the library
+    // from the start for every chunk, so this is quadratic in the size of
+    // the library, and off by default.
+    unsigned chunk_size = 0;
+    // The number of threads used to check songs against the rules.
+    unsigned threads = 1;
 };
 
 class MPDLoader : public Loader {
@@ -30,17 +83,140 @@ class MPDLoader : public Loader {
         : MPDLoader(mpd, ruleset, std::vector<enum mpd_tag_type>()){};
     MPDLoader(mpd::MPD* mpd, const std::vector<Rule>& ruleset,
               const std::vector<enum mpd_tag_type>& group_by)
-        : mpd_(mpd), rules_(ruleset), group_by_(group_by){};
+        : MPDLoader(mpd, ruleset, group_by, Weighting()){};
+    MPDLoader(mpd::MPD* mpd, const std::vector<Rule>& ruleset,
+              const std::vector<enum mpd_tag_type>& group_by,
+              Weighting weighting)
+        : MPDLoader(mpd, ruleset, group_by, std::move(weighting),
+                    std::nullopt){};
+    // If `spread_by` is set, every loaded item is given a spread key based
+    // on the value of that tag (for groups, the tag of the first song).
+    MPDLoader(mpd::MPD* mpd, const std::vector<Rule>& ruleset,
+              const std::vector<enum mpd_tag_type>& group_by,
+              Weighting weighting,
+              std::optional<enum mpd_tag_type> spread_by)
+        : MPDLoader(mpd, ruleset, group_by, std::move(weighting), spread_by,
+                    Listing()){};
+    MPDLoader(mpd::MPD* mpd, const std::vector<Rule>& ruleset,
+              const std::vector<enum mpd_tag_type>& group_by,
+              Weighting weighting,
+              std::optional<enum mpd_tag_type> spread_by, Listing listing)
+        : mpd_(mpd),
+          rules_(ruleset),
+          group_by_(group_by),
+          weighting_(std::move(weighting)),
+          spread_by_(spread_by),
+          listing_(listing){};
 
     void Load(ShuffleChain* into) override;
+    absl::Status TryLoad(ShuffleChain* into) override;
 
    protected:
+    // Return true if the given song should be loaded. Verify may be called
+    // from several threads at once.
     virtual bool Verify(const mpd::Song&);
 
-   private:
+    // Return a reader over the songs to load.
+    absl::StatusOr<std::unique_ptr<mpd::SongReader>> List(
+        mpd::MPD::MetadataOption metadata);
+
+    // Return how songs must be listed: metadata is omitted when no rule,
+    // grouping, or spread needs it.
+    mpd::MPD::MetadataOption Metadata() const;
+
+    // Return the weight stickers of all songs, keyed by URI. Empty if songs
+    // are not weighted by a sticker.
+    absl::StatusOr<std::unordered_map<std::string, std::string>> Stickers();
+
+    // Return the weight of the song with the given URI, given the stickers
+    // returned by Stickers.
+    uint32_t WeightOf(
+        const std::unordered_map<std::string, std::string>& stickers,
+        const std::string& uri) const;
+
+    // Load the songs read from `reader` that pass Verify into the given
+    // chain, weighting them with the given stickers, and grouping them. If
+    // `verified` is set, every song read has already passed Verify, and is
+    // not checked again. Returns an error if songs could not be read.
+    absl::Status LoadFrom(
+        mpd::SongReader* reader,
+        const std::unordered_map<std::string, std::string>& stickers,
+        ShuffleChain* into, bool verified = false);
+
+    // Return the tags used by the rules, grouping, and spread of this loader.
+    std::vector<enum mpd_tag_type> UsedTags() const;
+
+    // Ask MPD to only send the tags in UsedTags with songs, so tags that
+    // are never looked at are not transferred and parsed. Returns true if
+    // the connection was restricted, and must be reset with
+    // ResetTagTypes. Older MPDs do not support this, and send all tags.
+    bool RestrictTagTypes();
+    void ResetTagTypes();
+
     mpd::MPD* mpd_;
     const std::vector<Rule>& rules_;
     const std::vector<enum mpd_tag_type> group_by_;
+    const Weighting weighting_;
+    const std::optional<enum mpd_tag_type> spread_by_;
+    const Listing listing_;
+};
+
+// SampleMPDLoader loads a random sample of `n` songs (or `n` groups, when
+// grouping) from MPD, rather than the whole library. The library is read in
+// a single pass, and only the sample is kept, so memory use is proportional
+// to `n` rather than to the size of the library (apart from the weight
+// stickers, which are still fetched up-front).
+//
+// Songs are sampled without replacement, in proportion to their weight.
+// Groups are sampled uniformly, since the weight of a group is not known
+// until all of its songs have been listed. Runs with the same seed, library,
+// and options load the same sample.
+class SampleMPDLoader : public MPDLoader {
+   public:
+    SampleMPDLoader(mpd::MPD* mpd, const std::vector<Rule>& ruleset,
+                    const std::vector<enum mpd_tag_type>& group_by,
+                    Weighting weighting,
+                    std::optional<enum mpd_tag_type> spread_by,
+                    Listing listing, size_t n, uint64_t seed)
+        : MPDLoader(mpd, ruleset, group_by, std::move(weighting), spread_by,
+                    listing),
+          n_(n),
+          seed_(seed){};
+
+    void Load(ShuffleChain* into) override;
+
+   private:
+    const size_t n_;
+    const uint64_t seed_;
+};
+
+class DirectoryCache;
+
+// IncrementalMPDLoader is an MPDLoader for re-loading the library after a
+// database update. It remembers the songs it loaded, and the last-modified
+// time of every directory, and on later loads only re-lists directories
+// that changed. A reload after a small update is then proportional to the
+// size of the update, rather than the size of the library.
+//
+// Directories are listed one at a time, so the first load is slower than
+// MPDLoader's single listing. A directory's listing is what holds the
+// last-modified times of its sub-directories, so directories with
+// sub-directories are always re-listed; the savings come from skipping
+// unchanged leaf directories (e.g., albums), which hold most songs. Since
+// editing a song's tags does not modify its directory, tag edits in
+// unchanged leaf directories are not picked up.
+class IncrementalMPDLoader : public MPDLoader {
+   public:
+    IncrementalMPDLoader(mpd::MPD* mpd, const std::vector<Rule>& ruleset,
+                         const std::vector<enum mpd_tag_type>& group_by,
+                         Weighting weighting,
+                         std::optional<enum mpd_tag_type> spread_by);
+    ~IncrementalMPDLoader() override;
+
+    void Load(ShuffleChain* into) override;
+
+   private:
+    std::unique_ptr<DirectoryCache> cache_;
 };
 
 class FileMPDLoader : public MPDLoader {
@@ -49,24 +225,102 @@ class FileMPDLoader : public MPDLoader {
     FileMPDLoader(mpd::MPD* mpd, const std::vector<Rule>& ruleset,
                   const std::vector<enum mpd_tag_type>& group_by,
                   std::istream* file);
+    // Same as above, but reads the URIs from `contents`, one per line (e.g.,
+    // the contents of a MappedFile).
+    FileMPDLoader(mpd::MPD* mpd, const std::vector<Rule>& ruleset,
+                  const std::vector<enum mpd_tag_type>& group_by,
+                  std::string_view contents);
 
    protected:
     bool Verify(const mpd::Song&) override;
 
    private:
-    std::istream* file_;
-    std::vector<std::string> valid_uris_;
+    URISet valid_uris_;
 };
 
 class FileLoader : public Loader {
    public:
     ~FileLoader() override = default;
     FileLoader(std::istream* file) : file_(file){};
+    // Load the URIs from a mapped file instead. Lines are added to the chain
+    // straight from the mapping, without copying each one into a string.
+    FileLoader(MappedFile file) : mapped_(std::move(file)){};
+    // Load the URIs from the contents of a file read by ReadFile.
+    FileLoader(std::string contents) : contents_(std::move(contents)){};
 
     void Load(ShuffleChain* into) override;
 
    private:
-    std::istream* file_;
+    std::istream* file_ = nullptr;
+    std::optional<MappedFile> mapped_;
+    std::optional<std::string> contents_;
+};
+
+// ProgressiveLoad runs a loader on a background thread, so songs can be
+// picked before the whole library has been loaded. The caller's chain is
+// only ever modified by the caller, through First and Finish, so it does
+// not need to be synchronized with the loader.
+class ProgressiveLoad {
+   public:
+    // Start running `loader` in the background. `mpd` is the connection
+    // used by the loader, which must not be used by any other thread. It is
+    // owned by the load so it outlives the loader, and may be null if the
+    // loader does not need it.
+    ProgressiveLoad(std::unique_ptr<mpd::MPD> mpd,
+                    std::unique_ptr<Loader> loader, size_t first_items);
+    // Waits for the loader to finish.
+    ~ProgressiveLoad();
+
+    ProgressiveLoad(const ProgressiveLoad&) = delete;
+    ProgressiveLoad& operator=(const ProgressiveLoad&) = delete;
+
+    // Return a file descriptor that becomes readable once loading has
+    // finished, so it can be waited on along with other descriptors. May be
+    // -1 if no descriptor could be created.
+    int Fd() const { return wake_fds_[0]; }
+
+    // Wait until at least `first_items` items have been loaded, or loading
+    // has finished, and add the items loaded so far to `songs`. Returns true
+    // if loading finished, so `songs` holds the complete library. Returns
+    // the loader's error if loading failed.
+    absl::StatusOr<bool> First(ShuffleChain* songs);
+
+    // Once loading has finished, update `songs` with the complete library
+    // (keeping its shuffle history, see ShuffleChain::Update) and return
+    // true. If loading has not finished, returns false, or if `wait` is
+    // true, waits for it. Returns false once the library has been added,
+    // and the loader's error if loading failed.
+    absl::StatusOr<bool> Finish(ShuffleChain* songs, bool wait = false);
+
+   private:
+    void Run();
+
+    std::unique_ptr<mpd::MPD> mpd_;
+    std::unique_ptr<Loader> loader_;
+    const size_t first_items_;
+
+    // Guards everything below. wake_ is signalled when first_ is set, and
+    // when loading finishes.
+    std::mutex mu_;
+    std::condition_variable wake_;
+    // A copy of the chain, once it holds at least first_items_ items.
+    std::optional<ShuffleChain> first_;
+    // The complete library, once loading has finished.
+    std::optional<ShuffleChain> done_;
+    // The error loading failed with, if any. Set along with done_.
+    absl::Status status_;
+    // True once the complete library has been added by First or Finish.
+    bool finished_ = false;
+
+    // Only used by the loading thread.
+    ShuffleChain loaded_;
+    bool first_taken_ = false;
+
+    // A pipe, written to once loading has finished, to wake up anything
+    // waiting on Fd().
+    int wake_fds_[2] = {-1, -1};
+
+    std::thread thread_;
 };
 
 }  // namespace ashuffle
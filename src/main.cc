@@ -4,7 +4,10 @@
 #include <cstdlib>
 #include <functional>
 #include <iostream>
+#include <memory>
+#include <optional>
 #include <string>
+#include <string_view>
 #include <variant>
 #include <vector>
 
@@ -17,9 +20,12 @@
 #include "args.h"
 #include "ashuffle.h"
 #include "getpass.h"
+#include "index_picker.h"
 #include "load.h"
 #include "log.h"
+#include "mapped_file.h"
 #include "mpd_client.h"
+#include "rng.h"
 #include "shuffle.h"
 #include "version.h"
 
@@ -29,20 +35,90 @@ using namespace ashuffle;
 const absl::Duration kReconnectWait = absl::Milliseconds(250);
 
 namespace {
-std::unique_ptr<Loader> BuildLoader(mpd::MPD* mpd, const Options& opts) {
-    if (opts.file_in != nullptr && opts.check_uris) {
+// Build a loader for the `--file` list. Lists in regular files are mapped,
+// rather than read line by line. Anything else (e.g., stdin or a pipe) is
+// read as a stream.
+std::unique_ptr<Loader> BuildFileLoader(mpd::MPD* mpd, const Options& opts) {
+    std::optional<MappedFile> mapped;
+    if (!opts.file_in_path.empty()) {
+        absl::StatusOr<MappedFile> file = MappedFile::Open(opts.file_in_path);
+        if (file.ok()) {
+            mapped.emplace(std::move(*file));
+        }
+    }
+    if (opts.check_uris && mapped.has_value()) {
+        return std::make_unique<FileMPDLoader>(mpd, opts.ruleset, opts.group_by,
+                                               mapped->Contents());
+    } else if (opts.check_uris) {
         return std::make_unique<FileMPDLoader>(mpd, opts.ruleset, opts.group_by,
                                                opts.file_in);
-    } else if (opts.file_in != nullptr) {
-        return std::make_unique<FileLoader>(opts.file_in);
+    } else if (mapped.has_value()) {
+        return std::make_unique<FileLoader>(std::move(*mapped));
+    }
+    return std::make_unique<FileLoader>(opts.file_in);
+}
+
+std::unique_ptr<Loader> BuildLoader(mpd::MPD* mpd, const Options& opts) {
+    if (opts.file_in != nullptr) {
+        return BuildFileLoader(mpd, opts);
+    }
+
+    return std::make_unique<MPDLoader>(
+        mpd, opts.ruleset, opts.group_by,
+        Weighting{opts.tweak.weight_sticker, opts.tweak.default_weight},
+        opts.tweak.spread_by,
+        Listing{opts.tweak.list_chunk_size, opts.tweak.load_threads});
+}
+
+// Return a loader that loads only a random sample of `--only` songs (or
+// groups), sampled with the given seed, or nullptr if the whole library must
+// be loaded. The whole library is needed to save the shuffle state, and to
+// check files.
+std::unique_ptr<Loader> BuildSampler(mpd::MPD* mpd, const Options& opts,
+                                     uint64_t seed) {
+    if (opts.queue_only == 0 || opts.file_in != nullptr ||
+        !opts.tweak.state_file.empty() ||
+        opts.test.print_all_songs_and_exit) {
+        return nullptr;
     }
+    return std::make_unique<SampleMPDLoader>(
+        mpd, opts.ruleset, opts.group_by,
+        Weighting{opts.tweak.weight_sticker, opts.tweak.default_weight},
+        opts.tweak.spread_by,
+        Listing{opts.tweak.list_chunk_size, opts.tweak.load_threads},
+        opts.queue_only, StreamSeed(seed, SeedStream::kSample));
+}
 
-    return std::make_unique<MPDLoader>(mpd, opts.ruleset, opts.group_by);
+// Start loading the library in the background on a new connection to MPD,
+// if the `progressive-load` tweak is set. Returns nullptr if the library
+// should be loaded up-front instead.
+std::unique_ptr<ProgressiveLoad> StartProgressiveLoad(
+    const Options& options, const std::optional<std::string>& password) {
+    if (options.tweak.progressive_load == 0 || options.file_in != nullptr ||
+        options.queue_only || options.test.print_all_songs_and_exit) {
+        return nullptr;
+    }
+    std::function<std::string()> pass_f = [&password] {
+        return password.value_or("");
+    };
+    absl::StatusOr<std::unique_ptr<mpd::MPD>> mpd =
+        Connect(*mpd::client::Dialer(), options,
+                password ? &pass_f : kNonInteractiveGetpass);
+    if (!mpd.ok()) {
+        Log().Info("Loading the whole library first: %s",
+                   mpd.status().ToString());
+        return nullptr;
+    }
+    std::unique_ptr<Loader> loader = BuildLoader(mpd->get(), options);
+    return std::make_unique<ProgressiveLoad>(std::move(*mpd),
+                                             std::move(loader),
+                                             options.tweak.progressive_load);
 }
 
-void LoopOnce(mpd::MPD* mpd, ShuffleChain& songs, const Options& options) {
+void LoopOnce(mpd::MPD* mpd, ShuffleChain& songs, const Options& options,
+              ProgressiveLoad* loading = nullptr) {
     absl::Time start = absl::Now();
-    absl::Status status = Loop(mpd, &songs, options);
+    absl::Status status = Loop(mpd, &songs, options, TestDelegate(), loading);
     absl::Duration loop_length = absl::Now() - start;
     if (!status.ok()) {
         Log().Error("LOOP failed after %s with error: %s",
@@ -88,6 +164,15 @@ int main(int argc, const char* argv[]) {
         exit(EXIT_FAILURE);
     }
 
+    if (options.tweak.low_memory &&
+        (options.file_in != nullptr || !options.group_by.empty() ||
+         !options.tweak.weight_sticker.empty() || options.tweak.spread_by)) {
+        std::cerr << "low-memory not supported with -f/--file, -g/--group-by, "
+                     "weight-sticker, or spread-by"
+                  << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
     if (options.log_file == nullptr) {
         // By default, log to stderr.
         log::SetOutput(std::cerr);
@@ -96,9 +181,14 @@ int main(int argc, const char* argv[]) {
     }
 
     bool disable_reconnect = false;
-    std::function<std::string()> pass_f = [&disable_reconnect] {
+    // A password provided interactively is kept, so a progressive load can
+    // open its own connection without prompting again.
+    std::optional<std::string> interactive_pass;
+    std::function<std::string()> pass_f = [&disable_reconnect,
+                                           &interactive_pass] {
         disable_reconnect = true;
         std::string pass = GetPass(stdin, stdout, "mpd password: ");
+        interactive_pass = pass;
         Log().InfoStr(
             "Disabling reconnect support since the password was "
             "provided interactively. Supply password via MPD_HOST "
@@ -114,45 +204,148 @@ int main(int argc, const char* argv[]) {
         Die("Failed to connect to mpd: %s", mpd.status().ToString());
     }
 
-    ShuffleChain songs((size_t)options.tweak.window_size);
+    CheckLibraryCache(mpd->get(), &options);
+
+    // The seed is chosen once, and every consumer of random numbers draws
+    // from its own stream derived from it.
+    const uint64_t seed = options.tweak.seed.value_or(RandomSeed());
+    ShuffleChain songs(
+        (size_t)options.tweak.window_size,
+        ShuffleChain::engine_type(StreamSeed(seed, SeedStream::kChain)));
+    if (options.tweak.spread_by) {
+        songs.SetSpread(options.tweak.spread);
+    }
 
-    {
-        // We construct the loader in a new scope, since loaders can
-        // consume a lot of memory.
-        std::unique_ptr<Loader> loader = BuildLoader(mpd->get(), options);
-        loader->Load(&songs);
+    // Set while the library is being loaded in the background.
+    std::unique_ptr<ProgressiveLoad> loading;
+    // True if only a sample of the library was loaded, for `--only`.
+    bool sampled = false;
+
+    // Restoring saved state skips listing the whole library, and keeps the
+    // shuffle window from the last run. In low-memory mode, songs are picked
+    // straight from MPD's database, so nothing is loaded at all.
+    if (options.tweak.low_memory) {
+        std::cout << "Picking random songs out of MPD's database." << std::endl;
+    } else if (absl::Status restored =
+                   RestoreState(mpd->get(), &songs, options);
+               !restored.ok()) {
+        if (!absl::IsNotFound(restored)) {
+            Log().Info("Not restoring shuffle state: %s", restored.ToString());
+        }
+        // Failing that, the library cache still skips listing the library.
+        if (absl::Status cached = RestoreLibrary(mpd->get(), &songs, options);
+            !cached.ok()) {
+            if (!absl::IsNotFound(cached)) {
+                Log().Info("Not using library cache: %s", cached.ToString());
+            }
+            std::unique_ptr<Loader> sampler =
+                BuildSampler(mpd->get(), options, seed);
+            if (sampler == nullptr) {
+                loading = StartProgressiveLoad(options, interactive_pass);
+            }
+            if (sampler != nullptr) {
+                // Every sampled item is picked, so the window holds the
+                // whole sample, and no item is picked twice.
+                songs = ShuffleChain(
+                    options.queue_only - 1,
+                    ShuffleChain::engine_type(
+                        StreamSeed(seed, SeedStream::kChain)));
+                if (options.tweak.spread_by) {
+                    songs.SetSpread(options.tweak.spread);
+                }
+                sampler->Load(&songs);
+                sampled = true;
+            } else if (loading != nullptr) {
+                // Errors from the background load are reported here, on the
+                // main thread.
+                absl::StatusOr<bool> finished = loading->First(&songs);
+                if (!finished.ok()) {
+                    Die("Failed to load songs: %s",
+                        finished.status().ToString());
+                }
+                if (*finished) {
+                    // The whole library loaded before playback could start.
+                    loading.reset();
+                }
+            } else {
+                // We construct the loader in a new scope, since loaders can
+                // consume a lot of memory.
+                std::unique_ptr<Loader> loader =
+                    BuildLoader(mpd->get(), options);
+                loader->Load(&songs);
+            }
+            // If the library is still loading, Loop saves it once loading
+            // finishes. A sample is not the library, so it is not saved.
+            if (loading == nullptr && !sampled) {
+                if (auto status = SaveLibrary(mpd->get(), songs, options);
+                    !status.ok()) {
+                    Log().Error("Failed to save library cache: %s",
+                                status.ToString());
+                }
+            }
+        }
+        if (loading == nullptr && !sampled) {
+            if (auto status = SaveState(mpd->get(), songs, options);
+                !status.ok()) {
+                Log().Error("Failed to save shuffle state: %s",
+                            status.ToString());
+            }
+        }
     }
 
     // For integration testing, we sometimes just want to have ashuffle
     // dump the list of songs in its shuffle chain.
     if (options.test.print_all_songs_and_exit) {
         bool first = true;
-        for (auto&& group : songs.Items()) {
+        // Stream the songs straight out of the chain, so dumping a large
+        // library does not need a second copy of it in memory.
+        songs.ForEach([&first](absl::Span<const std::string_view> group) {
             if (!first) {
-                std::cout << "---" << std::endl;
+                std::cout << "---\n";
             }
             first = false;
-            for (auto&& song : group) {
-                std::cout << song << std::endl;
+            for (std::string_view song : group) {
+                std::cout << song << '\n';
             }
-        }
+        });
+        std::cout << std::flush;
         exit(EXIT_SUCCESS);
     }
 
-    if (songs.Len() == 0) {
-        PrintChainLength(std::cerr, songs);
-        exit(EXIT_FAILURE);
+    if (!options.tweak.low_memory) {
+        if (songs.Len() == 0) {
+            PrintChainLength(std::cerr, songs);
+            exit(EXIT_FAILURE);
+        }
+        PrintChainLength(std::cout, songs);
     }
 
-    PrintChainLength(std::cout, songs);
-
     if (options.queue_only) {
-        size_t number_of_songs = 0;
-        for (unsigned i = 0; i < options.queue_only; i++) {
-            auto& picked_songs = songs.Pick();
-            number_of_songs += picked_songs.size();
-            if (auto status = (*mpd)->Add(picked_songs); !status.ok()) {
-                Die("Failed to enqueue songs: %s", status.ToString());
+        std::vector<std::string> picked_songs;
+        if (options.tweak.low_memory) {
+            IndexPicker picker(options.ruleset, options.tweak.window_size,
+                               StreamSeed(seed, SeedStream::kIndexPicker));
+            for (unsigned i = 0; i < options.queue_only; i++) {
+                absl::StatusOr<ItemView> picked = picker.Pick(mpd->get());
+                if (!picked.ok()) {
+                    Die("Failed to pick songs: %s",
+                        picked.status().ToString());
+                }
+                picked_songs.insert(picked_songs.end(), picked->begin(),
+                                    picked->end());
+            }
+        } else {
+            songs.PickN(options.queue_only, &picked_songs);
+        }
+        size_t number_of_songs = picked_songs.size();
+        if (auto status = (*mpd)->Add(picked_songs); !status.ok()) {
+            Die("Failed to enqueue songs: %s", status.ToString());
+        }
+        if (!sampled && !options.tweak.low_memory) {
+            if (auto status = SaveState(mpd->get(), songs, options);
+                !status.ok()) {
+                Log().Error("Failed to save shuffle state: %s",
+                            status.ToString());
             }
         }
 
@@ -169,10 +362,16 @@ int main(int argc, const char* argv[]) {
         return 0;
     }
 
-    LoopOnce(mpd->get(), songs, options);
+    LoopOnce(mpd->get(), songs, options, loading.get());
     if (disable_reconnect) {
         exit(EXIT_FAILURE);
     }
+    if (loading != nullptr) {
+        // Loop may have stopped before the load finished. The library is
+        // reloaded after reconnecting anyway, so just wait for the loader to
+        // stop using its connection.
+        loading.reset();
+    }
 
     absl::Time disconnect_begin = absl::Now();
     while ((absl::Now() - disconnect_begin) < options.tweak.reconnect_timeout) {
@@ -186,8 +385,12 @@ int main(int argc, const char* argv[]) {
             continue;
         }
 
-        if (auto l = Reloader(mpd->get(), options); l.has_value()) {
-            (*l)->Load(&songs);
+        // In low-memory mode, there is nothing to reload.
+        if (auto l = Reloader(mpd->get(), options);
+            l.has_value() && !options.tweak.low_memory) {
+            ShuffleChain next;
+            (*l)->Load(&next);
+            songs.Update(std::move(next));
             PrintChainLength(std::cout, songs);
         }
 
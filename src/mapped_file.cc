@@ -0,0 +1,125 @@
+#include "mapped_file.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <utility>
+
+#include <absl/strings/str_format.h>
+
+namespace ashuffle {
+
+absl::StatusOr<MappedFile> MappedFile::Open(const std::filesystem::path& path) {
+    // Check the file type before opening it, since opening a FIFO blocks
+    // until it has a writer.
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        return absl::UnavailableError(absl::StrFormat(
+            "failed to stat '%s': %s", path.string(), std::strerror(errno)));
+    }
+    if (!S_ISREG(st.st_mode)) {
+        return absl::FailedPreconditionError(
+            absl::StrFormat("'%s' is not a regular file", path.string()));
+    }
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return absl::UnavailableError(absl::StrFormat(
+            "failed to open '%s': %s", path.string(), std::strerror(errno)));
+    }
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return absl::UnavailableError(absl::StrFormat(
+            "failed to stat '%s': %s", path.string(), std::strerror(errno)));
+    }
+    size_t size = static_cast<size_t>(st.st_size);
+    if (size == 0) {
+        // Empty files cannot be mapped.
+        close(fd);
+        return MappedFile(nullptr, 0);
+    }
+    void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping stays valid after the file is closed.
+    close(fd);
+    if (data == MAP_FAILED) {
+        return absl::UnavailableError(absl::StrFormat(
+            "failed to map '%s': %s", path.string(), std::strerror(errno)));
+    }
+    madvise(data, size, MADV_SEQUENTIAL);
+    return MappedFile(static_cast<const char*>(data), size);
+}
+
+MappedFile::MappedFile(MappedFile&& other)
+    : data_(std::exchange(other.data_, nullptr)),
+      size_(std::exchange(other.size_, 0)) {}
+
+MappedFile::~MappedFile() {
+    if (data_ != nullptr) {
+        munmap(const_cast<char*>(data_), size_);
+    }
+}
+
+absl::StatusOr<std::string> ReadFile(const std::filesystem::path& path) {
+    // As with MappedFile::Open, opening a FIFO would block.
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        return absl::UnavailableError(absl::StrFormat(
+            "failed to stat '%s': %s", path.string(), std::strerror(errno)));
+    }
+    if (!S_ISREG(st.st_mode)) {
+        return absl::FailedPreconditionError(
+            absl::StrFormat("'%s' is not a regular file", path.string()));
+    }
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return absl::UnavailableError(absl::StrFormat(
+            "failed to open '%s': %s", path.string(), std::strerror(errno)));
+    }
+    std::string contents;
+    if (fstat(fd, &st) == 0) {
+        contents.reserve(static_cast<size_t>(st.st_size));
+    }
+    // The size is only a hint, the file may change while it is read. It is
+    // read until the end, wherever that is.
+    char buf[64 * 1024];
+    while (true) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            int err = errno;
+            close(fd);
+            return absl::UnavailableError(absl::StrFormat(
+                "failed to read '%s': %s", path.string(), std::strerror(err)));
+        }
+        if (n == 0) {
+            break;
+        }
+        contents.append(buf, static_cast<size_t>(n));
+    }
+    close(fd);
+    return contents;
+}
+
+void ForEachLine(std::string_view contents,
+                 absl::FunctionRef<void(std::string_view)> f) {
+    while (!contents.empty()) {
+        // memchr is vectorized by the C library, so newlines are found many
+        // bytes at a time.
+        const char* newline = static_cast<const char*>(
+            std::memchr(contents.data(), '\n', contents.size()));
+        if (newline == nullptr) {
+            f(contents);
+            return;
+        }
+        size_t end = newline - contents.data();
+        f(contents.substr(0, end));
+        contents.remove_prefix(end + 1);
+    }
+}
+
+}  // namespace ashuffle
@@ -0,0 +1,54 @@
+#ifndef __ASHUFFLE_MAPPED_FILE_H__
+#define __ASHUFFLE_MAPPED_FILE_H__
+
+#include <cstddef>
+#include <filesystem>
+#include <string>
+#include <string_view>
+
+#include <absl/functional/function_ref.h>
+#include <absl/status/statusor.h>
+
+namespace ashuffle {
+
+// MappedFile maps a whole regular file into memory, read-only, so it can be
+// scanned without copying it through a stream buffer.
+class MappedFile {
+   public:
+    // Map the file at `path`. Returns a FAILED_PRECONDITION error if `path`
+    // is not a regular file (e.g., a pipe), since those cannot be mapped.
+    static absl::StatusOr<MappedFile> Open(const std::filesystem::path& path);
+
+    MappedFile(MappedFile&& other);
+    MappedFile& operator=(MappedFile&&) = delete;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile();
+
+    // Return the contents of the file. The view is valid for the lifetime of
+    // this MappedFile.
+    std::string_view Contents() const { return {data_, size_}; }
+
+   private:
+    MappedFile(const char* data, size_t size) : data_(data), size_(size){};
+
+    const char* data_;
+    size_t size_;
+};
+
+// Read the whole regular file at `path` into memory. Unlike a MappedFile,
+// the contents are a private copy, so they stay valid if the file is
+// truncated or rewritten while they are used. A mapping of a file that is
+// truncated while it is scanned raises SIGBUS instead, so files that may
+// change while ashuffle runs (e.g., a watched `--file` list) must be read.
+absl::StatusOr<std::string> ReadFile(const std::filesystem::path& path);
+
+// Call `f` with every line of `contents`, without its trailing newline.
+// Lines are split the same way as std::getline: a final newline does not
+// start another (empty) line.
+void ForEachLine(std::string_view contents,
+                 absl::FunctionRef<void(std::string_view)> f);
+
+}  // namespace ashuffle
+
+#endif  // __ASHUFFLE_MAPPED_FILE_H__
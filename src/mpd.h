@@ -5,12 +5,15 @@
 #include <optional>
 #include <string>
 #include <string_view>
+#include <unordered_map>
+#include <utility>
 #include <variant>
 #include <vector>
 
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
 #include "absl/time/time.h"
+#include "absl/types/span.h"
 
 #include <mpd/idle.h>
 #include <mpd/status.h>
@@ -32,9 +35,21 @@ class Song {
    public:
     virtual ~Song(){};
 
-    // Get the given tag for this song.
+    // Get the given tag for this song. If the tag has several values, this
+    // is the first of them.
     virtual std::optional<std::string> Tag(enum mpd_tag_type tag) const = 0;
 
+    // Get every value of the given tag for this song (e.g., every artist of
+    // a song with several artists), in order. By default, songs only have
+    // the value returned by Tag.
+    virtual std::vector<std::string> TagValues(enum mpd_tag_type tag) const {
+        std::optional<std::string> value = Tag(tag);
+        if (!value) {
+            return {};
+        }
+        return {std::move(*value)};
+    }
+
     // Returns the URI of this song.
     virtual std::string URI() const = 0;
 };
@@ -73,6 +88,43 @@ class SongReader {
     virtual bool Done() = 0;
 };
 
+// Directory is a directory in MPD's database.
+struct Directory {
+    // The path of the directory, relative to the music directory.
+    std::string path;
+    // The time the directory was last modified. This changes when songs or
+    // directories are added to, or removed from, the directory itself, but
+    // not when the contents of its sub-directories change.
+    absl::Time last_modified;
+};
+
+// DirectoryListing is the contents of a single directory in MPD's database.
+struct DirectoryListing {
+    // The directories directly inside the listed directory.
+    std::vector<Directory> directories;
+    // The songs directly inside the listed directory, with metadata.
+    std::vector<std::unique_ptr<Song>> songs;
+};
+
+// DBStats are statistics about MPD's database.
+struct DBStats {
+    // The time of the last database update.
+    absl::Time last_update;
+    // The number of songs in the database.
+    unsigned songs = 0;
+    // The total play time of all songs in the database.
+    absl::Duration playtime;
+};
+
+// A filter expression that matches every song.
+constexpr char kAllSongsFilter[] = "(file != \"\")";
+
+// Window is the range [start, end) of positions in a list of songs.
+struct Window {
+    unsigned start = 0;
+    unsigned end = 0;
+};
+
 // IdleEventSet contains a set of MPD "Idle" events. These events are used to
 // signal to MPD what conditions trigger the end of an "idle" command.
 struct IdleEventSet {
@@ -128,22 +180,60 @@ class MPD {
     virtual absl::StatusOr<std::unique_ptr<SongReader>> ListAll(
         MetadataOption metadata = MetadataOption::kInclude) = 0;
 
+    // Returns a song reader over the songs in MPD's database that match the
+    // given filter expression, with metadata. The filter is matched
+    // case-insensitively. If `window` is set, only the matching songs at
+    // those positions are listed. Returns UNIMPLEMENTED if the server is too
+    // old to support filter expressions.
+    virtual absl::StatusOr<std::unique_ptr<SongReader>> ListMatching(
+        std::string_view filter,
+        std::optional<Window> window = std::nullopt) = 0;
+
+    // Restricts the tags MPD sends with songs on this connection (e.g., by
+    // ListAll) to the given tags. Returns UNIMPLEMENTED if the server is too
+    // old to support this.
+    virtual absl::Status RestrictTagTypes(
+        const std::vector<enum mpd_tag_type>& tags) = 0;
+
+    // Undoes RestrictTagTypes, so MPD sends all tags with songs again.
+    virtual absl::Status AllTagTypes() = 0;
+
     // Searches MPD's DB for a particular song URI, and returns that song.
     // Returns a NOT_FOUND status if the song could not be found.
     virtual absl::StatusOr<std::unique_ptr<Song>> Search(
         std::string_view uri) = 0;
 
+    // Returns the songs and sub-directories directly inside the directory
+    // with the given path. The empty path is the root of the database.
+    virtual absl::StatusOr<DirectoryListing> ListDirectory(
+        std::string_view path) = 0;
+
+    // Returns the value of the song sticker with the given name for every
+    // song that has it, keyed by song URI. All stickers are fetched in a
+    // single request.
+    virtual absl::StatusOr<std::unordered_map<std::string, std::string>>
+    SongStickers(std::string_view name) = 0;
+
+    // Returns statistics about MPD's database.
+    virtual absl::StatusOr<DBStats> DatabaseStats() = 0;
+
     // Blocks until one of the enum mpd_idle events in the event set happens.
     // A new event set is returned, containing all events that occured during
     // the idle period.
     virtual absl::StatusOr<IdleEventSet> Idle(const IdleEventSet&) = 0;
 
+    // Same as Idle, but also stops idling once any of the file descriptors
+    // in `fds` is readable, in which case the returned set may be empty.
+    // Negative descriptors are ignored.
+    virtual absl::StatusOr<IdleEventSet> IdleOrReadable(
+        const IdleEventSet&, absl::Span<const int> fds) = 0;
+
     // Add, adds the song wit the given URI to the MPD queue.
     virtual absl::Status Add(const std::string& uri) = 0;
 
-    // Add also works on vectors of URIs, by repeatedly invoking Add for each
+    // Add also works on lists of URIs, by repeatedly invoking Add for each
     // element.
-    absl::Status Add(const std::vector<std::string>& uris) {
+    absl::Status Add(absl::Span<const std::string> uris) {
         for (auto& u : uris) {
             absl::Status status = Add(u);
             if (!status.ok()) {
@@ -1,12 +1,19 @@
 #include "mpd_client.h"
 
+#include <poll.h>
+
+#include <cerrno>
+#include <cstring>
 #include <iostream>
+#include <vector>
 
 #include <absl/strings/str_format.h>
 #include <absl/strings/str_join.h>
 #include <mpd/capabilities.h>
 #include <mpd/connection.h>
 #include <mpd/database.h>
+#include <mpd/directory.h>
+#include <mpd/entity.h>
 #include <mpd/error.h>
 #include <mpd/idle.h>
 #include <mpd/pair.h>
@@ -15,9 +22,14 @@
 #include <mpd/protocol.h>
 #include <mpd/queue.h>
 #include <mpd/recv.h>
+#include <mpd/response.h>
 #include <mpd/search.h>
+#include <mpd/send.h>
 #include <mpd/song.h>
+#include <mpd/stats.h>
 #include <mpd/status.h>
+#include <mpd/sticker.h>
+#include <mpd/version.h>
 
 #include "log.h"
 #include "mpd.h"
@@ -65,6 +77,8 @@ class SongImpl : public Song {
     ~SongImpl() override;
 
     std::optional<std::string> Tag(enum mpd_tag_type tag) const override;
+    std::vector<std::string> TagValues(
+        enum mpd_tag_type tag) const override;
     std::string URI() const override;
 
    private:
@@ -82,6 +96,17 @@ std::optional<std::string> SongImpl::Tag(enum mpd_tag_type tag) const {
     return std::string(raw_value);
 }
 
+std::vector<std::string> SongImpl::TagValues(enum mpd_tag_type tag) const {
+    std::vector<std::string> values;
+    for (unsigned i = 0;; i++) {
+        const char* raw_value = mpd_song_get_tag(song_, tag, i);
+        if (raw_value == nullptr) {
+            return values;
+        }
+        values.emplace_back(raw_value);
+    }
+}
+
 std::string SongImpl::URI() const { return mpd_song_get_uri(song_); }
 
 class StatusImpl : public Status {
@@ -150,8 +175,20 @@ class MPDImpl : public MPD {
     absl::StatusOr<std::unique_ptr<Status>> CurrentStatus() override;
     absl::StatusOr<std::unique_ptr<SongReader>> ListAll(
         MetadataOption metadata) override;
+    absl::StatusOr<std::unique_ptr<SongReader>> ListMatching(
+        std::string_view filter, std::optional<Window> window) override;
     absl::StatusOr<std::unique_ptr<Song>> Search(std::string_view uri) override;
+    absl::StatusOr<DirectoryListing> ListDirectory(
+        std::string_view path) override;
+    absl::Status RestrictTagTypes(
+        const std::vector<enum mpd_tag_type>& tags) override;
+    absl::Status AllTagTypes() override;
+    absl::StatusOr<std::unordered_map<std::string, std::string>> SongStickers(
+        std::string_view name) override;
+    absl::StatusOr<DBStats> DatabaseStats() override;
     absl::StatusOr<IdleEventSet> Idle(const IdleEventSet&) override;
+    absl::StatusOr<IdleEventSet> IdleOrReadable(
+        const IdleEventSet&, absl::Span<const int> fds) override;
     absl::Status Add(const std::string& uri) override;
     absl::StatusOr<MPD::PasswordStatus> ApplyPassword(
         const std::string& password) override;
@@ -331,6 +368,32 @@ absl::StatusOr<std::unique_ptr<SongReader>> MPDImpl::ListAll(
     return std::unique_ptr<SongReader>(new SongReaderImpl(*this));
 }
 
+absl::StatusOr<std::unique_ptr<SongReader>> MPDImpl::ListMatching(
+    std::string_view filter, std::optional<Window> window) {
+    // Filter expressions were added in MPD 0.21.
+    if (mpd_connection_cmp_server_version(mpd_, 0, 21, 0) < 0) {
+        return absl::UnimplementedError(
+            "filter expressions require MPD 0.21 or newer");
+    }
+    // Copy to ensure the filter is null-terminated.
+    std::string filter_copy(filter);
+    // "search" rather than "find", so the filter is case-insensitive.
+    mpd_search_db_songs(mpd_, false);
+    if (!mpd_search_add_expression(mpd_, filter_copy.data())) {
+        mpd_search_cancel(mpd_);
+        return ConnectionStatus();
+    }
+    if (window &&
+        !mpd_search_add_window(mpd_, window->start, window->end)) {
+        mpd_search_cancel(mpd_);
+        return ConnectionStatus();
+    }
+    if (!mpd_search_commit(mpd_)) {
+        return ConnectionStatus();
+    }
+    return std::unique_ptr<SongReader>(new SongReaderImpl(*this));
+}
+
 absl::StatusOr<std::unique_ptr<Song>> MPDImpl::Search(std::string_view uri) {
     // Copy to ensure URI buffer is null-terminated.
     std::string uri_copy(uri);
@@ -358,6 +421,131 @@ absl::StatusOr<std::unique_ptr<Song>> MPDImpl::Search(std::string_view uri) {
     return std::unique_ptr<Song>(std::move(song));
 }
 
+absl::Status MPDImpl::RestrictTagTypes(
+    const std::vector<enum mpd_tag_type>& tags) {
+    // "tagtypes clear" was added in MPD 0.21.
+    if (mpd_connection_cmp_server_version(mpd_, 0, 21, 0) < 0) {
+        return absl::UnimplementedError(
+            "restricting tag types requires MPD 0.21 or newer");
+    }
+    if (!mpd_run_clear_tag_types(mpd_)) {
+        return ConnectionStatus();
+    }
+    if (tags.empty()) {
+        return absl::OkStatus();
+    }
+    mpd_run_enable_tag_types(mpd_, tags.data(),
+                             static_cast<unsigned>(tags.size()));
+    return ConnectionStatus();
+}
+
+absl::Status MPDImpl::AllTagTypes() {
+#if LIBMPDCLIENT_CHECK_VERSION(2, 19, 0)
+    mpd_run_all_tag_types(mpd_);
+#else
+    // Older libmpdclient versions have no wrapper for "tagtypes all", so
+    // the command is sent directly.
+    if (mpd_send_command(mpd_, "tagtypes", "all", nullptr)) {
+        mpd_response_finish(mpd_);
+    }
+#endif
+    return ConnectionStatus();
+}
+
+absl::StatusOr<DirectoryListing> MPDImpl::ListDirectory(
+    std::string_view path) {
+    // Copy to ensure the path is null-terminated.
+    std::string path_copy(path);
+    if (!mpd_send_list_meta(mpd_, path_copy.data())) {
+        return ConnectionStatus();
+    }
+
+    DirectoryListing listing;
+    struct mpd_entity* entity;
+    while ((entity = mpd_recv_entity(mpd_)) != nullptr) {
+        switch (mpd_entity_get_type(entity)) {
+            case MPD_ENTITY_TYPE_DIRECTORY: {
+                const struct mpd_directory* dir =
+                    mpd_entity_get_directory(entity);
+                listing.directories.push_back(Directory{
+                    .path = mpd_directory_get_path(dir),
+                    .last_modified = absl::FromTimeT(
+                        mpd_directory_get_last_modified(dir)),
+                });
+                break;
+            }
+            case MPD_ENTITY_TYPE_SONG:
+                listing.songs.emplace_back(
+                    new SongImpl(mpd_song_dup(mpd_entity_get_song(entity))));
+                break;
+            default:
+                // Playlists are not shuffled.
+                break;
+        }
+        mpd_entity_free(entity);
+    }
+    if (auto status = ConnectionStatus(); !status.ok()) {
+        return status;
+    }
+    if (!mpd_response_finish(mpd_)) {
+        return ConnectionStatus();
+    }
+    return listing;
+}
+
+absl::StatusOr<std::unordered_map<std::string, std::string>>
+MPDImpl::SongStickers(std::string_view name) {
+    // Copy to ensure the name is null-terminated.
+    std::string name_copy(name);
+    // Searching from the root URI finds the sticker on every song in the
+    // database in a single round-trip.
+    if (!mpd_send_sticker_find(mpd_, "song", "", name_copy.data())) {
+        return ConnectionStatus();
+    }
+
+    // The response is a list of "file" pairs, each followed by the
+    // "sticker" pair for that file, of the form "name=value".
+    std::unordered_map<std::string, std::string> stickers;
+    std::string uri;
+    struct mpd_pair* pair = mpd_recv_pair(mpd_);
+    while (pair != nullptr) {
+        if (std::string_view(pair->name) == "file") {
+            uri = pair->value;
+        } else if (std::string_view(pair->name) == "sticker") {
+            size_t name_length;
+            const char* value = mpd_parse_sticker(pair->value, &name_length);
+            if (value != nullptr && !uri.empty()) {
+                stickers.emplace(std::move(uri), value);
+            }
+            uri.clear();
+        }
+        mpd_return_pair(mpd_, pair);
+        pair = mpd_recv_pair(mpd_);
+    }
+    if (auto status = ConnectionStatus(); !status.ok()) {
+        return status;
+    }
+    if (!mpd_response_finish(mpd_)) {
+        return ConnectionStatus();
+    }
+    return stickers;
+}
+
+absl::StatusOr<DBStats> MPDImpl::DatabaseStats() {
+    struct mpd_stats* stats = mpd_run_stats(mpd_);
+    if (stats == nullptr) {
+        return ConnectionStatus();
+    }
+    DBStats db_stats = {
+        .last_update =
+            absl::FromUnixSeconds(mpd_stats_get_db_update_time(stats)),
+        .songs = mpd_stats_get_number_of_songs(stats),
+        .playtime = absl::Seconds(mpd_stats_get_db_play_time(stats)),
+    };
+    mpd_stats_free(stats);
+    return db_stats;
+}
+
 absl::StatusOr<IdleEventSet> MPDImpl::Idle(const IdleEventSet& events) {
     enum mpd_idle occured = mpd_run_idle_mask(mpd_, events.Enum());
     if (auto status = ConnectionStatus(); !status.ok()) {
@@ -366,6 +554,36 @@ absl::StatusOr<IdleEventSet> MPDImpl::Idle(const IdleEventSet& events) {
     return {static_cast<int>(occured)};
 }
 
+absl::StatusOr<IdleEventSet> MPDImpl::IdleOrReadable(
+    const IdleEventSet& events, absl::Span<const int> watch) {
+    if (!mpd_send_idle_mask(mpd_, events.Enum())) {
+        return ConnectionStatus();
+    }
+    // The MPD connection always comes first. poll ignores negative fds.
+    std::vector<struct pollfd> fds = {
+        {.fd = mpd_connection_get_fd(mpd_), .events = POLLIN, .revents = 0},
+    };
+    for (int fd : watch) {
+        fds.push_back({.fd = fd, .events = POLLIN, .revents = 0});
+    }
+    while (poll(fds.data(), fds.size(), -1) < 0) {
+        if (errno != EINTR) {
+            return absl::UnavailableError(absl::StrFormat(
+                "failed to wait for MPD events: %s", std::strerror(errno)));
+        }
+    }
+    // If MPD has not answered yet, ask it to stop idling. It then answers
+    // with the events so far (if any).
+    if (fds[0].revents == 0 && !mpd_send_noidle(mpd_)) {
+        return ConnectionStatus();
+    }
+    enum mpd_idle occured = mpd_recv_idle(mpd_, true);
+    if (auto status = ConnectionStatus(); !status.ok()) {
+        return status;
+    }
+    return {static_cast<int>(occured)};
+}
+
 absl::Status MPDImpl::Add(const std::string& uri) {
     mpd_run_add(mpd_, uri.data());
     return ConnectionStatus();
@@ -0,0 +1,146 @@
+#ifndef __ASHUFFLE_RNG_H__
+#define __ASHUFFLE_RNG_H__
+
+#include <cstdint>
+#include <istream>
+#include <limits>
+#include <ostream>
+#include <random>
+
+#include <absl/numeric/int128.h>
+
+namespace ashuffle {
+
+// Xoshiro256 is the xoshiro256** generator by Blackman and Vigna. It has
+// 32 bytes of state (vs. ~2.5KB for std::mt19937), and produces a full
+// 64-bit result per step with a handful of shifts and rotates. It satisfies
+// the standard UniformRandomBitGenerator requirements, so it can be used
+// with <random> distributions.
+class Xoshiro256 {
+   public:
+    using result_type = uint64_t;
+
+    // Create a new generator seeded with the given seed.
+    explicit Xoshiro256(uint64_t seed = 0) { this->seed(seed); }
+
+    // Re-seed this generator. The seed is expanded into the full state with
+    // splitmix64, as recommended by the xoshiro authors, so similar seeds
+    // still produce unrelated sequences.
+    void seed(uint64_t seed) {
+        for (uint64_t& s : _s) {
+            seed += 0x9e3779b97f4a7c15;
+            uint64_t z = seed;
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+            s = z ^ (z >> 31);
+        }
+    }
+
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() {
+        return std::numeric_limits<result_type>::max();
+    }
+
+    result_type operator()() {
+        const uint64_t result = Rotl(_s[1] * 5, 7) * 9;
+        const uint64_t t = _s[1] << 17;
+        _s[2] ^= _s[0];
+        _s[3] ^= _s[1];
+        _s[1] ^= _s[2];
+        _s[0] ^= _s[3];
+        _s[2] ^= t;
+        _s[3] = Rotl(_s[3], 45);
+        return result;
+    }
+
+    // Engine state can be written to, and read from, streams, as with the
+    // standard <random> engines.
+    friend std::ostream& operator<<(std::ostream& os, const Xoshiro256& r) {
+        return os << r._s[0] << ' ' << r._s[1] << ' ' << r._s[2] << ' '
+                  << r._s[3];
+    }
+    friend std::istream& operator>>(std::istream& is, Xoshiro256& r) {
+        return is >> r._s[0] >> r._s[1] >> r._s[2] >> r._s[3];
+    }
+
+   private:
+    static constexpr uint64_t Rotl(uint64_t x, int k) {
+        return (x << k) | (x >> (64 - k));
+    }
+
+    uint64_t _s[4];
+};
+
+namespace rng_internal {
+
+// Return 64 uniformly random bits from `g`, which must produce either 32 or
+// 64 random bits per call.
+template <typename URBG>
+uint64_t Bits64(URBG& g) {
+    static_assert(URBG::min() == 0, "engine must produce a full range");
+    if constexpr (URBG::max() == std::numeric_limits<uint64_t>::max()) {
+        return g();
+    } else {
+        static_assert(URBG::max() == std::numeric_limits<uint32_t>::max(),
+                      "engine must produce 32 or 64 random bits");
+        uint64_t hi = g();
+        return (hi << 32) | static_cast<uint64_t>(g());
+    }
+}
+
+}  // namespace rng_internal
+
+// Return a uniformly distributed integer in [0, n) using `g`. This uses
+// Lemire's "nearly divisionless" method: a single 64x64->128 multiply, with
+// a modulo only on the rare path where rejection may be needed. `n` must be
+// non-zero.
+template <typename URBG>
+uint64_t UniformBelow(URBG& g, uint64_t n) {
+    absl::uint128 m = absl::uint128(rng_internal::Bits64(g)) * n;
+    uint64_t low = absl::Uint128Low64(m);
+    if (low < n) {
+        const uint64_t threshold = -n % n;
+        while (low < threshold) {
+            m = absl::uint128(rng_internal::Bits64(g)) * n;
+            low = absl::Uint128Low64(m);
+        }
+    }
+    return absl::Uint128High64(m);
+}
+
+// Return a non-deterministic 64-bit seed from std::random_device.
+inline uint64_t RandomSeed() {
+    std::random_device rd;
+    uint64_t hi = rd();
+    return (hi << 32) | static_cast<uint64_t>(rd());
+}
+
+// SeedStream names each consumer of random numbers that is seeded from the
+// `seed` tweak.
+enum class SeedStream : uint64_t {
+    // The shuffle chain. Its seed is the seed itself.
+    kChain = 0,
+    // The sample of songs loaded for `--only`.
+    kSample = 1,
+    // The index picker used in low-memory mode.
+    kIndexPicker = 2,
+};
+
+// Return the seed for the given stream, derived from `seed`. Consumers that
+// share a seed would otherwise draw the same numbers (e.g., the sampler
+// would pick the same positions the chain then picks from the sample), so
+// every other stream is offset from the seed, and mixed with a splitmix64
+// step, to give unrelated sequences.
+inline uint64_t StreamSeed(uint64_t seed, SeedStream stream) {
+    if (stream == SeedStream::kChain) {
+        return seed;
+    }
+    uint64_t z = seed + static_cast<uint64_t>(stream) * 0x9e3779b97f4a7c15;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    return z ^ (z >> 31);
+}
+
+}  // namespace ashuffle
+
+#endif
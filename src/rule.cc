@@ -18,19 +18,24 @@ bool Rule::Accepts(const mpd::Song &song) const {
     assert(type_ == Rule::Type::kExclude &&
            "only exclusion rules are supported");
     for (const Pattern &p : patterns_) {
-        std::optional<std::string> tag_value = song.Tag(p.tag);
-        if (!tag_value) {
-            // If the tag doesn't exist, we can't match on it. Accept this
-            // song because it can't possible match this tag.
-            return true;
+        // A song may have several values for a tag (e.g., several artists),
+        // and the pattern matches if any of them matches. If the tag doesn't
+        // exist, we can't match on it.
+        bool matched = false;
+        for (std::string &tag_value : song.TagValues(p.tag)) {
+            // Lowercase the tag value, to make sure our comparison is not
+            // case sensitive.
+            std::transform(tag_value.begin(), tag_value.end(),
+                           tag_value.begin(),
+                           [](unsigned char c) { return std::tolower(c); });
+            if (tag_value.find(p.value) != std::string::npos) {
+                matched = true;
+                break;
+            }
         }
-
-        // Lowercase the tag value, to make sure our comparison is not
-        // case sensitive.
-        std::transform(tag_value->begin(), tag_value->end(), tag_value->begin(),
-                       [](unsigned char c) { return std::tolower(c); });
-        if (tag_value->find(p.value) == std::string::npos) {
-            // No substring match, this pattern does not match.
+        if (!matched) {
+            // No substring match, this pattern does not match. Accept this
+            // song because it can't possibly match this rule.
             return true;
         }
     }
@@ -43,6 +43,9 @@ class Rule {
     // Size returns the number of patterns in this rule.
     inline size_t Size() const { return patterns_.size(); }
 
+    // Patterns returns the patterns in this rule.
+    const std::vector<Pattern> &Patterns() const { return patterns_; }
+
     // Add the given pattern to this rule.
     void AddPattern(enum mpd_tag_type, std::string value);
 
@@ -1,61 +1,570 @@
+#include <algorithm>
 #include <cassert>
+#include <cstdint>
 #include <cstdlib>
+#include <functional>
 #include <numeric>
 #include <random>
+#include <sstream>
 #include <string>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
+#include <absl/hash/hash.h>
+
 #include "shuffle.h"
 
 namespace ashuffle {
 
-void ShuffleChain::Clear() {
+template <typename Engine>
+void BasicShuffleChain<Engine>::Clear() {
     _window.clear();
     _pool.clear();
-    _items.clear();
+    _weights.clear();
+    _pool_weights.Clear();
+    _pool_weights_stale = false;
+    _spread_keys.clear();
+    _recent_keys.clear();
+    _recent_key_counts.clear();
+    _item_starts.clear();
+    _uris.Clear();
+}
+
+template <typename Engine>
+void BasicShuffleChain<Engine>::Add(std::string_view uri, uint32_t weight) {
+    _item_starts.push_back(_uris.Add(uri));
+    AddWeight(weight);
+}
+
+template <typename Engine>
+void BasicShuffleChain<Engine>::Add(ShuffleItem item) {
+    assert(!item._uris.empty() && "cannot add empty item");
+    _item_starts.push_back(_uris.Size());
+    for (const std::string& uri : item._uris) {
+        _uris.Add(uri);
+    }
+    AddWeight(item._weight);
+}
+
+template <typename Engine>
+void BasicShuffleChain<Engine>::AddWeight(uint32_t weight) {
+    assert(weight >= 1 && "item weight must be at least 1");
+    size_t item = _item_starts.size() - 1;
+    if (!Weighted() && weight == kDefaultWeight) {
+        _pool.push_back(item);
+        return;
+    }
+    if (!Weighted()) {
+        // Switch to weighted sampling. Every item added so far has the
+        // default weight, and the pool is now tracked by _pool_weights.
+        _weights.assign(item, kDefaultWeight);
+        std::vector<size_t>().swap(_pool);
+    }
+    _weights.push_back(weight);
+    _pool_weights_stale = true;
+}
+
+template <typename Engine>
+void BasicShuffleChain<Engine>::SetWeight(size_t item, uint32_t weight) {
+    assert(item < Len() && "item out of range");
+    assert(weight >= 1 && "item weight must be at least 1");
+    if (!Weighted()) {
+        if (weight == kDefaultWeight) {
+            return;
+        }
+        _weights.assign(Len(), kDefaultWeight);
+        std::vector<size_t>().swap(_pool);
+        _pool_weights_stale = true;
+    }
+    uint32_t old = _weights[item];
+    _weights[item] = weight;
+    if (_pool_weights_stale) {
+        return;
+    }
+    // Items in the window are not in the tree, they pick up their new
+    // weight when they are returned to the pool.
+    if (std::find(_window.begin(), _window.end(), item) != _window.end()) {
+        return;
+    }
+    if (weight > old) {
+        _pool_weights.Add(item, weight - old);
+    } else {
+        _pool_weights.Sub(item, old - weight);
+    }
 }
 
-void ShuffleChain::Add(ShuffleItem item) {
-    _items.emplace_back(item);
-    _pool.push_back(_items.size() - 1);
+template <typename Engine>
+void BasicShuffleChain<Engine>::SetSpread(size_t distance) {
+    _spread = distance;
+    while (_recent_keys.size() > _spread) {
+        if (_recent_keys.front() != kNoSpreadKey) {
+            _recent_key_counts[_recent_keys.front()]--;
+        }
+        _recent_keys.pop_front();
+    }
 }
 
-size_t ShuffleChain::Len() const { return _items.size(); }
-size_t ShuffleChain::LenURIs() const {
-    size_t sum = 0;
-    for (auto& group : _items) {
-        sum += group._uris.size();
+template <typename Engine>
+void BasicShuffleChain<Engine>::SetSpreadKey(size_t item, uint32_t key) {
+    assert(item < Len() && "item out of range");
+    if (_spread_keys.size() <= item) {
+        _spread_keys.resize(Len(), kNoSpreadKey);
     }
-    return sum;
+    _spread_keys[item] = key;
+}
+
+template <typename Engine>
+ChainDiff BasicShuffleChain<Engine>::Update(BasicShuffleChain&& next) {
+    // Items are matched by a hash of their URIs. Hashing (rather than
+    // storing every old item's URIs in a set) keeps the extra memory used
+    // here to a few words per item, which matters for large libraries.
+    std::string key;
+    auto item_key = [&key](absl::Span<const std::string_view> uris) {
+        key.clear();
+        for (std::string_view uri : uris) {
+            key.append(uri);
+            // URIs cannot contain NUL, so this separates them unambiguously.
+            key.push_back('\0');
+        }
+        return absl::Hash<std::string_view>{}(key);
+    };
+
+    // Duplicate items (e.g., a song listed twice in a `--file` list) share
+    // a hash, so every old item is kept, and each is matched at most once.
+    std::unordered_multimap<size_t, size_t> old_items;
+    old_items.reserve(Len());
+    size_t old_item = 0;
+    ForEach([&](absl::Span<const std::string_view> uris) {
+        old_items.emplace(item_key(uris), old_item++);
+    });
+
+    // old_to_new[i] is the index of old item i in `next`, or kMissing.
+    constexpr size_t kMissing = static_cast<size_t>(-1);
+    std::vector<size_t> old_to_new(Len(), kMissing);
+    std::vector<bool> matched(next.Len(), false);
+    std::vector<std::string> old_uris;
+    size_t new_item = 0;
+    next.ForEach([&](absl::Span<const std::string_view> uris) {
+        auto [it, end] = old_items.equal_range(item_key(uris));
+        for (; it != end; ++it) {
+            if (old_to_new[it->second] != kMissing) {
+                continue;
+            }
+            // Make sure this is not a hash collision.
+            Decode(it->second, &old_uris);
+            if (std::equal(old_uris.begin(), old_uris.end(), uris.begin(),
+                           uris.end())) {
+                old_to_new[it->second] = new_item;
+                matched[new_item] = true;
+                break;
+            }
+        }
+        new_item++;
+    });
+    std::unordered_multimap<size_t, size_t>().swap(old_items);
+
+    ChainDiff diff;
+    diff.added = std::count(matched.begin(), matched.end(), false);
+    diff.removed = std::count(old_to_new.begin(), old_to_new.end(), kMissing);
+
+    // Spread keys are re-assigned by every load, so the recently drawn keys
+    // need to be translated into the keys used by `next`.
+    std::unordered_map<uint32_t, uint32_t> new_keys;
+    for (size_t item = 0; item < old_to_new.size(); item++) {
+        if (old_to_new[item] == kMissing || item >= _spread_keys.size() ||
+            _spread_keys[item] == kNoSpreadKey) {
+            continue;
+        }
+        size_t to = old_to_new[item];
+        new_keys.try_emplace(_spread_keys[item], to < next._spread_keys.size()
+                                                     ? next._spread_keys[to]
+                                                     : kNoSpreadKey);
+    }
+    std::vector<uint32_t> recent_keys;
+    for (uint32_t key : _recent_keys) {
+        auto it = new_keys.find(key);
+        recent_keys.push_back(it == new_keys.end() ? kNoSpreadKey
+                                                   : it->second);
+    }
+
+    std::deque<size_t> window;
+    for (size_t item : _window) {
+        if (old_to_new[item] != kMissing) {
+            window.push_back(old_to_new[item]);
+        }
+    }
+    // Surviving pool items keep their order, and new items go at the end.
+    std::vector<size_t> pool;
+    if (!next.Weighted()) {
+        pool.reserve(next.Len() - window.size());
+        if (!Weighted()) {
+            for (size_t item : _pool) {
+                if (old_to_new[item] != kMissing) {
+                    pool.push_back(old_to_new[item]);
+                }
+            }
+        } else {
+            // The weighted pool is unordered, it is every item not in the
+            // window.
+            std::vector<bool> in_window(old_to_new.size(), false);
+            for (size_t item : _window) {
+                in_window[item] = true;
+            }
+            for (size_t item = 0; item < old_to_new.size(); item++) {
+                if (old_to_new[item] != kMissing && !in_window[item]) {
+                    pool.push_back(old_to_new[item]);
+                }
+            }
+        }
+        for (size_t item = 0; item < matched.size(); item++) {
+            if (!matched[item]) {
+                pool.push_back(item);
+            }
+        }
+    }
+
+    _uris = std::move(next._uris);
+    _item_starts = std::move(next._item_starts);
+    _weights = std::move(next._weights);
+    _spread_keys = std::move(next._spread_keys);
+    _window = std::move(window);
+    _pool = std::move(pool);
+    _pool_weights.Clear();
+    _pool_weights_stale = Weighted();
+    SetRecentKeys(recent_keys);
+    return diff;
+}
+
+template <typename Engine>
+size_t BasicShuffleChain<Engine>::Len() const {
+    return _item_starts.size();
+}
+
+template <typename Engine>
+size_t BasicShuffleChain<Engine>::LenURIs() const {
+    return _uris.Size();
+}
+
+template <typename Engine>
+ChainStats BasicShuffleChain<Engine>::Stats() const {
+    ChainStats stats;
+    stats.items = _item_starts.size();
+    stats.uris = _uris.Size();
+    stats.uri_bytes = _uris.Bytes();
+    stats.window = _window.size();
+    stats.pool = _item_starts.size() - _window.size();
+    stats.picks = _picks;
+    return stats;
+}
+
+template <typename Engine>
+size_t BasicShuffleChain<Engine>::ItemEnd(size_t item) const {
+    return item + 1 < _item_starts.size() ? _item_starts[item + 1]
+                                          : _uris.Size();
+}
+
+template <typename Engine>
+void BasicShuffleChain<Engine>::Decode(size_t item,
+                                       std::vector<std::string>* out,
+                                       size_t at) const {
+    size_t first = _item_starts[item];
+    size_t end = ItemEnd(item);
+    // Resizing keeps the existing strings (and their buffers) around, so
+    // decoding into a re-used vector does not allocate in steady state.
+    out->resize(at + end - first);
+    for (size_t id = first; id < end; id++) {
+        _uris.Get(id, &(*out)[at + id - first]);
+    }
+}
+
+template <typename Engine>
+void BasicShuffleChain<Engine>::DrawFromPool() {
+    // The number of draws to make while looking for an item that does not
+    // violate the spread constraint.
+    constexpr int kSpreadAttempts = 16;
+
+    if (Weighted()) {
+        if (_pool_weights_stale) {
+            BuildPoolWeights();
+        }
+        /* pick a song from the pool in proportion to its weight, and zero
+         * out its weight while it is in the window. */
+        size_t item =
+            _pool_weights.Find(UniformBelow(_rng, _pool_weights.Total()));
+        for (int i = 1; i < kSpreadAttempts && SpreadConflict(item); i++) {
+            item =
+                _pool_weights.Find(UniformBelow(_rng, _pool_weights.Total()));
+        }
+        _pool_weights.Sub(item, _weights[item]);
+        _window.push_back(item);
+        RecordSpread(item);
+        return;
+    }
+    /* push a random song from the pool onto the end of the window, and
+     * back-fill its slot in the pool with the last pool entry. */
+    size_t idx = UniformBelow(_rng, _pool.size());
+    for (int i = 1; i < kSpreadAttempts && SpreadConflict(_pool[idx]); i++) {
+        idx = UniformBelow(_rng, _pool.size());
+    }
+    _window.push_back(_pool[idx]);
+    RecordSpread(_pool[idx]);
+    _pool[idx] = _pool.back();
+    _pool.pop_back();
+}
+
+template <typename Engine>
+bool BasicShuffleChain<Engine>::SpreadConflict(size_t item) const {
+    if (item >= _spread_keys.size()) {
+        return false;
+    }
+    uint32_t key = _spread_keys[item];
+    return key != kNoSpreadKey && key < _recent_key_counts.size() &&
+           _recent_key_counts[key] > 0;
+}
+
+template <typename Engine>
+void BasicShuffleChain<Engine>::RecordSpread(size_t item) {
+    if (_spread == 0) {
+        return;
+    }
+    uint32_t key =
+        item < _spread_keys.size() ? _spread_keys[item] : kNoSpreadKey;
+    if (key != kNoSpreadKey) {
+        if (key >= _recent_key_counts.size()) {
+            _recent_key_counts.resize(key + 1);
+        }
+        _recent_key_counts[key]++;
+    }
+    _recent_keys.push_back(key);
+    if (_recent_keys.size() > _spread) {
+        if (_recent_keys.front() != kNoSpreadKey) {
+            _recent_key_counts[_recent_keys.front()]--;
+        }
+        _recent_keys.pop_front();
+    }
+}
+
+template <typename Engine>
+void BasicShuffleChain<Engine>::SetRecentKeys(
+    absl::Span<const uint32_t> keys) {
+    _recent_keys.clear();
+    _recent_key_counts.clear();
+    for (uint32_t key : keys) {
+        if (key != kNoSpreadKey && key >= _recent_key_counts.size()) {
+            _recent_key_counts.resize(key + 1);
+        }
+        if (key != kNoSpreadKey) {
+            _recent_key_counts[key]++;
+        }
+        _recent_keys.push_back(key);
+    }
+}
+
+template <typename Engine>
+void BasicShuffleChain<Engine>::ReturnToPool(size_t item) {
+    if (!Weighted()) {
+        _pool.push_back(item);
+    } else if (!_pool_weights_stale) {
+        _pool_weights.Add(item, _weights[item]);
+    }
+}
+
+template <typename Engine>
+void BasicShuffleChain<Engine>::BuildPoolWeights() {
+    std::vector<uint64_t> weights(_weights.begin(), _weights.end());
+    for (size_t item : _window) {
+        weights[item] = 0;
+    }
+    _pool_weights.Assign(std::move(weights));
+    _pool_weights_stale = false;
 }
 
 /* ensure that our window is as full as it can possibly be. */
-void ShuffleChain::FillWindow() {
-    while (_window.size() <= _max_window && _pool.size() > 0) {
-        std::uniform_int_distribution<unsigned long long> rd{0,
-                                                             _pool.size() - 1};
-        /* push a random song from the pool onto the end of the window */
-        size_t idx = rd(_rng);
-        _window.push_back(_pool[idx]);
-        _pool.erase(_pool.begin() + idx);
+template <typename Engine>
+void BasicShuffleChain<Engine>::FillWindow() {
+    while (_window.size() <= _max_window && _window.size() < Len()) {
+        DrawFromPool();
     }
 }
 
-const std::vector<std::string>& ShuffleChain::Pick() {
+template <typename Engine>
+ItemView BasicShuffleChain<Engine>::Pick() {
     assert(Len() != 0 && "cannot pick from empty chain");
     FillWindow();
     size_t picked_idx = _window[0];
     _window.pop_front();
-    _pool.push_back(picked_idx);
-    return _items[picked_idx]._uris;
+    ReturnToPool(picked_idx);
+    _picks++;
+    Decode(picked_idx, &_picked);
+    return _picked;
 }
 
-std::vector<std::vector<std::string>> ShuffleChain::Items() {
-    std::vector<std::vector<std::string>> result;
-    for (auto group : _items) {
-        result.push_back(group._uris);
+template <typename Engine>
+void BasicShuffleChain<Engine>::PickN(size_t n,
+                                      std::vector<std::string>* out) {
+    assert(Len() != 0 && "cannot pick from empty chain");
+    if (n == 0) {
+        return;
     }
+    FillWindow();
+    for (size_t i = 0; i < n; i++) {
+        size_t picked_idx = _window.front();
+        _window.pop_front();
+        ReturnToPool(picked_idx);
+        _picks++;
+        Decode(picked_idx, out, out->size());
+        // The window was full before this pick, and the pool has at least
+        // the picked item in it, so drawing a single item is exactly what
+        // FillWindow would do before the next Pick.
+        if (i + 1 < n) {
+            DrawFromPool();
+        }
+    }
+}
+
+template <typename Engine>
+void BasicShuffleChain<Engine>::ForEach(
+    absl::FunctionRef<void(absl::Span<const std::string_view>)> f) const {
+    // URIs of a multi-URI item are buffered here until the whole item has
+    // been decoded. This is only ever as large as the largest group.
+    std::string group;
+    std::vector<size_t> group_ends;
+    std::vector<std::string_view> group_uris;
+
+    size_t item = 0;
+    _uris.ForEach([&](size_t id, std::string_view uri) {
+        bool last = id + 1 == ItemEnd(item);
+        if (last && group_ends.empty()) {
+            // Fast path: single URI items can be passed straight through.
+            f(absl::MakeConstSpan(&uri, 1));
+            item++;
+            return;
+        }
+        group.append(uri);
+        group_ends.push_back(group.size());
+        if (!last) {
+            return;
+        }
+        size_t begin = 0;
+        for (size_t end : group_ends) {
+            group_uris.emplace_back(group.data() + begin, end - begin);
+            begin = end;
+        }
+        f(group_uris);
+        group.clear();
+        group_ends.clear();
+        group_uris.clear();
+        item++;
+    });
+}
+
+template <typename Engine>
+std::vector<std::vector<std::string>> BasicShuffleChain<Engine>::Items()
+    const {
+    std::vector<std::vector<std::string>> result;
+    result.reserve(_item_starts.size());
+    ForEach([&result](absl::Span<const std::string_view> uris) {
+        result.emplace_back(uris.begin(), uris.end());
+    });
     return result;
 }
 
+template <typename Engine>
+void BasicShuffleChain<Engine>::SaveItems(SnapshotWriter* out) const {
+    out->PutArray(_item_starts);
+    _uris.Save(out);
+    out->PutArray(_weights);
+    out->PutArray(_spread_keys);
+}
+
+template <typename Engine>
+bool BasicShuffleChain<Engine>::RestoreItems(SnapshotReader* in) {
+    Clear();
+    bool ok = in->GetArray(&_item_starts) && _uris.Restore(in) &&
+              in->GetArray(&_weights) && in->GetArray(&_spread_keys);
+    // Make sure every index refers to something that exists, so a corrupt
+    // snapshot cannot cause out of bounds accesses later. Items are
+    // non-empty, contiguous ranges of URIs, covering every URI in order.
+    ok = ok && (_weights.empty() || _weights.size() == Len()) &&
+         _spread_keys.size() <= Len() &&
+         std::all_of(_weights.begin(), _weights.end(),
+                     [](uint32_t weight) { return weight >= 1; }) &&
+         _item_starts.empty() == (_uris.Size() == 0) &&
+         (_item_starts.empty() || _item_starts.front() == 0) &&
+         std::adjacent_find(_item_starts.begin(), _item_starts.end(),
+                            std::greater_equal<size_t>()) ==
+             _item_starts.end() &&
+         (_item_starts.empty() || _item_starts.back() < _uris.Size());
+    if (!ok) {
+        Clear();
+        return false;
+    }
+    if (Weighted()) {
+        _pool_weights_stale = true;
+    } else {
+        _pool.resize(Len());
+        std::iota(_pool.begin(), _pool.end(), 0);
+    }
+    return true;
+}
+
+template <typename Engine>
+void BasicShuffleChain<Engine>::Save(SnapshotWriter* out) const {
+    SaveItems(out);
+    out->PutArray(std::vector<size_t>(_window.begin(), _window.end()));
+    out->PutArray(_pool);
+    out->PutArray(
+        std::vector<uint32_t>(_recent_keys.begin(), _recent_keys.end()));
+    out->PutU64(_picks);
+    std::ostringstream rng;
+    rng << _rng;
+    out->PutString(rng.str());
+}
+
+template <typename Engine>
+bool BasicShuffleChain<Engine>::Restore(SnapshotReader* in) {
+    std::vector<size_t> window;
+    std::vector<uint32_t> recent_keys;
+    std::string rng;
+    uint64_t picks = 0;
+    bool ok = RestoreItems(in) && in->GetArray(&window) &&
+              in->GetArray(&_pool) && in->GetArray(&recent_keys) &&
+              in->GetU64(&picks) && in->GetString(&rng);
+    // Every item must be in exactly one of the window and the pool, so a
+    // corrupt snapshot cannot repeat, drop, or draw from an empty pool. A
+    // weighted chain tracks its pool by weight, so the index pool is empty
+    // and every item outside the window is in the pool.
+    std::vector<bool> seen(Len());
+    auto unseen = [&seen](size_t item) {
+        if (item >= seen.size() || seen[item]) {
+            return false;
+        }
+        seen[item] = true;
+        return true;
+    };
+    ok = ok && window.size() <= _max_window &&
+         std::all_of(window.begin(), window.end(), unseen) &&
+         std::all_of(_pool.begin(), _pool.end(), unseen) &&
+         (Weighted() ? _pool.empty()
+                     : window.size() + _pool.size() == Len());
+    if (ok) {
+        std::istringstream rng_in(rng);
+        ok = static_cast<bool>(rng_in >> _rng);
+    }
+    if (!ok) {
+        Clear();
+        return false;
+    }
+    _picks = picks;
+    _window.assign(window.begin(), window.end());
+    SetRecentKeys(recent_keys);
+    // The restored keys may be from a chain with a larger spread.
+    SetSpread(_spread);
+    return true;
+}
+
+template class BasicShuffleChain<Xoshiro256>;
+template class BasicShuffleChain<std::mt19937>;
+
 }  // namespace ashuffle
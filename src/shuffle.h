@@ -1,74 +1,271 @@
 #ifndef __ASHUFFLE_SHUFFLE_H__
 #define __ASHUFFLE_SHUFFLE_H__
 
+#include <cstdint>
 #include <deque>
 #include <random>
 #include <string>
 #include <string_view>
 #include <vector>
 
+#include <absl/functional/function_ref.h>
+#include <absl/types/span.h>
+
+#include "fenwick_tree.h"
+#include "rng.h"
+#include "snapshot.h"
+#include "uri_arena.h"
+
 namespace ashuffle {
 
-class ShuffleChain;
+template <typename Engine>
+class BasicShuffleChain;
+
+// ItemView is a read-only view of the URIs in a single item (group) of a
+// ShuffleChain.
+using ItemView = absl::Span<const std::string>;
+
+// The weight of items added to a ShuffleChain without an explicit weight.
+constexpr uint32_t kDefaultWeight = 1;
+
+// The spread key of items that are not subject to the spread constraint.
+constexpr uint32_t kNoSpreadKey = 0;
 
+// ShuffleItem is a group of URIs that are always picked together.
 class ShuffleItem {
    public:
-    template <typename T>
-    ShuffleItem(T v) : ShuffleItem(std::vector<std::string>{v}){};
-    ShuffleItem(std::vector<std::string> uris) : _uris(uris){};
+    ShuffleItem(std::vector<std::string> uris, uint32_t weight = kDefaultWeight)
+        : _uris(std::move(uris)), _weight(weight){};
 
    private:
     std::vector<std::string> _uris;
-    friend class ShuffleChain;
+    uint32_t _weight;
+    template <typename Engine>
+    friend class BasicShuffleChain;
+};
+
+// ChainStats summarizes the contents of a ShuffleChain.
+struct ChainStats {
+    // The number of items (groups) in the chain.
+    size_t items = 0;
+    // The total number of URIs in the chain, in all items.
+    size_t uris = 0;
+    // The number of bytes used to store the chain's URIs.
+    size_t uri_bytes = 0;
+    // The number of items currently queued in the window.
+    size_t window = 0;
+    // The number of items in the pool (not in the window).
+    size_t pool = 0;
+    // The total number of items picked from the chain.
+    uint64_t picks = 0;
+};
+
+// ChainDiff summarizes the changes made to a ShuffleChain by Update.
+struct ChainDiff {
+    // The number of items that were not in the chain before the update.
+    size_t added = 0;
+    // The number of items that were in the chain, but not in the update.
+    size_t removed = 0;
 };
 
-class ShuffleChain {
+// BasicShuffleChain is a shuffle chain that draws its random numbers from
+// the given RandomNumberEngine. Most code should use the ShuffleChain alias
+// below; other engines are only instantiated for tests and benchmarks.
+template <typename Engine>
+class BasicShuffleChain {
    public:
+    using engine_type = Engine;
+
     // By default, create a new shuffle chain with a window-size of 1.
-    ShuffleChain() : ShuffleChain(1){};
+    BasicShuffleChain() : BasicShuffleChain(1){};
 
-    // Create a new ShuffleChain with the given window length.
-    explicit ShuffleChain(size_t window) : _max_window(window) {
-        std::random_device rd;
-        _rng.seed(rd());
+    // Create a new chain with the given window length, and a randomly
+    // seeded engine.
+    explicit BasicShuffleChain(size_t window) : _max_window(window) {
+        _rng.seed(RandomSeed());
     }
 
-    // Create a new ShuffleChain with the given window length
-    // and using the given RandomNumberEngine
-    ShuffleChain(size_t window, std::mt19937 rng)
+    // Create a new chain with the given window length and using the given
+    // engine. Chains built with identically seeded engines pick the same
+    // sequence of items.
+    BasicShuffleChain(size_t window, Engine rng)
         : _max_window(window), _rng(rng) {}
 
     // Clear this shuffle chain, removing anypreviously added songs.
     void Clear();
 
-    // Add a string to the pool of songs that can be picked out of this
-    // chain.
+    // Add a single song URI to the pool of songs that can be picked out of
+    // this chain. Once the chain has grown to its steady-state size (e.g.,
+    // after a Clear and reload), this does not allocate.
+    //
+    // Items are picked out of the pool with probability proportional to
+    // their weight, which must be at least 1.
+    void Add(std::string_view uri, uint32_t weight = kDefaultWeight);
+
+    // Add a group of songs to the pool of songs that can be picked out of
+    // this chain. All songs in the group are picked together.
     void Add(ShuffleItem i);
 
+    // Set the weight of the item with the given index (items are indexed in
+    // the order they were added). This is O(log n) once the chain is being
+    // picked from.
+    void SetWeight(size_t item, uint32_t weight);
+
+    // Avoid picking two items with the same spread key (e.g., the same
+    // artist) within `distance` picks of each other. Zero disables the
+    // constraint. This is best-effort: if no such item is found after a
+    // few random draws, the last one drawn is used anyway, so picks stay
+    // O(1) even when the constraint cannot be met.
+    void SetSpread(size_t distance);
+
+    // Set the spread key of the item with the given index. Spread keys are
+    // small integers (e.g., a dictionary-encoded artist name). Items with
+    // kNoSpreadKey, the default, never conflict.
+    void SetSpreadKey(size_t item, uint32_t key);
+
+    // Update replaces the items in this chain with the items in `next`, but
+    // keeps the shuffle history: items that are in both chains (with exactly
+    // the same URIs) keep their place in the window, and in the pool, so
+    // only added and removed items affect what is picked next. Weights and
+    // spread keys are taken from `next`. The window size, spread, engine
+    // state, and pick count of this chain are kept. This is O(n) in the
+    // size of both chains, but, unlike Clear and a reload, it does not
+    // reset the window.
+    ChainDiff Update(BasicShuffleChain&& next);
+
     // Return the total number of Items (groups) in this chain.
     size_t Len() const;
 
     // Return the total number of URIs in this chain, in all items.
     size_t LenURIs() const;
 
-    // Pick a group of songs out of this chain.
-    const std::vector<std::string>& Pick();
+    // Return statistics about this chain. This is O(1), so it is cheap to
+    // call as often as needed.
+    ChainStats Stats() const;
+
+    // Pick a group of songs out of this chain. The returned view is only
+    // valid until the chain is next picked from or modified.
+    ItemView Pick();
+
+    // Pick `n` groups of songs out of this chain, appending the URIs of every
+    // picked group to `out`. This is equivalent to calling Pick `n` times,
+    // but refills the window only once and decodes straight into `out`, so
+    // it is much cheaper for large batches.
+    void PickN(size_t n, std::vector<std::string>* out);
+
+    // ForEach calls `f` once for every item in this chain, in the order the
+    // items were added. The URIs passed to `f` are only valid for the
+    // duration of the call. URIs are decoded one at a time, so unlike
+    // Items, this uses no additional memory proportional to the size of
+    // the chain.
+    void ForEach(
+        absl::FunctionRef<void(absl::Span<const std::string_view>)> f) const;
+
+    // Write the items in this chain, with their weights and spread keys, to
+    // the given snapshot. The shuffle history is not saved.
+    void SaveItems(SnapshotWriter* out) const;
+
+    // Replace the contents of this chain with the items read from the given
+    // snapshot, written by SaveItems. The window is left empty, so this is
+    // equivalent to Clear followed by re-adding every item. Returns false
+    // if the snapshot is malformed, in which case the chain is left empty.
+    bool RestoreItems(SnapshotReader* in);
+
+    // Write the contents of this chain (items, weights, the window, the pool,
+    // and the random number engine state) to the given snapshot. The window
+    // size and spread are configuration, and are not saved.
+    void Save(SnapshotWriter* out) const;
+
+    // Replace the contents of this chain with the contents read from the
+    // given snapshot. Picking from the restored chain continues exactly
+    // where the saved chain left off. Returns false if the snapshot is
+    // malformed, in which case the chain is left empty.
+    bool Restore(SnapshotReader* in);
 
     // Items returns a vector of all items in this chain. This operation is
     // extremely heavyweight, since it copies most of the storage used by
-    // the chain. Use with caution.
-    std::vector<std::vector<std::string>> Items();
+    // the chain. Prefer ForEach where possible.
+    std::vector<std::vector<std::string>> Items() const;
 
    private:
     void FillWindow();
 
+    // Move a random item from the pool to the end of the window.
+    void DrawFromPool();
+
+    // Return the given item (which was just picked out of the window) to the
+    // pool.
+    void ReturnToPool(size_t item);
+
+    // Record the weight of a newly added item.
+    void AddWeight(uint32_t weight);
+
+    // Return true if items are sampled by weight, rather than uniformly.
+    bool Weighted() const { return !_weights.empty(); }
+
+    // Rebuild _pool_weights from _weights, leaving out items in the window.
+    void BuildPoolWeights();
+
+    // Return true if the given item shares a spread key with one of the
+    // last _spread items drawn into the window.
+    bool SpreadConflict(size_t item) const;
+
+    // Record that the given item was drawn into the window.
+    void RecordSpread(size_t item);
+
+    // Replace the recently drawn spread keys with `keys`, oldest first.
+    void SetRecentKeys(absl::Span<const uint32_t> keys);
+
+    // Return the id one past the last URI of the item with the given index.
+    size_t ItemEnd(size_t item) const;
+
+    // Rebuild the URIs of the item with the given index into `out`,
+    // starting at index `at`. `out` is resized to fit.
+    void Decode(size_t item, std::vector<std::string>* out,
+                size_t at = 0) const;
+
     size_t _max_window;
-    std::vector<ShuffleItem> _items;
+    URIArena _uris;
+    // Items are stored as a flat offsets table: _item_starts[i] is the id of
+    // the first URI in item i, and the item extends up to the first URI of
+    // the next item (or the end of _uris). The URIs of an item are always
+    // added together, so URI ids within an item are contiguous and need no
+    // separate table.
+    std::vector<size_t> _item_starts;
     std::deque<size_t> _window;
-    std::deque<size_t> _pool;
-    std::mt19937 _rng;
+    // While every item has the default weight, the pool is sampled
+    // uniformly. It is unordered, picks swap the chosen index with the last
+    // element before removing it, so removal is O(1).
+    std::vector<size_t> _pool;
+    // Once any item has a non-default weight, _weights holds the weight of
+    // every item, and the pool is instead tracked by _pool_weights: items in
+    // the pool have their weight in the tree, items in the window have zero
+    // weight. The tree is rebuilt lazily after items are added.
+    std::vector<uint32_t> _weights;
+    FenwickTree _pool_weights;
+    bool _pool_weights_stale = false;
+    // Spread keys of each item, empty until a key is set. Items past the
+    // end have kNoSpreadKey.
+    std::vector<uint32_t> _spread_keys;
+    size_t _spread = 0;
+    // The keys of the last _spread items drawn into the window (which is
+    // the order they are picked in), and how many times each key occurs
+    // in it, so conflicts are checked without scanning.
+    std::deque<uint32_t> _recent_keys;
+    std::vector<uint32_t> _recent_key_counts;
+    Engine _rng;
+    uint64_t _picks = 0;
+    // Scratch storage for the most recently picked item.
+    std::vector<std::string> _picked;
 };
 
+extern template class BasicShuffleChain<Xoshiro256>;
+extern template class BasicShuffleChain<std::mt19937>;
+
+// ShuffleChain is the shuffle chain used by ashuffle. It uses the small,
+// fast Xoshiro256 engine.
+using ShuffleChain = BasicShuffleChain<Xoshiro256>;
+
 }  // namespace ashuffle
 
 #endif
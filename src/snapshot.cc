@@ -0,0 +1,172 @@
+#include "snapshot.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <system_error>
+#include <utility>
+
+#include <absl/strings/str_format.h>
+
+namespace ashuffle {
+
+namespace {
+
+constexpr char kMagic[8] = {'A', 'S', 'H', 'U', 'F', 'S', 'N', 'P'};
+constexpr uint32_t kFormatVersion = 2;
+// Written in native byte order, so a snapshot from a machine with a
+// different byte order can be detected.
+constexpr uint32_t kByteOrderMark = 0x01020304;
+
+// The size of the header: magic, version, byte order mark, and key.
+constexpr size_t kHeaderSize = sizeof(kMagic) + 2 * sizeof(uint32_t) + 8;
+
+}  // namespace
+
+void Fingerprint::Add(uint64_t v) {
+    for (int i = 0; i < 8; i++) {
+        hash_ ^= (v >> (i * 8)) & 0xff;
+        hash_ *= 0x100000001b3;
+    }
+}
+
+void Fingerprint::Add(std::string_view s) {
+    // Mix in the length first, so adjacent strings cannot run together.
+    Add(s.size());
+    for (unsigned char c : s) {
+        hash_ ^= c;
+        hash_ *= 0x100000001b3;
+    }
+}
+
+absl::StatusOr<SnapshotWriter> SnapshotWriter::Create(
+    std::filesystem::path path, uint64_t key) {
+    // The temporary file is created in the same directory as `path`, so it
+    // can be renamed over it.
+    std::string tmp = path.string() + ".XXXXXX";
+    int fd = mkstemp(tmp.data());
+    if (fd < 0) {
+        return absl::UnavailableError(absl::StrFormat(
+            "failed to create snapshot file '%s': %s", tmp,
+            std::strerror(errno)));
+    }
+    close(fd);
+    SnapshotWriter writer(std::move(path), std::move(tmp));
+    if (!writer.out_.is_open()) {
+        return absl::UnavailableError(absl::StrFormat(
+            "failed to open snapshot file '%s' for writing: %s",
+            writer.tmp_.string(), std::strerror(errno)));
+    }
+    writer.Put(kMagic, sizeof(kMagic));
+    writer.Put(&kFormatVersion, sizeof(kFormatVersion));
+    writer.Put(&kByteOrderMark, sizeof(kByteOrderMark));
+    writer.PutU64(key);
+    return writer;
+}
+
+SnapshotWriter::SnapshotWriter(SnapshotWriter&& other)
+    : path_(std::move(other.path_)),
+      tmp_(std::exchange(other.tmp_, {})),
+      out_(std::move(other.out_)) {}
+
+SnapshotWriter::~SnapshotWriter() {
+    if (!tmp_.empty()) {
+        out_.close();
+        std::error_code err;
+        std::filesystem::remove(tmp_, err);
+    }
+}
+
+absl::Status SnapshotWriter::Commit() {
+    out_.close();
+    if (out_.fail()) {
+        return absl::DataLossError(absl::StrFormat(
+            "failed to write snapshot file '%s'", tmp_.string()));
+    }
+    std::error_code err;
+    std::filesystem::rename(tmp_, path_, err);
+    if (err) {
+        return absl::UnavailableError(
+            absl::StrFormat("failed to move snapshot into place at '%s': %s",
+                            path_.string(), err.message()));
+    }
+    tmp_.clear();
+    return absl::OkStatus();
+}
+
+absl::StatusOr<SnapshotReader> SnapshotReader::Open(
+    const std::filesystem::path& path, uint64_t key) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        if (errno == ENOENT) {
+            return absl::NotFoundError(
+                absl::StrFormat("no snapshot at '%s'", path.string()));
+        }
+        return absl::UnavailableError(absl::StrFormat(
+            "failed to open snapshot '%s': %s", path.string(),
+            std::strerror(errno)));
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return absl::UnavailableError(absl::StrFormat(
+            "failed to stat snapshot '%s': %s", path.string(),
+            std::strerror(errno)));
+    }
+    size_t size = static_cast<size_t>(st.st_size);
+    if (size < kHeaderSize) {
+        close(fd);
+        return absl::DataLossError(
+            absl::StrFormat("snapshot '%s' is truncated", path.string()));
+    }
+    void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping stays valid after the file is closed.
+    close(fd);
+    if (data == MAP_FAILED) {
+        return absl::UnavailableError(absl::StrFormat(
+            "failed to map snapshot '%s': %s", path.string(),
+            std::strerror(errno)));
+    }
+    // The whole snapshot is read front to back, exactly once.
+    madvise(data, size, MADV_SEQUENTIAL);
+
+    SnapshotReader reader(static_cast<const char*>(data), size);
+    // The file is at least kHeaderSize long, so these reads cannot fail.
+    char magic[sizeof(kMagic)] = {};
+    uint32_t version = 0, byte_order = 0;
+    uint64_t got_key = 0;
+    reader.Get(magic, sizeof(magic));
+    reader.Get(&version, sizeof(version));
+    reader.Get(&byte_order, sizeof(byte_order));
+    reader.GetU64(&got_key);
+    if (std::memcmp(magic, kMagic, sizeof(kMagic)) != 0 ||
+        version != kFormatVersion || byte_order != kByteOrderMark) {
+        return absl::DataLossError(absl::StrFormat(
+            "'%s' is not a compatible ashuffle snapshot", path.string()));
+    }
+    if (got_key != key) {
+        return absl::FailedPreconditionError(
+            absl::StrFormat("snapshot '%s' is out of date", path.string()));
+    }
+    return reader;
+}
+
+SnapshotReader::SnapshotReader(SnapshotReader&& other)
+    : data_(std::exchange(other.data_, nullptr)),
+      size_(std::exchange(other.size_, 0)),
+      pos_(std::exchange(other.pos_, 0)) {}
+
+SnapshotReader::~SnapshotReader() {
+    if (data_ != nullptr) {
+        munmap(const_cast<char*>(data_), size_);
+    }
+}
+
+}  // namespace ashuffle
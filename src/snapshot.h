@@ -0,0 +1,152 @@
+#ifndef __ASHUFFLE_SNAPSHOT_H__
+#define __ASHUFFLE_SNAPSHOT_H__
+
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include <absl/status/status.h>
+#include <absl/status/statusor.h>
+
+namespace ashuffle {
+
+// Snapshots are compact binary files used to persist ashuffle state across
+// restarts. A snapshot starts with a fixed header, which includes a
+// caller-supplied 64-bit key. Snapshots are only read back if the key
+// matches, so callers should derive the key from everything that would
+// invalidate the snapshot (e.g., the MPD database version).
+//
+// The body is a sequence of fixed-width integers and length-prefixed
+// arrays, written in native byte order. Snapshots are not portable between
+// machines, and a snapshot with a foreign byte order is rejected.
+
+// Fingerprint is a small, stable (FNV-1a) hash, suitable for building
+// snapshot keys. Unlike absl::Hash, its value is the same in every process.
+class Fingerprint {
+   public:
+    void Add(uint64_t v);
+    void Add(std::string_view s);
+    uint64_t Value() const { return hash_; }
+
+   private:
+    uint64_t hash_ = 0xcbf29ce484222325;
+};
+
+// SnapshotWriter writes a snapshot file. The snapshot is written to a
+// uniquely named temporary file next to `path`, and only replaces the file
+// at `path` on Commit, so readers never observe a partially written
+// snapshot, and two writers never write to the same temporary file. The
+// temporary file is removed if the writer is destroyed without committing.
+class SnapshotWriter {
+   public:
+    // Start writing a new snapshot, with the given key, to `path`.
+    static absl::StatusOr<SnapshotWriter> Create(std::filesystem::path path,
+                                                 uint64_t key);
+
+    SnapshotWriter(SnapshotWriter&& other);
+    SnapshotWriter& operator=(SnapshotWriter&&) = delete;
+    SnapshotWriter(const SnapshotWriter&) = delete;
+    SnapshotWriter& operator=(const SnapshotWriter&) = delete;
+    ~SnapshotWriter();
+
+    void PutU64(uint64_t v) { Put(&v, sizeof(v)); }
+    void PutString(std::string_view s) {
+        PutU64(s.size());
+        Put(s.data(), s.size());
+    }
+
+    // Write a length-prefixed array of trivially copyable values.
+    template <typename T>
+    void PutArray(const std::vector<T>& values) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        PutU64(values.size());
+        Put(values.data(), values.size() * sizeof(T));
+    }
+
+    // Finish writing the snapshot, and move it into place.
+    absl::Status Commit();
+
+   private:
+    SnapshotWriter(std::filesystem::path path, std::filesystem::path tmp)
+        : path_(std::move(path)), tmp_(std::move(tmp)),
+          out_(tmp_, std::ios::binary | std::ios::trunc){};
+
+    void Put(const void* data, size_t size) {
+        out_.write(static_cast<const char*>(data), size);
+    }
+
+    std::filesystem::path path_;
+    std::filesystem::path tmp_;
+    std::ofstream out_;
+};
+
+// SnapshotReader reads back a snapshot written by SnapshotWriter. The file
+// is memory-mapped, so reading large arrays is a single copy out of the
+// page cache. All reads are bounds-checked: the Get* methods return false
+// if the snapshot is truncated.
+class SnapshotReader {
+   public:
+    // Open the snapshot at `path`. Returns a NOT_FOUND error if there is no
+    // snapshot, and a FAILED_PRECONDITION error if it has a different key.
+    static absl::StatusOr<SnapshotReader> Open(
+        const std::filesystem::path& path, uint64_t key);
+
+    SnapshotReader(SnapshotReader&& other);
+    SnapshotReader& operator=(SnapshotReader&&) = delete;
+    SnapshotReader(const SnapshotReader&) = delete;
+    SnapshotReader& operator=(const SnapshotReader&) = delete;
+    ~SnapshotReader();
+
+    bool GetU64(uint64_t* v) { return Get(v, sizeof(*v)); }
+    bool GetString(std::string* s) {
+        uint64_t size;
+        if (!GetU64(&size) || size > Remaining()) {
+            return false;
+        }
+        s->assign(data_ + pos_, size);
+        pos_ += size;
+        return true;
+    }
+
+    template <typename T>
+    bool GetArray(std::vector<T>* values) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        uint64_t count;
+        if (!GetU64(&count) || count > Remaining() / sizeof(T)) {
+            return false;
+        }
+        values->resize(count);
+        return Get(values->data(), count * sizeof(T));
+    }
+
+    // Returns true if the whole snapshot has been read.
+    bool Done() const { return pos_ == size_; }
+
+   private:
+    SnapshotReader(const char* data, size_t size)
+        : data_(data), size_(size), pos_(0){};
+
+    size_t Remaining() const { return size_ - pos_; }
+
+    bool Get(void* out, size_t size) {
+        if (size > Remaining()) {
+            return false;
+        }
+        std::memcpy(out, data_ + pos_, size);
+        pos_ += size;
+        return true;
+    }
+
+    const char* data_;
+    size_t size_;
+    size_t pos_;
+};
+
+}  // namespace ashuffle
+
+#endif  // __ASHUFFLE_SNAPSHOT_H__
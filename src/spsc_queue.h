@@ -0,0 +1,81 @@
+#ifndef __ASHUFFLE_SPSC_QUEUE_H__
+#define __ASHUFFLE_SPSC_QUEUE_H__
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace ashuffle {
+
+// SPSCQueue is a bounded, lock-free, first-in first-out queue for passing
+// values from exactly one producer thread to exactly one consumer thread.
+// Push waits while the queue is full, and Pop waits while it is empty.
+template <typename T>
+class SPSCQueue {
+   public:
+    // Create a queue that holds up to `capacity` values. The capacity is
+    // rounded up to a power of two, and must be non-zero.
+    explicit SPSCQueue(size_t capacity) {
+        size_t size = 1;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        slots_.resize(size);
+        mask_ = size - 1;
+    }
+
+    SPSCQueue(const SPSCQueue&) = delete;
+    SPSCQueue& operator=(const SPSCQueue&) = delete;
+
+    // Push `value` onto the back of the queue. Must only be called from the
+    // producer thread.
+    void Push(T value) {
+        const size_t tail = tail_.load(std::memory_order_relaxed);
+        for (int spins = 0;
+             tail - head_.load(std::memory_order_acquire) == slots_.size();
+             spins++) {
+            Wait(spins);
+        }
+        slots_[tail & mask_] = std::move(value);
+        tail_.store(tail + 1, std::memory_order_release);
+    }
+
+    // Pop the value at the front of the queue. Must only be called from the
+    // consumer thread.
+    T Pop() {
+        const size_t head = head_.load(std::memory_order_relaxed);
+        for (int spins = 0; tail_.load(std::memory_order_acquire) == head;
+             spins++) {
+            Wait(spins);
+        }
+        T value = std::move(slots_[head & mask_]);
+        head_.store(head + 1, std::memory_order_release);
+        return value;
+    }
+
+   private:
+    // Wait for the other thread. Waits are expected to be short when both
+    // threads are busy, so spin briefly before sleeping, so a thread that is
+    // blocked for a long time (e.g., on the network) does not burn a core.
+    static void Wait(int spins) {
+        if (spins < 64) {
+            std::this_thread::yield();
+        } else {
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+    }
+
+    std::vector<T> slots_;
+    size_t mask_;
+    // head_ and tail_ count the values popped and pushed. They are on
+    // separate cache lines, so the threads do not contend on them.
+    alignas(64) std::atomic<size_t> head_ = 0;
+    alignas(64) std::atomic<size_t> tail_ = 0;
+};
+
+}  // namespace ashuffle
+
+#endif  // __ASHUFFLE_SPSC_QUEUE_H__
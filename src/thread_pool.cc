@@ -0,0 +1,105 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+
+namespace ashuffle {
+
+ThreadPool::ThreadPool(unsigned threads) {
+    threads = std::max(threads, 1u);
+    for (unsigned i = 0; i < threads; i++) {
+        queues_.push_back(std::make_unique<Queue>());
+    }
+    for (unsigned i = 1; i < threads; i++) {
+        threads_.emplace_back(&ThreadPool::Work, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        stop_ = true;
+    }
+    wake_.notify_all();
+    for (std::thread& thread : threads_) {
+        thread.join();
+    }
+}
+
+void ThreadPool::ParallelFor(size_t n, size_t grain,
+                             const std::function<void(size_t, size_t)>& fn) {
+    grain = std::max<size_t>(grain, 1);
+    if (threads_.empty() || n <= grain) {
+        for (size_t begin = 0; begin < n; begin += grain) {
+            fn(begin, std::min(begin + grain, n));
+        }
+        return;
+    }
+
+    // Count the tasks before queueing them, since threads still looking for
+    // work from the last loop may start on them right away.
+    remaining_.fetch_add((n + grain - 1) / grain, std::memory_order_relaxed);
+    size_t task = 0;
+    for (size_t begin = 0; begin < n; begin += grain, task++) {
+        Queue& queue = *queues_[task % queues_.size()];
+        std::lock_guard<std::mutex> lock(queue.mu);
+        queue.tasks.push_back(Task{begin, std::min(begin + grain, n), &fn});
+    }
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        generation_++;
+    }
+    wake_.notify_all();
+
+    RunTasks(0);
+    // All tasks have been taken, wait for the ones still running on other
+    // threads.
+    while (remaining_.load(std::memory_order_acquire) != 0) {
+        std::this_thread::yield();
+    }
+}
+
+void ThreadPool::RunTasks(size_t self) {
+    while (std::optional<Task> task = Take(self)) {
+        (*task->fn)(task->begin, task->end);
+        remaining_.fetch_sub(1, std::memory_order_release);
+    }
+}
+
+std::optional<ThreadPool::Task> ThreadPool::Take(size_t self) {
+    {
+        Queue& own = *queues_[self];
+        std::lock_guard<std::mutex> lock(own.mu);
+        if (!own.tasks.empty()) {
+            Task task = own.tasks.back();
+            own.tasks.pop_back();
+            return task;
+        }
+    }
+    for (size_t i = 1; i < queues_.size(); i++) {
+        Queue& victim = *queues_[(self + i) % queues_.size()];
+        std::lock_guard<std::mutex> lock(victim.mu);
+        if (!victim.tasks.empty()) {
+            Task task = victim.tasks.front();
+            victim.tasks.pop_front();
+            return task;
+        }
+    }
+    return std::nullopt;
+}
+
+void ThreadPool::Work(size_t self) {
+    uint64_t seen = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mu_);
+            wake_.wait(lock, [&] { return stop_ || generation_ != seen; });
+            if (stop_) {
+                return;
+            }
+            seen = generation_;
+        }
+        RunTasks(self);
+    }
+}
+
+}  // namespace ashuffle
@@ -0,0 +1,79 @@
+#ifndef __ASHUFFLE_THREAD_POOL_H__
+#define __ASHUFFLE_THREAD_POOL_H__
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+namespace ashuffle {
+
+// ThreadPool runs loops over ranges of indices in parallel. Every thread
+// has its own queue of work, and threads that run out of work steal from
+// the queues of other threads, so work is balanced even when some parts of
+// the range take much longer than others.
+class ThreadPool {
+   public:
+    // Create a pool that runs loops on `threads` threads in total, including
+    // the thread calling ParallelFor. A pool of zero or one threads runs
+    // loops serially on the calling thread.
+    explicit ThreadPool(unsigned threads);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Call `fn(begin, end)` for disjoint ranges covering [0, n), each at
+    // most `grain` indices long, and return once all calls have finished.
+    // Calls may run concurrently, and in any order. ParallelFor must not be
+    // called concurrently with itself.
+    void ParallelFor(size_t n, size_t grain,
+                     const std::function<void(size_t, size_t)>& fn);
+
+   private:
+    struct Task {
+        size_t begin;
+        size_t end;
+        const std::function<void(size_t, size_t)>* fn;
+    };
+
+    struct Queue {
+        std::mutex mu;
+        std::deque<Task> tasks;
+    };
+
+    // Run tasks from the queue of thread `self`, stealing from other queues
+    // once it is empty, until there are no tasks left.
+    void RunTasks(size_t self);
+
+    // Take a task from the back of the queue of thread `self`, or steal one
+    // from the front of another queue.
+    std::optional<Task> Take(size_t self);
+
+    void Work(size_t self);
+
+    // One queue per thread. The calling thread uses queue 0.
+    std::vector<std::unique_ptr<Queue>> queues_;
+    std::vector<std::thread> threads_;
+
+    // The number of tasks of the current loop that have not finished.
+    std::atomic<size_t> remaining_ = 0;
+
+    // Guards generation_ and stop_. Workers wait on wake_ until a new loop
+    // is started (generation_ changes), or the pool is stopped.
+    std::mutex mu_;
+    std::condition_variable wake_;
+    uint64_t generation_ = 0;
+    bool stop_ = false;
+};
+
+}  // namespace ashuffle
+
+#endif  // __ASHUFFLE_THREAD_POOL_H__
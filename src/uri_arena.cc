@@ -0,0 +1,158 @@
+#include "uri_arena.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace ashuffle {
+
+namespace {
+
+// Append `v` to `out` as a LEB128-style variable length integer.
+void PutVarint(std::string* out, size_t v) {
+    while (v >= 0x80) {
+        out->push_back(static_cast<char>((v & 0x7f) | 0x80));
+        v >>= 7;
+    }
+    out->push_back(static_cast<char>(v));
+}
+
+// Decode a variable length integer from `data` starting at `*pos`, and
+// advance `*pos` past it.
+size_t GetVarint(const std::string& data, size_t* pos) {
+    size_t result = 0;
+    for (int shift = 0;; shift += 7) {
+        uint8_t byte = static_cast<uint8_t>(data[(*pos)++]);
+        result |= static_cast<size_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return result;
+        }
+    }
+}
+
+// Same as GetVarint, but returns false instead of reading past the end of
+// `data`, or decoding a value that does not fit in a size_t.
+bool GetVarintChecked(const std::string& data, size_t* pos, size_t* v) {
+    size_t result = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (*pos >= data.size()) {
+            return false;
+        }
+        uint8_t byte = static_cast<uint8_t>(data[(*pos)++]);
+        result |= static_cast<size_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            *v = result;
+            return true;
+        }
+    }
+    return false;
+}
+
+}  // namespace
+
+size_t URIArena::Add(std::string_view uri) {
+    size_t shared = 0;
+    if (size_ % kRestartInterval == 0) {
+        // Restart points are always stored in full.
+        restarts_.push_back(data_.size());
+    } else {
+        size_t max_shared = std::min(last_.size(), uri.size());
+        while (shared < max_shared && last_[shared] == uri[shared]) {
+            shared++;
+        }
+    }
+    PutVarint(&data_, shared);
+    PutVarint(&data_, uri.size() - shared);
+    data_.append(uri.substr(shared));
+    last_.assign(uri);
+    return size_++;
+}
+
+void URIArena::Get(size_t id, std::string* out) const {
+    assert(id < size_ && "URI id out of range");
+    size_t pos = restarts_[id / kRestartInterval];
+    out->clear();
+    for (size_t i = 0; i <= id % kRestartInterval; i++) {
+        size_t shared = GetVarint(data_, &pos);
+        size_t suffix = GetVarint(data_, &pos);
+        out->resize(shared);
+        out->append(data_, pos, suffix);
+        pos += suffix;
+    }
+}
+
+void URIArena::ForEach(
+    absl::FunctionRef<void(size_t, std::string_view)> f) const {
+    std::string uri;
+    size_t pos = 0;
+    for (size_t id = 0; id < size_; id++) {
+        size_t shared = GetVarint(data_, &pos);
+        size_t suffix = GetVarint(data_, &pos);
+        uri.resize(shared);
+        uri.append(data_, pos, suffix);
+        pos += suffix;
+        f(id, uri);
+    }
+}
+
+size_t URIArena::Bytes() const {
+    return data_.size() + restarts_.size() * sizeof(size_t);
+}
+
+void URIArena::Clear() {
+    data_.clear();
+    restarts_.clear();
+    last_.clear();
+    size_ = 0;
+}
+
+void URIArena::Save(SnapshotWriter* out) const {
+    out->PutString(data_);
+    out->PutArray(restarts_);
+    out->PutString(last_);
+    out->PutU64(size_);
+}
+
+bool URIArena::Restore(SnapshotReader* in) {
+    uint64_t size;
+    if (!in->GetString(&data_) || !in->GetArray(&restarts_) ||
+        !in->GetString(&last_) || !in->GetU64(&size) ||
+        restarts_.size() != (size + kRestartInterval - 1) / kRestartInterval ||
+        !Valid(size)) {
+        Clear();
+        return false;
+    }
+    size_ = size;
+    return true;
+}
+
+bool URIArena::Valid(size_t size) const {
+    // Every entry takes at least two bytes (its two lengths).
+    if (size > data_.size() / 2) {
+        return false;
+    }
+    // Walk every entry, so Get and ForEach can trust the lengths and
+    // offsets they decode without checking them again.
+    size_t pos = 0;
+    size_t length = 0;
+    for (size_t id = 0; id < size; id++) {
+        size_t shared, suffix;
+        if (id % kRestartInterval == 0 &&
+            restarts_[id / kRestartInterval] != pos) {
+            return false;
+        }
+        if (!GetVarintChecked(data_, &pos, &shared) ||
+            !GetVarintChecked(data_, &pos, &suffix) ||
+            (id % kRestartInterval == 0 && shared != 0) || shared > length ||
+            suffix > data_.size() - pos) {
+            return false;
+        }
+        pos += suffix;
+        length = shared + suffix;
+    }
+    return pos == data_.size() && last_.size() == length;
+}
+
+}  // namespace ashuffle
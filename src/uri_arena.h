@@ -0,0 +1,79 @@
+#ifndef __ASHUFFLE_URI_ARENA_H__
+#define __ASHUFFLE_URI_ARENA_H__
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <absl/functional/function_ref.h>
+
+#include "snapshot.h"
+
+namespace ashuffle {
+
+// URIArena is a compact, append-only store for song URIs. URIs are stored
+// front-coded in a single contiguous buffer: each entry records the length
+// of the prefix it shares with the previous URI, followed by the remaining
+// suffix. Since MPD lists songs in directory order, most URIs share a long
+// "artist/album/" prefix with their predecessor, so this is much smaller
+// than storing each URI as a separate std::string.
+//
+// Every kRestartInterval'th URI is stored in full (a "restart point"), and
+// its offset is recorded in a flat offsets table, so any single URI can be
+// rebuilt by decoding at most kRestartInterval entries.
+class URIArena {
+   public:
+    // The number of URIs between restart points.
+    static constexpr size_t kRestartInterval = 16;
+
+    // Add the given URI to the end of the arena, and return its id. Ids are
+    // assigned sequentially, starting from zero.
+    size_t Add(std::string_view uri);
+
+    // Rebuild the URI with the given id into `out`, replacing any existing
+    // contents.
+    void Get(size_t id, std::string* out) const;
+
+    // Call `f` with the id and value of every URI in this arena, in id
+    // order. URIs are decoded sequentially into a single buffer, so this
+    // does not allocate per-URI. The string_view passed to `f` is only valid
+    // for the duration of the call.
+    void ForEach(absl::FunctionRef<void(size_t, std::string_view)> f) const;
+
+    // Return the number of URIs stored in this arena.
+    size_t Size() const { return size_; }
+
+    // Return the number of bytes used to store URIs in this arena, including
+    // the offsets table.
+    size_t Bytes() const;
+
+    // Remove all URIs from this arena.
+    void Clear();
+
+    // Write the contents of this arena to the given snapshot.
+    void Save(SnapshotWriter* out) const;
+
+    // Replace the contents of this arena with the contents read from the
+    // given snapshot. Returns false if the snapshot is malformed, in which
+    // case the arena is left empty.
+    bool Restore(SnapshotReader* in);
+
+   private:
+    // Returns true if data_ holds exactly `size` well-formed entries, and
+    // restarts_ points at every restart point.
+    bool Valid(size_t size) const;
+
+    // data_ holds the front-coded URI entries.
+    std::string data_;
+    // restarts_ holds the offset in data_ of every restart point.
+    std::vector<size_t> restarts_;
+    // last_ is the most recently added URI, used to compute the shared
+    // prefix of the next URI.
+    std::string last_;
+    size_t size_ = 0;
+};
+
+}  // namespace ashuffle
+
+#endif  // __ASHUFFLE_URI_ARENA_H__
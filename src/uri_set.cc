@@ -0,0 +1,94 @@
+#include "uri_set.h"
+
+#include <algorithm>
+#include <cassert>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <absl/hash/hash.h>
+
+namespace ashuffle {
+
+namespace {
+
+// The number of slots in a new table.
+constexpr size_t kInitialSlots = 16;
+
+uint64_t HashURI(std::string_view uri) {
+    return absl::Hash<std::string_view>{}(uri);
+}
+
+}  // namespace
+
+std::string_view URISet::At(uint32_t id) const {
+    assert(id != 0 && id <= ends_.size() && "URI id out of range");
+    size_t begin = id == 1 ? 0 : ends_[id - 2];
+    return std::string_view(data_).substr(begin, ends_[id - 1] - begin);
+}
+
+size_t URISet::Find(std::string_view uri, uint64_t hash) const {
+    size_t mask = slots_.size() - 1;
+    for (size_t pos = hash & mask;; pos = (pos + 1) & mask) {
+        const Slot& slot = slots_[pos];
+        if (slot.id == 0 || (slot.hash == hash && At(slot.id) == uri)) {
+            return pos;
+        }
+    }
+}
+
+void URISet::Rehash(size_t size) {
+    std::vector<Slot> old = std::exchange(slots_, std::vector<Slot>(size));
+    size_t mask = slots_.size() - 1;
+    for (const Slot& slot : old) {
+        if (slot.id == 0) {
+            continue;
+        }
+        // URIs in the old table are distinct, so there is no need to compare
+        // them, just find the first empty slot.
+        size_t pos = slot.hash & mask;
+        while (slots_[pos].id != 0) {
+            pos = (pos + 1) & mask;
+        }
+        slots_[pos] = slot;
+    }
+}
+
+void URISet::Reserve(size_t n) {
+    size_t size = std::max(kInitialSlots, slots_.size());
+    while (n * 2 > size) {
+        size *= 2;
+    }
+    if (size != slots_.size()) {
+        Rehash(size);
+    }
+    ends_.reserve(n);
+}
+
+void URISet::Insert(std::string_view uri) {
+    if ((ends_.size() + 1) * 2 > slots_.size()) {
+        Rehash(std::max(kInitialSlots, slots_.size() * 2));
+    }
+    uint64_t hash = HashURI(uri);
+    Slot& slot = slots_[Find(uri, hash)];
+    if (slot.id != 0) {
+        return;
+    }
+    data_.append(uri);
+    ends_.push_back(data_.size());
+    slot = Slot{hash, static_cast<uint32_t>(ends_.size())};
+}
+
+bool URISet::Contains(std::string_view uri) const {
+    if (slots_.empty()) {
+        return false;
+    }
+    return slots_[Find(uri, HashURI(uri))].id != 0;
+}
+
+size_t URISet::Bytes() const {
+    return data_.size() + ends_.size() * sizeof(size_t) +
+           slots_.size() * sizeof(Slot);
+}
+
+}  // namespace ashuffle
@@ -0,0 +1,63 @@
+#ifndef __ASHUFFLE_URI_SET_H__
+#define __ASHUFFLE_URI_SET_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace ashuffle {
+
+// URISet is a compact set of song URIs, used to check URIs from a large
+// list quickly. URIs are appended to a single contiguous buffer, and
+// indexed by an open-addressing hash table (with linear probing) of their
+// 64-bit hashes. Lookups only compare the URI bytes when the full hashes
+// match, so a miss rarely touches the buffer at all.
+class URISet {
+   public:
+    // Add `uri` to the set, if it is not already present.
+    void Insert(std::string_view uri);
+
+    // Make room for at least `n` URIs in total, so inserting them does not
+    // grow the hash table.
+    void Reserve(size_t n);
+
+    // Return true if `uri` is in the set.
+    bool Contains(std::string_view uri) const;
+
+    // Return the number of distinct URIs in the set.
+    size_t Size() const { return ends_.size(); }
+
+    // Return the number of bytes used by this set, including the hash table.
+    size_t Bytes() const;
+
+   private:
+    // An entry in the hash table. `id` is one more than the index of the URI
+    // in ends_, so zero marks an empty slot.
+    struct Slot {
+        uint64_t hash;
+        uint32_t id;
+    };
+
+    // Return the URI with the given (one-based) slot id.
+    std::string_view At(uint32_t id) const;
+
+    // Return the position of the slot holding `uri`, or of the empty slot
+    // where it would be inserted. There must be at least one empty slot.
+    size_t Find(std::string_view uri, uint64_t hash) const;
+
+    // Resize the hash table to `size` slots, and re-insert every slot.
+    void Rehash(size_t size);
+
+    // slots_ always has a power-of-two size, and is at most half full.
+    std::vector<Slot> slots_;
+    // data_ holds every URI back to back, in insertion order.
+    std::string data_;
+    // ends_ holds the offset in data_ one past the end of every URI.
+    std::vector<size_t> ends_;
+};
+
+}  // namespace ashuffle
+
+#endif  // __ASHUFFLE_URI_SET_H__
@@ -52,7 +52,20 @@ TEST(ParseTest, Empty) {
     EXPECT_EQ(opts.tweak.play_on_startup, true);
     EXPECT_EQ(opts.tweak.suspend_timeout, absl::ZeroDuration());
     EXPECT_EQ(opts.tweak.exit_on_db_update, false);
+    EXPECT_EQ(opts.tweak.directory_reload, false);
     EXPECT_EQ(opts.tweak.reconnect_timeout, absl::Seconds(10));
+    EXPECT_EQ(opts.tweak.seed, std::nullopt);
+    EXPECT_EQ(opts.tweak.weight_sticker, "");
+    EXPECT_EQ(opts.tweak.default_weight, 5u);
+    EXPECT_EQ(opts.tweak.spread_by, std::nullopt);
+    EXPECT_EQ(opts.tweak.spread, 3u);
+    EXPECT_EQ(opts.tweak.state_file, "");
+    EXPECT_EQ(opts.tweak.library_cache, false);
+    EXPECT_EQ(opts.tweak.list_chunk_size, 0u);
+    EXPECT_EQ(opts.tweak.load_threads, 1u);
+    EXPECT_EQ(opts.tweak.progressive_load, 0u);
+    EXPECT_EQ(opts.tweak.low_memory, false);
+    EXPECT_EQ(opts.tweak.watch_file, true);
 }
 
 TEST(ParseTest, Short) {
@@ -81,6 +94,7 @@ TEST(ParseTest, Short) {
     EXPECT_EQ(opts.ruleset.size(), 1U);
     EXPECT_EQ(opts.queue_only, 5U);
     EXPECT_THAT(opts.file_in, NotNull());
+    EXPECT_EQ(opts.file_in_path, "/dev/zero");
     EXPECT_FALSE(opts.check_uris);
     EXPECT_EQ(opts.queue_buffer, 10U);
     EXPECT_EQ(opts.port, 1234U);
@@ -226,6 +240,7 @@ TEST(ParseTest, FileInStdin) {
 
     opts = std::get<Options>(Options::Parse(tagger, {"-f", "-"}));
     EXPECT_EQ(opts.file_in, &std::cin);
+    EXPECT_EQ(opts.file_in_path, "");
 
     opts = std::get<Options>(Options::Parse(tagger, {"--file", "-"}));
     EXPECT_EQ(opts.file_in, &std::cin);
@@ -290,6 +305,94 @@ TEST(ParseTest, TweakReconnectTimeout) {
     }
 }
 
+TEST(ParseTest, TweakDirectoryReload) {
+    Options opts = std::get<Options>(
+        Options::Parse(fake::TagParser(), {"--tweak", "directory-reload=on"}));
+    EXPECT_TRUE(opts.tweak.directory_reload);
+}
+
+TEST(ParseTest, TweakLowMemory) {
+    Options opts = std::get<Options>(
+        Options::Parse(fake::TagParser(), {"--tweak", "low-memory=yes"}));
+    EXPECT_TRUE(opts.tweak.low_memory);
+}
+
+TEST(ParseTest, TweakWatchFile) {
+    Options opts = std::get<Options>(
+        Options::Parse(fake::TagParser(), {"--tweak", "watch-file=no"}));
+    EXPECT_FALSE(opts.tweak.watch_file);
+}
+
+TEST(ParseTest, TweakLibraryCache) {
+    Options opts = std::get<Options>(
+        Options::Parse(fake::TagParser(), {"--tweak", "library-cache=yes"}));
+    EXPECT_TRUE(opts.tweak.library_cache);
+}
+
+TEST(ParseTest, TweakListChunkSize) {
+    Options opts = std::get<Options>(
+        Options::Parse(fake::TagParser(), {"--tweak", "list-chunk-size=500"}));
+    EXPECT_EQ(opts.tweak.list_chunk_size, 500u);
+
+    auto err = std::get<ParseError>(Options::Parse(
+        fake::TagParser(), {"--tweak", "list-chunk-size=lots"}));
+    EXPECT_EQ(err.type, ParseError::Type::kGeneric);
+}
+
+TEST(ParseTest, TweakLoadThreads) {
+    Options opts = std::get<Options>(
+        Options::Parse(fake::TagParser(), {"--tweak", "load-threads=4"}));
+    EXPECT_EQ(opts.tweak.load_threads, 4u);
+
+    for (std::string bad : {"0", "-1", "many"}) {
+        auto err = std::get<ParseError>(Options::Parse(
+            fake::TagParser(), {"--tweak", "load-threads=" + bad}));
+        EXPECT_EQ(err.type, ParseError::Type::kGeneric) << "Case: " << bad;
+    }
+}
+
+TEST(ParseTest, TweakProgressiveLoad) {
+    Options opts = std::get<Options>(Options::Parse(
+        fake::TagParser(), {"--tweak", "progressive-load=1000"}));
+    EXPECT_EQ(opts.tweak.progressive_load, 1000u);
+
+    auto err = std::get<ParseError>(Options::Parse(
+        fake::TagParser(), {"--tweak", "progressive-load=soon"}));
+    EXPECT_EQ(err.type, ParseError::Type::kGeneric);
+}
+
+TEST(ParseTest, TweakSeed) {
+    Options opts = std::get<Options>(
+        Options::Parse(fake::TagParser(), {"--tweak", "seed=1234"}));
+    EXPECT_EQ(opts.tweak.seed, 1234u);
+}
+
+TEST(ParseTest, TweakWeights) {
+    Options opts = std::get<Options>(Options::Parse(
+        fake::TagParser(),
+        {"--tweak", "weight-sticker=rating", "-t", "default-weight=3"}));
+    EXPECT_EQ(opts.tweak.weight_sticker, "rating");
+    EXPECT_EQ(opts.tweak.default_weight, 3u);
+}
+
+TEST(ParseTest, TweakSpread) {
+    fake::TagParser tagger({{"artist", MPD_TAG_ARTIST}});
+    Options opts = std::get<Options>(Options::Parse(
+        tagger, {"--tweak", "spread-by=artist", "-t", "spread=10"}));
+    EXPECT_EQ(opts.tweak.spread_by, MPD_TAG_ARTIST);
+    EXPECT_EQ(opts.tweak.spread, 10u);
+
+    auto err = std::get<ParseError>(
+        Options::Parse(tagger, {"--tweak", "spread-by=color"}));
+    EXPECT_THAT(err.msg, HasSubstr("invalid tag name 'color'"));
+}
+
+TEST(ParseTest, TweakStateFile) {
+    Options opts = std::get<Options>(Options::Parse(
+        fake::TagParser(), {"--tweak", "state-file=/tmp/ashuffle.state"}));
+    EXPECT_EQ(opts.tweak.state_file, "/tmp/ashuffle.state");
+}
+
 using ParseFailureParam =
     std::tuple<std::vector<std::string>, Matcher<std::string>>;
 
@@ -383,6 +486,10 @@ std::vector<ParseFailureParam> constraint_cases = {
                "given)")},
     {{"--tweak", "suspend-timeout=-1ms"},
      HasSubstr("suspend-timeout must be a positive duration ('-1ms' given)")},
+    {{"--tweak", "default-weight=0"},
+     HasSubstr("default-weight must be >= 1 (0 given)")},
+    {{"--tweak", "seed=-1"},
+     HasSubstr("seed must be a non-negative integer ('-1' given)")},
 };
 
 INSTANTIATE_TEST_SUITE_P(Constraint, ParseFailureTest,
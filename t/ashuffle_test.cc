@@ -4,6 +4,8 @@
 #include <cassert>
 #include <cstring>
 #include <deque>
+#include <filesystem>
+#include <fstream>
 #include <functional>
 #include <iostream>
 #include <memory>
@@ -14,6 +16,7 @@
 #include <variant>
 #include <vector>
 
+#include <absl/strings/str_cat.h>
 #include <absl/strings/str_join.h>
 #include <absl/time/time.h>
 #include <mpd/error.h>
@@ -36,14 +39,17 @@
 
 using namespace ashuffle;
 
+using ::testing::ContainerEq;
 using ::testing::ElementsAre;
 using ::testing::Eq;
 using ::testing::ExitedWithCode;
 using ::testing::HasSubstr;
+using ::testing::IsEmpty;
 using ::testing::Optional;
 using ::testing::Pointee;
 using ::testing::ValuesIn;
 using ::testing::WhenDynamicCastTo;
+using ::testing::WhenSorted;
 
 void xsetenv(std::string k, std::string v) {
     if (setenv(k.data(), v.data(), 1) != 0) {
@@ -59,6 +65,17 @@ void xclearenv() {
     unsetenv("MPD_PORT");
 }
 
+// CacheDirEnvironment points the XDG cache directory at the test's temporary
+// directory, so the library cache written by Loop does not end up in the
+// user's cache directory.
+class CacheDirEnvironment : public testing::Environment {
+   public:
+    void SetUp() override { xsetenv("XDG_CACHE_HOME", testing::TempDir()); }
+};
+
+[[maybe_unused]] testing::Environment *const kCacheDirEnvironment =
+    testing::AddGlobalTestEnvironment(new CacheDirEnvironment);
+
 // This test delegate only allows the "init" part of the loop to run. No
 // continous logic runs.
 TestDelegate init_only_d = {
@@ -163,6 +180,21 @@ TEST_F(LoopTest, Requeue) {
     EXPECT_THAT(mpd.Playing(), Optional(song_a));
 }
 
+TEST_F(LoopTest, LowMemory) {
+    opts.tweak.play_on_startup = false;
+    opts.tweak.low_memory = true;
+    opts.queue_buffer = 3;
+
+    ASSERT_OK(Loop(&mpd, &chain, opts, loop_once_d));
+
+    // Songs are picked from MPD's database (which has both songs), rather
+    // than from the chain (which only has song_a).
+    ASSERT_EQ(mpd.queue.size(), 4u);
+    EXPECT_THAT(mpd.queue, testing::Contains(song_b));
+    EXPECT_EQ(chain.Stats().picks, 0u);
+    EXPECT_TRUE(mpd.state.playing);
+}
+
 TEST_F(LoopTest, RequeueEmpty) {
     opts.tweak.play_on_startup = false;
 
@@ -352,6 +384,133 @@ TEST(MPDUpdateTest, GroupByPersistsAcrossUpdate) {
     EXPECT_THAT(mpd.state.song_position, Optional(2));
 }
 
+TEST(MPDUpdateTest, UpdateKeepsWindow) {
+    fake::MPD mpd;
+    for (int i = 0; i < 5; i++) {
+        mpd.db.push_back(fake::Song(absl::StrCat("song_", i)));
+    }
+
+    ShuffleChain chain(2);
+    for (auto &song : mpd.db) {
+        chain.Add(song.URI());
+    }
+    chain.Pick();
+    ShuffleChain copy = chain;
+    std::vector<std::string> window;
+    copy.PickN(2, &window);
+
+    Options opts;
+    opts.tweak.play_on_startup = false;
+    mpd.db.push_back(fake::Song("song_new"));
+    mpd.idle_f = [] { return mpd::IdleEventSet(MPD_IDLE_DATABASE); };
+    ASSERT_OK(Loop(&mpd, &chain, opts, loop_once_d));
+
+    EXPECT_EQ(chain.Len(), 6u);
+    EXPECT_THAT(chain.Pick(), ElementsAre(window[0]));
+    EXPECT_THAT(chain.Pick(), ElementsAre(window[1]));
+}
+
+TEST(MPDUpdateTest, UpdateWithNoSongs) {
+    fake::MPD mpd;
+    mpd.db.push_back(fake::Song("song_a"));
+    mpd.db.push_back(fake::Song("song_b"));
+
+    ShuffleChain chain;
+    for (auto &song : mpd.db) {
+        chain.Add(song.URI());
+    }
+
+    Options opts;
+    opts.tweak.play_on_startup = false;
+    // An update that leaves nothing to pick is not applied.
+    mpd.db.clear();
+    mpd.idle_f = [] { return mpd::IdleEventSet(MPD_IDLE_DATABASE); };
+    ASSERT_OK(Loop(&mpd, &chain, opts, loop_once_d));
+    EXPECT_EQ(chain.Len(), 2u);
+
+    // The next update with songs is.
+    mpd.db.push_back(fake::Song("song_c"));
+    ASSERT_OK(Loop(&mpd, &chain, opts, loop_once_d));
+    EXPECT_THAT(chain.Items(), ElementsAre(ElementsAre("song_c")));
+}
+
+// The path of the `--file` list used by the FileUpdateTest tests.
+std::filesystem::path WatchedListPath() {
+    return std::filesystem::path(testing::TempDir()) / "watched_list";
+}
+
+void WriteWatchedList(const std::vector<std::string> &uris) {
+    std::ofstream(WatchedListPath()) << absl::StrJoin(uris, "\n");
+}
+
+class FileUpdateTest : public testing::Test {
+   public:
+    fake::MPD mpd;
+    ShuffleChain chain;
+    Options opts;
+    std::istringstream file_in;
+
+    // Set up MPD with six songs, and a `--file` list (and chain) with the
+    // first five.
+    void SetUp() override {
+        std::vector<std::string> uris;
+        for (int i = 0; i < 6; i++) {
+            mpd.db.push_back(fake::Song(absl::StrCat("song_", i)));
+            if (i < 5) {
+                uris.push_back(absl::StrCat("song_", i));
+                chain.Add(uris.back());
+            }
+        }
+        WriteWatchedList(uris);
+        opts.file_in = &file_in;
+        opts.file_in_path = WatchedListPath().string();
+        opts.tweak.play_on_startup = false;
+    }
+
+    void TearDown() override { std::filesystem::remove(WatchedListPath()); }
+};
+
+TEST_F(FileUpdateTest, Reload) {
+#ifndef ASHUFFLE_HAVE_INOTIFY
+    GTEST_SKIP() << "watching files requires inotify";
+#endif
+    // Rewrite the list while idling: song_0 is removed, song_5 is added, and
+    // song_6 is not in MPD's database, so it is not loaded.
+    mpd.idle_f = [] {
+        WriteWatchedList(
+            {"song_1", "song_2", "song_3", "song_4", "song_5", "song_6"});
+        return mpd::IdleEventSet();
+    };
+    ASSERT_OK(Loop(&mpd, &chain, opts, loop_once_d));
+
+    std::vector<std::vector<std::string>> want = {
+        {"song_1"}, {"song_2"}, {"song_3"}, {"song_4"}, {"song_5"}};
+    EXPECT_THAT(chain.Items(), WhenSorted(want));
+    // Nothing is enqueued for a change to the list.
+    EXPECT_THAT(mpd.queue, IsEmpty());
+}
+
+TEST_F(FileUpdateTest, EmptyListIgnored) {
+    mpd.idle_f = [] {
+        WriteWatchedList({});
+        return mpd::IdleEventSet();
+    };
+    ASSERT_OK(Loop(&mpd, &chain, opts, loop_once_d));
+
+    EXPECT_EQ(chain.Len(), 5u);
+}
+
+TEST_F(FileUpdateTest, WatchFileTweak) {
+    opts.tweak.watch_file = false;
+    mpd.idle_f = [] {
+        WriteWatchedList({"song_5"});
+        return mpd::IdleEventSet();
+    };
+    ASSERT_OK(Loop(&mpd, &chain, opts, loop_once_d));
+
+    EXPECT_EQ(chain.Len(), 5u);
+}
+
 TEST(MPDUpdateTest, ExitOnDBUpdateTweak) {
     fake::MPD mpd;
 
@@ -372,6 +531,197 @@ TEST(MPDUpdateTest, ExitOnDBUpdateTweak) {
                 ExitedWithCode(0), testing::_);
 }
 
+TEST(LibraryCacheTest, SaveAndRestore) {
+    fake::MPD mpd;
+    mpd.db.push_back(fake::Song("song_a"));
+    mpd.db.push_back(fake::Song("song_b"));
+
+    Options opts;
+    opts.tweak.library_cache = true;
+    ShuffleChain chain;
+    chain.Add("song_a");
+    chain.Add("song_b");
+    chain.Pick();
+    ASSERT_OK(SaveLibrary(&mpd, chain, opts));
+
+    ShuffleChain restored;
+    ASSERT_OK(RestoreLibrary(&mpd, &restored, opts));
+    EXPECT_THAT(restored.Items(), ContainerEq(chain.Items()));
+    // Only the library is cached, not the shuffle history.
+    EXPECT_EQ(restored.Stats().window, 0u);
+
+    // Adding a song changes the database stats, even within the same second.
+    mpd.db.push_back(fake::Song("song_c"));
+    ShuffleChain stale;
+    EXPECT_EQ(RestoreLibrary(&mpd, &stale, opts).code(),
+              absl::StatusCode::kFailedPrecondition);
+
+    opts.tweak.library_cache = false;
+    EXPECT_EQ(RestoreLibrary(&mpd, &stale, opts).code(),
+              absl::StatusCode::kNotFound);
+}
+
+TEST(LibraryCacheTest, PerServer) {
+    // Start without the caches left by earlier runs.
+    std::filesystem::remove_all(std::filesystem::path(testing::TempDir()) /
+                                "ashuffle");
+    fake::MPD mpd;
+    mpd.db.push_back(fake::Song("song_a"));
+
+    Options opts;
+    opts.tweak.library_cache = true;
+    opts.host = "server_a";
+    opts.port = 6600;
+    ShuffleChain chain;
+    chain.Add("song_a");
+    ASSERT_OK(SaveLibrary(&mpd, chain, opts));
+
+    // Another server with the same database stats has its own cache, and
+    // saving it does not replace the first server's cache.
+    opts.host = "server_b";
+    ShuffleChain other;
+    EXPECT_EQ(RestoreLibrary(&mpd, &other, opts).code(),
+              absl::StatusCode::kNotFound);
+    other.Add("song_b");
+    ASSERT_OK(SaveLibrary(&mpd, other, opts));
+
+    opts.host = "password@server_a";
+    ShuffleChain restored;
+    ASSERT_OK(RestoreLibrary(&mpd, &restored, opts));
+    EXPECT_THAT(restored.Items(), ContainerEq(chain.Items()));
+
+    // Servers on the same host are told apart by their port.
+    opts.port = 6601;
+    EXPECT_EQ(RestoreLibrary(&mpd, &restored, opts).code(),
+              absl::StatusCode::kNotFound);
+}
+
+TEST(LibraryCacheTest, StickersChangeKey) {
+    fake::MPD mpd;
+    mpd.db.push_back(fake::Song("song_a"));
+    mpd.stickers["weight"]["song_a"] = "2";
+
+    Options opts;
+    opts.tweak.library_cache = true;
+    opts.tweak.weight_sticker = "weight";
+    ShuffleChain chain;
+    chain.Add("song_a", 2);
+    ASSERT_OK(SaveLibrary(&mpd, chain, opts));
+    ShuffleChain restored;
+    ASSERT_OK(RestoreLibrary(&mpd, &restored, opts));
+
+    // Changing a sticker does not update the database, but the cached
+    // weights are stale.
+    mpd.stickers["weight"]["song_a"] = "5";
+    ShuffleChain stale;
+    EXPECT_EQ(RestoreLibrary(&mpd, &stale, opts).code(),
+              absl::StatusCode::kFailedPrecondition);
+}
+
+TEST(LibraryCacheTest, NeedsStats) {
+    fake::MPD mpd;
+    mpd.users = {
+        {"no-stats", {"add", "status", "play", "pause", "idle"}},
+        {"stats", {"add", "status", "play", "pause", "idle", "stats"}},
+    };
+
+    Options opts;
+    mpd.active_user = "stats";
+    EXPECT_FALSE(CheckLibraryCache(&mpd, &opts));
+
+    opts.tweak.library_cache = true;
+    EXPECT_TRUE(CheckLibraryCache(&mpd, &opts));
+    EXPECT_TRUE(opts.tweak.library_cache);
+
+    // Without `stats`, the cache is turned off, rather than failing to
+    // build its key on every save.
+    mpd.active_user = "no-stats";
+    EXPECT_FALSE(CheckLibraryCache(&mpd, &opts));
+    EXPECT_FALSE(opts.tweak.library_cache);
+}
+
+TEST(StateTest, SaveAndRestore) {
+    fake::MPD mpd;
+    for (int i = 0; i < 20; i++) {
+        mpd.db.push_back(fake::Song(absl::StrCat("song_", i)));
+    }
+
+    Options opts;
+    opts.tweak.state_file = std::filesystem::path(testing::TempDir()) /
+                            "ashuffle_test.state";
+    std::filesystem::remove(opts.tweak.state_file);
+
+    ShuffleChain chain(3, Xoshiro256(1));
+    EXPECT_EQ(RestoreState(&mpd, &chain, opts).code(),
+              absl::StatusCode::kNotFound);
+    for (auto &song : mpd.db) {
+        chain.Add(song.URI());
+    }
+
+    // The loop saves the state after it picks songs.
+    ASSERT_OK(Loop(&mpd, &chain, opts, init_only_d));
+    ASSERT_THAT(mpd.queue, testing::SizeIs(1));
+
+    ShuffleChain restored(3);
+    ASSERT_OK(RestoreState(&mpd, &restored, opts));
+    EXPECT_EQ(restored.Stats().picks, chain.Stats().picks);
+    for (int i = 0; i < 10; i++) {
+        EXPECT_EQ(restored.Pick(), chain.Pick());
+    }
+
+    // Once the database changes, the state is stale.
+    mpd.db_update += absl::Seconds(1);
+    ShuffleChain stale(3);
+    EXPECT_EQ(RestoreState(&mpd, &stale, opts).code(),
+              absl::StatusCode::kFailedPrecondition);
+    EXPECT_EQ(stale.Len(), 0u);
+}
+
+TEST(StateTest, OptionsChangeKey) {
+    fake::MPD mpd;
+    mpd.db.push_back(fake::Song("song_a"));
+
+    Options opts;
+    opts.tweak.state_file = std::filesystem::path(testing::TempDir()) /
+                            "ashuffle_options_test.state";
+    ShuffleChain chain;
+    chain.Add("song_a");
+    ASSERT_OK(SaveState(&mpd, chain, opts));
+
+    ShuffleChain restored;
+    opts.group_by = {MPD_TAG_ALBUM};
+    EXPECT_EQ(RestoreState(&mpd, &restored, opts).code(),
+              absl::StatusCode::kFailedPrecondition);
+    opts.group_by = {};
+    ASSERT_OK(RestoreState(&mpd, &restored, opts));
+    EXPECT_EQ(restored.Len(), 1u);
+}
+
+TEST(StateTest, SaveWithKey) {
+    fake::MPD mpd;
+    mpd.db.push_back(fake::Song("song_a"));
+
+    Options opts;
+    opts.tweak.state_file = std::filesystem::path(testing::TempDir()) /
+                            "ashuffle_key_test.state";
+    absl::StatusOr<uint64_t> key = StateKey(&mpd, opts);
+    ASSERT_OK(key.status());
+    ShuffleChain chain;
+    chain.Add("song_a");
+    ASSERT_OK(SaveState(chain, opts, *key));
+
+    ShuffleChain restored;
+    ASSERT_OK(RestoreState(&mpd, &restored, opts));
+    EXPECT_EQ(restored.Len(), 1u);
+
+    // A key fetched before the database changed saves stale state.
+    mpd.db_update += absl::Seconds(1);
+    ASSERT_OK(SaveState(chain, opts, *key));
+    ShuffleChain stale;
+    EXPECT_EQ(RestoreState(&mpd, &stale, opts).code(),
+              absl::StatusCode::kFailedPrecondition);
+}
+
 struct ConnectTestCase {
     // Want is used to set the actual server host/port.
     mpd::Address want;
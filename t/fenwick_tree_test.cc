@@ -0,0 +1,75 @@
+#include "fenwick_tree.h"
+
+#include <cstdint>
+#include <vector>
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+using namespace ashuffle;
+
+namespace {
+
+// Find the index for `offset` by scanning the weights directly.
+size_t LinearFind(const std::vector<uint64_t>& weights, uint64_t offset) {
+    for (size_t i = 0; i < weights.size(); i++) {
+        if (offset < weights[i]) {
+            return i;
+        }
+        offset -= weights[i];
+    }
+    return weights.size();
+}
+
+}  // namespace
+
+TEST(FenwickTreeTest, Empty) {
+    FenwickTree tree;
+    EXPECT_EQ(tree.Size(), 0u);
+    EXPECT_EQ(tree.Total(), 0u);
+}
+
+TEST(FenwickTreeTest, Find) {
+    FenwickTree tree;
+    std::vector<uint64_t> weights = {3, 0, 1, 5, 2, 0, 0, 4, 1, 7, 2};
+    tree.Assign(weights);
+    ASSERT_EQ(tree.Total(), 25u);
+
+    for (uint64_t offset = 0; offset < tree.Total(); offset++) {
+        EXPECT_EQ(tree.Find(offset), LinearFind(weights, offset))
+            << "offset " << offset;
+    }
+}
+
+TEST(FenwickTreeTest, Update) {
+    FenwickTree tree;
+    std::vector<uint64_t> weights(37, 2);
+    tree.Assign(weights);
+
+    for (size_t i = 0; i < weights.size(); i += 3) {
+        tree.Sub(i, 2);
+        weights[i] -= 2;
+    }
+    for (size_t i = 1; i < weights.size(); i += 5) {
+        tree.Add(i, 10);
+        weights[i] += 10;
+    }
+
+    uint64_t total = 0;
+    for (uint64_t w : weights) {
+        total += w;
+    }
+    ASSERT_EQ(tree.Total(), total);
+    for (uint64_t offset = 0; offset < tree.Total(); offset++) {
+        EXPECT_EQ(tree.Find(offset), LinearFind(weights, offset))
+            << "offset " << offset;
+    }
+}
+
+TEST(FenwickTreeTest, Clear) {
+    FenwickTree tree;
+    tree.Assign({1, 2, 3});
+    tree.Clear();
+    EXPECT_EQ(tree.Size(), 0u);
+    EXPECT_EQ(tree.Total(), 0u);
+}
@@ -0,0 +1,69 @@
+#include "file_watcher.h"
+
+#include <filesystem>
+#include <fstream>
+#include <string_view>
+
+#include <absl/status/status.h>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+using namespace ashuffle;
+
+namespace {
+
+std::filesystem::path TestPath(std::string_view name) {
+    std::filesystem::path path =
+        std::filesystem::path(testing::TempDir()) / name;
+    std::filesystem::remove(path);
+    return path;
+}
+
+}  // namespace
+
+TEST(FileWatcherTest, Rewrite) {
+    std::filesystem::path path = TestPath("watched_rewrite");
+    std::ofstream(path) << "song_a\n";
+
+    absl::StatusOr<FileWatcher> watcher = FileWatcher::Create(path);
+    ASSERT_TRUE(watcher.ok()) << watcher.status();
+    EXPECT_FALSE(watcher->Changed());
+
+    std::ofstream(path) << "song_b\n";
+    EXPECT_TRUE(watcher->Changed());
+    // Every change is only reported once.
+    EXPECT_FALSE(watcher->Changed());
+}
+
+TEST(FileWatcherTest, Replace) {
+    std::filesystem::path path = TestPath("watched_replace");
+    std::filesystem::path tmp = TestPath("watched_replace.tmp");
+    std::ofstream(path) << "song_a\n";
+
+    absl::StatusOr<FileWatcher> watcher = FileWatcher::Create(path);
+    ASSERT_TRUE(watcher.ok()) << watcher.status();
+
+    // Replacing the file is noticed, and so are later changes to the new
+    // file.
+    std::ofstream(tmp) << "song_b\n";
+    std::filesystem::rename(tmp, path);
+    EXPECT_TRUE(watcher->Changed());
+    std::ofstream(path) << "song_c\n";
+    EXPECT_TRUE(watcher->Changed());
+}
+
+TEST(FileWatcherTest, OtherFilesIgnored) {
+    std::filesystem::path path = TestPath("watched_other");
+    std::filesystem::path other = TestPath("watched_other.unrelated");
+    std::ofstream(path) << "song_a\n";
+
+    absl::StatusOr<FileWatcher> watcher = FileWatcher::Create(path);
+    ASSERT_TRUE(watcher.ok()) << watcher.status();
+
+    std::ofstream(other) << "song_b\n";
+    EXPECT_FALSE(watcher->Changed());
+}
+
+TEST(FileWatcherTest, MissingDirectory) {
+    EXPECT_FALSE(FileWatcher::Create(TestPath("missing") / "list").ok());
+}
@@ -0,0 +1,172 @@
+#include "index_picker.h"
+
+#include <set>
+#include <string>
+#include <vector>
+
+#include <absl/status/status.h>
+#include <absl/strings/str_format.h>
+#include <mpd/tag.h>
+
+#include "mpd.h"
+#include "rule.h"
+
+#include "t/mpd_fake.h"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+using namespace ashuffle;
+
+using ::testing::Contains;
+using ::testing::ElementsAre;
+using ::testing::Not;
+using ::testing::SizeIs;
+
+namespace {
+
+// Pick `n` songs with `picker`, failing the test if any pick fails.
+std::vector<std::string> PickN(IndexPicker& picker, fake::MPD& mpd, int n) {
+    std::vector<std::string> picked;
+    for (int i = 0; i < n; i++) {
+        absl::StatusOr<ItemView> item = picker.Pick(&mpd);
+        EXPECT_TRUE(item.ok()) << item.status();
+        if (!item.ok()) {
+            break;
+        }
+        EXPECT_THAT(*item, SizeIs(1));
+        picked.push_back((*item)[0]);
+    }
+    return picked;
+}
+
+}  // namespace
+
+TEST(IndexPickerTest, Basic) {
+    fake::MPD mpd;
+    for (int i = 0; i < 10; i++) {
+        mpd.db.emplace_back(absl::StrFormat("song_%d", i));
+    }
+    std::vector<Rule> ruleset;
+
+    IndexPicker picker(ruleset, 3, 1);
+    std::vector<std::string> picked = PickN(picker, mpd, 100);
+    ASSERT_THAT(picked, SizeIs(100));
+
+    // No song is picked again within 3 picks of itself.
+    for (size_t i = 0; i + 3 < picked.size(); i++) {
+        std::set<std::string> window(picked.begin() + i,
+                                     picked.begin() + i + 4);
+        EXPECT_THAT(window, SizeIs(4)) << "at pick " << i;
+    }
+    // Every pick fetches a single song. Songs are counted from the database
+    // stats, so there are no other requests.
+    EXPECT_THAT(mpd.windows, SizeIs(100));
+    for (auto [start, end] : mpd.windows) {
+        EXPECT_EQ(end, start + 1);
+    }
+}
+
+TEST(IndexPickerTest, WithRules) {
+    fake::MPD mpd;
+    for (int i = 0; i < 10; i++) {
+        mpd.db.push_back(fake::Song(
+            absl::StrFormat("song_%d", i),
+            {{MPD_TAG_ARTIST, i % 2 == 0 ? "artist_a" : "artist_b"}}));
+    }
+    Rule rule;
+    rule.AddPattern(MPD_TAG_ARTIST, "artist_b");
+    std::vector<Rule> ruleset = {rule};
+
+    IndexPicker picker(ruleset, 1, 1);
+    std::vector<std::string> picked = PickN(picker, mpd, 50);
+    ASSERT_THAT(picked, SizeIs(50));
+
+    // Songs rejected by the rules are skipped by the picker.
+    for (int i = 1; i < 10; i += 2) {
+        EXPECT_THAT(picked, Not(Contains(absl::StrFormat("song_%d", i))));
+    }
+}
+
+TEST(IndexPickerTest, FewSongsAccepted) {
+    fake::MPD mpd;
+    for (int i = 0; i < 1000; i++) {
+        bool keep = i == 10 || i == 500;
+        mpd.db.push_back(
+            fake::Song(absl::StrFormat("song_%d", i),
+                       {{MPD_TAG_ARTIST, keep ? "artist_a" : "artist_b"}}));
+    }
+    Rule rule;
+    rule.AddPattern(MPD_TAG_ARTIST, "artist_b");
+    std::vector<Rule> ruleset = {rule};
+
+    // Random positions almost never land on the two accepted songs, so the
+    // picker falls back to listing every song, rather than failing.
+    IndexPicker picker(ruleset, 1, 1);
+    std::vector<std::string> picked = PickN(picker, mpd, 6);
+    ASSERT_THAT(picked, SizeIs(6));
+    for (size_t i = 0; i < picked.size(); i++) {
+        EXPECT_THAT(picked[i], testing::AnyOf("song_10", "song_500"));
+        // The last pick is still avoided.
+        if (i > 0) {
+            EXPECT_NE(picked[i], picked[i - 1]);
+        }
+    }
+}
+
+TEST(IndexPickerTest, NoSongsAccepted) {
+    fake::MPD mpd;
+    for (int i = 0; i < 10; i++) {
+        mpd.db.push_back(fake::Song(absl::StrFormat("song_%d", i),
+                                    {{MPD_TAG_ARTIST, "artist_b"}}));
+    }
+    Rule rule;
+    rule.AddPattern(MPD_TAG_ARTIST, "artist_b");
+    std::vector<Rule> ruleset = {rule};
+
+    IndexPicker picker(ruleset, 1, 1);
+    absl::StatusOr<ItemView> picked = picker.Pick(&mpd);
+    EXPECT_TRUE(absl::IsFailedPrecondition(picked.status()))
+        << picked.status();
+}
+
+TEST(IndexPickerTest, SmallLibrary) {
+    fake::MPD mpd;
+    mpd.db.emplace_back("song_a");
+    std::vector<Rule> ruleset;
+
+    // With a single song, it has to be repeated.
+    IndexPicker picker(ruleset, 3, 1);
+    EXPECT_THAT(PickN(picker, mpd, 3),
+                ElementsAre("song_a", "song_a", "song_a"));
+}
+
+TEST(IndexPickerTest, Empty) {
+    fake::MPD mpd;
+    std::vector<Rule> ruleset;
+
+    IndexPicker picker(ruleset, 3, 1);
+    absl::StatusOr<ItemView> picked = picker.Pick(&mpd);
+    EXPECT_TRUE(absl::IsFailedPrecondition(picked.status()))
+        << picked.status();
+}
+
+TEST(IndexPickerTest, SongsRemoved) {
+    fake::MPD mpd;
+    for (int i = 0; i < 10; i++) {
+        mpd.db.emplace_back(absl::StrFormat("song_%d", i));
+    }
+    std::vector<Rule> ruleset;
+
+    IndexPicker picker(ruleset, 1, 1);
+    ASSERT_THAT(PickN(picker, mpd, 1), SizeIs(1));
+
+    // Songs past the end of the database are noticed, and the songs are
+    // counted again.
+    mpd.db.erase(mpd.db.begin() + 2, mpd.db.end());
+    std::vector<std::string> picked = PickN(picker, mpd, 20);
+    ASSERT_THAT(picked, SizeIs(20));
+    for (const std::string& uri : picked) {
+        EXPECT_THAT(uri, testing::AnyOf("song_0", "song_1"));
+    }
+}
@@ -119,7 +119,7 @@ func newLibrary() (*library.Library, error) {
 	return library.New(library.EmbeddedGoldMP3())
 }
 
-func newLibraryT(t *testing.T) *library.Library {
+func newLibraryT(t testing.TB) *library.Library {
 	t.Helper()
 
 	l, err := newLibrary()
@@ -672,6 +672,59 @@ func TestFastStartup(t *testing.T) {
 	}
 }
 
+// BenchmarkLoadMassive measures loading a 500k song library with exclusion
+// rules and grouping, which exercises both receiving songs from MPD and
+// checking and grouping them.
+func BenchmarkLoadMassive(b *testing.B) {
+	ctx := context.Background()
+
+	lib := newLibraryT(b)
+	lib.Tracks = 500_000
+	lib.Tagger = library.RepeatedLetters{
+		TracksPerAlbum:  10,
+		AlbumsPerArtist: 3,
+		// Realistic path lengths, as in TestMaxMemoryUsage.
+		MinComponentLength: (71 / 3) * 2,
+	}.Tag
+	libDir := mountLibrary(b, lib)
+
+	mpd, err := testmpd.New(ctx, &testmpd.Options{
+		LibraryRoot:         libDir,
+		MaxOutputBufferSize: 500 * unit.Mebibyte,
+		UpdateDBTimeout:     10 * time.Minute,
+	})
+	if err != nil {
+		b.Fatalf("failed to create new MPD instance: %v", err)
+	}
+	defer mpd.Shutdown()
+
+	args := []string{
+		"-o", "1", "-e", "artist", "AA", "-g", "album",
+		// Always load the library from MPD.
+		"--tweak", "library-cache=no",
+	}
+
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		as, err := testashuffle.New(ctx, ashuffleBin, &testashuffle.Options{
+			MPDAddress:      mpd,
+			Args:            args,
+			ShutdownTimeout: 2 * time.Minute,
+		})
+		if err != nil {
+			b.Fatalf("failed to create new ashuffle instance: %v", err)
+		}
+		if err := as.Shutdown(testashuffle.ShutdownSoft); err != nil {
+			b.Fatalf("ashuffle did not shut down cleanly: %v", err)
+		}
+	}
+	b.StopTimer()
+
+	if !mpd.IsOk() {
+		b.Fatalf("mpd communication error: %v", mpd.Errors)
+	}
+}
+
 func peakUsage(m *massif.Massif) unit.Datasize {
 	var max unit.Datasize
 	for _, snapshot := range m.Snapshots {
@@ -898,7 +951,7 @@ func titlePather(_ int, tag *id3v2.Tag) string {
 
 // mountLibrary mounts the given library and returns the path to the root
 // of the mounted library.
-func mountLibrary(t *testing.T, l *library.Library) (path string) {
+func mountLibrary(t testing.TB, l *library.Library) (path string) {
 	t.Helper()
 
 	suffix := "ashuffle." + t.Name()
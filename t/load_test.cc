@@ -1,9 +1,21 @@
+#include <poll.h>
+
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <future>
 #include <istream>
 #include <memory>
 #include <sstream>
 
+#include <absl/status/status.h>
+#include <absl/status/statusor.h>
+#include <absl/strings/str_format.h>
+
 #include "args.h"
 #include "load.h"
+#include "mapped_file.h"
 #include "mpd.h"
 #include "rule.h"
 #include "shuffle.h"
@@ -16,6 +28,8 @@
 using namespace ashuffle;
 
 using ::testing::ContainerEq;
+using ::testing::ElementsAre;
+using ::testing::ElementsAreArray;
 using ::testing::WhenSorted;
 
 TEST(MPDLoaderTest, Basic) {
@@ -70,7 +84,502 @@ TEST(MPDLoaderTest, WithGroup) {
     loader.Load(&chain);
 
     std::vector<std::string> want = {"song_a", "song_b"};
-    EXPECT_THAT(chain.Pick(), WhenSorted(ContainerEq(want)));
+    EXPECT_THAT(chain.Pick(), WhenSorted(ElementsAreArray(want)));
+}
+
+TEST(MPDLoaderTest, WithWeights) {
+    fake::MPD mpd;
+    mpd.db.emplace_back("rated_high");
+    mpd.db.emplace_back("rated_zero");
+    mpd.db.emplace_back("rated_junk");
+    mpd.db.emplace_back("unrated");
+    mpd.stickers["rating"] = {
+        {"rated_high", "100"},
+        {"rated_zero", "0"},
+        {"rated_junk", "five"},
+    };
+
+    ShuffleChain chain(1, Xoshiro256(1));
+    std::vector<Rule> ruleset;
+
+    MPDLoader loader(static_cast<mpd::MPD *>(&mpd), ruleset, {},
+                     Weighting{"rating", 2});
+    loader.Load(&chain);
+
+    std::vector<std::vector<std::string>> want = {
+        {"rated_high"}, {"rated_junk"}, {"rated_zero"}, {"unrated"}};
+    EXPECT_THAT(chain.Items(), WhenSorted(ContainerEq(want)));
+
+    // rated_high has weight 100 out of a total of 105, so with a window of
+    // one it should be picked every other time.
+    int high = 0;
+    for (int i = 0; i < 100; i++) {
+        if (chain.Pick()[0] == "rated_high") {
+            high++;
+        }
+    }
+    EXPECT_GE(high, 45);
+}
+
+TEST(MPDLoaderTest, WithWeightsAndGroup) {
+    fake::MPD mpd;
+    mpd.db.push_back(fake::Song("song_a", {{MPD_TAG_ALBUM, "album_a"}}));
+    mpd.db.push_back(fake::Song("song_b", {{MPD_TAG_ALBUM, "album_a"}}));
+    mpd.db.push_back(fake::Song("song_c", {{MPD_TAG_ALBUM, "album_b"}}));
+    mpd.stickers["rating"] = {{"song_a", "200"}, {"song_b", "200"}};
+
+    std::vector<enum mpd_tag_type> group_by = {MPD_TAG_ALBUM};
+
+    ShuffleChain chain(1, Xoshiro256(1));
+    std::vector<Rule> ruleset;
+
+    MPDLoader loader(static_cast<mpd::MPD *>(&mpd), ruleset, group_by,
+                     Weighting{"rating", 1});
+    loader.Load(&chain);
+
+    std::vector<std::vector<std::string>> want = {{"song_a", "song_b"},
+                                                  {"song_c"}};
+    EXPECT_THAT(chain.Items(), WhenSorted(ContainerEq(want)));
+
+    // album_a has weight 200, album_b has weight 1. The first pick should
+    // almost certainly be album_a.
+    EXPECT_THAT(chain.Pick(), WhenSorted(ElementsAreArray(want[0])));
+}
+
+TEST(MPDLoaderTest, WithGroupOrder) {
+    fake::MPD mpd;
+    mpd.db.push_back(fake::Song(
+        "song_a", {{MPD_TAG_ARTIST, "artist_b"}, {MPD_TAG_ALBUM, "album"}}));
+    mpd.db.push_back(fake::Song("song_b", {{MPD_TAG_ALBUM, "album"}}));
+    mpd.db.push_back(fake::Song(
+        "song_c", {{MPD_TAG_ARTIST, "artist_a"}, {MPD_TAG_ALBUM, "album"}}));
+    mpd.db.push_back(fake::Song(
+        "song_d", {{MPD_TAG_ARTIST, "artist_b"}, {MPD_TAG_ALBUM, "album"}}));
+    mpd.db.push_back(fake::Song("song_e", {{MPD_TAG_ARTIST, "artist_b"}}));
+    mpd.db.push_back(fake::Song("song_f", {{MPD_TAG_ALBUM, "album"}}));
+
+    std::vector<enum mpd_tag_type> group_by = {MPD_TAG_ARTIST, MPD_TAG_ALBUM};
+    std::vector<Rule> ruleset;
+
+    // Groups are added in the order their first song was listed, however
+    // many threads group them.
+    std::vector<std::vector<std::string>> want = {
+        {"song_a", "song_d"}, {"song_b", "song_f"}, {"song_c"}, {"song_e"}};
+    for (unsigned threads : {1u, 3u}) {
+        Listing listing;
+        listing.threads = threads;
+        ShuffleChain chain;
+        MPDLoader loader(static_cast<mpd::MPD *>(&mpd), ruleset, group_by,
+                         Weighting(), std::nullopt, listing);
+        loader.Load(&chain);
+
+        EXPECT_THAT(chain.Items(), ContainerEq(want)) << threads << " threads";
+    }
+}
+
+TEST(MPDLoaderTest, WithSpread) {
+    fake::MPD mpd;
+    mpd.db.push_back(fake::Song("a_1", {{MPD_TAG_ARTIST, "artist_a"}}));
+    mpd.db.push_back(fake::Song("a_2", {{MPD_TAG_ARTIST, "artist_a"}}));
+    mpd.db.push_back(fake::Song("b_1", {{MPD_TAG_ARTIST, "artist_b"}}));
+    mpd.db.push_back(fake::Song("b_2", {{MPD_TAG_ARTIST, "artist_b"}}));
+
+    ShuffleChain chain(1, Xoshiro256(1));
+    chain.SetSpread(1);
+    std::vector<Rule> ruleset;
+
+    MPDLoader loader(static_cast<mpd::MPD *>(&mpd), ruleset, {}, Weighting(),
+                     MPD_TAG_ARTIST);
+    loader.Load(&chain);
+
+    // With two artists and a spread of one, picks should alternate between
+    // the artists.
+    char last = 0;
+    for (int i = 0; i < 50; i++) {
+        auto got = chain.Pick();
+        EXPECT_NE(got[0][0], last) << "artist repeated on pick " << i;
+        last = got[0][0];
+    }
+}
+
+TEST(MPDLoaderTest, RestrictsTagTypes) {
+    fake::MPD mpd;
+    mpd.db.push_back(fake::Song("song_a", {{MPD_TAG_ARTIST, "__artist__"},
+                                           {MPD_TAG_ALBUM, "__album__"},
+                                           {MPD_TAG_TITLE, "__title__"}}));
+    mpd.db.push_back(
+        fake::Song("song_b", {{MPD_TAG_ARTIST, "__not_artist__"},
+                              {MPD_TAG_ALBUM, "__album__"}}));
+    mpd.db.push_back(fake::Song("song_c", {{MPD_TAG_ARTIST, "__artist__"},
+                                           {MPD_TAG_ALBUM, "__album__"}}));
+
+    std::vector<Rule> ruleset;
+    Rule rule;
+    rule.AddPattern(MPD_TAG_ARTIST, "__not_artist__");
+    ruleset.push_back(rule);
+    std::vector<enum mpd_tag_type> group_by = {MPD_TAG_ALBUM};
+
+    ShuffleChain chain;
+    MPDLoader loader(static_cast<mpd::MPD *>(&mpd), ruleset, group_by);
+    loader.Load(&chain);
+
+    // Only the tags used by the rules and grouping are requested, and the
+    // connection is reset afterwards.
+    ASSERT_EQ(mpd.restricted_tag_types.size(), 1);
+    EXPECT_THAT(mpd.restricted_tag_types[0],
+                WhenSorted(ElementsAre(MPD_TAG_ARTIST, MPD_TAG_ALBUM)));
+    EXPECT_FALSE(mpd.tag_types.has_value());
+
+    std::vector<std::string> want = {"song_a", "song_c"};
+    EXPECT_THAT(chain.Pick(), WhenSorted(ElementsAreArray(want)));
+}
+
+TEST(MPDLoaderTest, NoTagTypesWithoutMetadata) {
+    fake::MPD mpd;
+    mpd.db.emplace_back("song_a");
+
+    ShuffleChain chain;
+    std::vector<Rule> ruleset;
+
+    MPDLoader loader(static_cast<mpd::MPD *>(&mpd), ruleset);
+    loader.Load(&chain);
+
+    // No metadata is requested at all, so there is nothing to restrict.
+    EXPECT_THAT(mpd.restricted_tag_types, ElementsAre());
+}
+
+TEST(MPDLoaderTest, WithChunks) {
+    fake::MPD mpd;
+    mpd.db.push_back(fake::Song("song_a", {{MPD_TAG_ALBUM, "album_a"}}));
+    mpd.db.push_back(fake::Song("song_b", {{MPD_TAG_ALBUM, "album_b"}}));
+    mpd.db.push_back(fake::Song("song_c", {{MPD_TAG_ALBUM, "album_a"}}));
+    mpd.db.push_back(fake::Song("song_d", {{MPD_TAG_ALBUM, "album_b"}}));
+    mpd.db.push_back(fake::Song("song_e", {{MPD_TAG_ALBUM, "album_a"}}));
+
+    std::vector<Rule> ruleset;
+    std::vector<enum mpd_tag_type> group_by = {MPD_TAG_ALBUM};
+    Listing listing;
+    listing.chunk_size = 2;
+
+    ShuffleChain chain;
+    MPDLoader loader(static_cast<mpd::MPD *>(&mpd), ruleset, group_by,
+                     Weighting(), std::nullopt, listing);
+    loader.Load(&chain);
+
+    using Window = std::pair<unsigned, unsigned>;
+    EXPECT_THAT(mpd.windows,
+                ElementsAre(Window{0, 2}, Window{2, 4}, Window{4, 6}));
+    // Groups span chunks.
+    std::vector<std::vector<std::string>> want = {
+        {"song_a", "song_c", "song_e"},
+        {"song_b", "song_d"},
+    };
+    EXPECT_THAT(chain.Items(), WhenSorted(ContainerEq(want)));
+
+    // When the library is a multiple of the chunk size, the last chunk is
+    // empty.
+    mpd.db.pop_back();
+    mpd.windows.clear();
+    ShuffleChain reloaded;
+    loader.Load(&reloaded);
+    EXPECT_THAT(mpd.windows,
+                ElementsAre(Window{0, 2}, Window{2, 4}, Window{4, 6}));
+    EXPECT_EQ(reloaded.Len(), 2u);
+}
+
+TEST(MPDLoaderTest, WithChunksUnsupported) {
+    fake::MPD mpd;
+    mpd.filter_support = false;
+    mpd.db.emplace_back("song_a");
+    mpd.db.emplace_back("song_b");
+    mpd.db.emplace_back("song_c");
+
+    std::vector<Rule> ruleset;
+    Listing listing;
+    listing.chunk_size = 2;
+
+    ShuffleChain chain;
+    MPDLoader loader(static_cast<mpd::MPD *>(&mpd), ruleset, {}, Weighting(),
+                     std::nullopt, listing);
+    loader.Load(&chain);
+
+    // Old MPDs list the whole library at once.
+    EXPECT_THAT(mpd.windows, ElementsAre());
+    EXPECT_EQ(chain.Len(), 3u);
+}
+
+TEST(MPDLoaderTest, WithThreads) {
+    fake::MPD mpd;
+    for (int i = 0; i < 2000; i++) {
+        mpd.db.push_back(fake::Song(
+            absl::StrFormat("song_%d", i),
+            {{MPD_TAG_ARTIST, absl::StrFormat("artist_%d", i % 37)},
+             {MPD_TAG_ALBUM, absl::StrFormat("album_%d", i % 101)}}));
+    }
+    std::vector<Rule> ruleset;
+    for (int i = 0; i < 10; i++) {
+        Rule rule;
+        rule.AddPattern(MPD_TAG_ARTIST, absl::StrFormat("artist_%d", i));
+        ruleset.push_back(rule);
+    }
+
+    for (auto group_by : std::vector<std::vector<enum mpd_tag_type>>{
+             {}, {MPD_TAG_ALBUM}}) {
+        Listing serial;
+        serial.threads = 1;
+        ShuffleChain want;
+        MPDLoader(static_cast<mpd::MPD *>(&mpd), ruleset, group_by,
+                  Weighting(), std::nullopt, serial)
+            .Load(&want);
+
+        Listing parallel;
+        parallel.threads = 4;
+        ShuffleChain got;
+        MPDLoader(static_cast<mpd::MPD *>(&mpd), ruleset, group_by,
+                  Weighting(), std::nullopt, parallel)
+            .Load(&got);
+
+        // Threads must not change which songs are loaded, or their order.
+        EXPECT_THAT(got.Items(), ContainerEq(want.Items()));
+        EXPECT_LT(got.Len(), 2000u);
+    }
+}
+
+TEST(MPDLoaderTest, WithProgress) {
+    fake::MPD mpd;
+    for (int i = 0; i < 1000; i++) {
+        mpd.db.emplace_back(absl::StrFormat("song_%d", i));
+    }
+    std::vector<Rule> ruleset;
+
+    std::vector<size_t> progress;
+    ShuffleChain chain;
+    MPDLoader loader(static_cast<mpd::MPD *>(&mpd), ruleset);
+    loader.OnProgress([&progress](const ShuffleChain &loaded) {
+        progress.push_back(loaded.Len());
+    });
+    loader.Load(&chain);
+
+    // Progress is reported as songs are received, not just at the end.
+    ASSERT_GT(progress.size(), 1u);
+    EXPECT_LT(progress.front(), 1000u);
+    EXPECT_EQ(progress.back(), 1000u);
+}
+
+TEST(SampleMPDLoaderTest, Basic) {
+    fake::MPD mpd;
+    for (int i = 0; i < 100; i++) {
+        mpd.db.push_back(fake::Song(absl::StrFormat("song_%d", i),
+                                    {{MPD_TAG_ARTIST, "artist_a"}}));
+    }
+    mpd.db.push_back(fake::Song("excluded", {{MPD_TAG_ARTIST, "artist_b"}}));
+    Rule rule;
+    rule.AddPattern(MPD_TAG_ARTIST, "artist_b");
+    std::vector<Rule> ruleset = {rule};
+
+    auto sample = [&](uint64_t seed) {
+        ShuffleChain chain;
+        SampleMPDLoader(static_cast<mpd::MPD *>(&mpd), ruleset, {},
+                        Weighting(), std::nullopt, Listing(), 10, seed)
+            .Load(&chain);
+        return chain.Items();
+    };
+
+    std::vector<std::vector<std::string>> got = sample(1);
+    ASSERT_EQ(got.size(), 10u);
+    std::sort(got.begin(), got.end());
+    EXPECT_EQ(std::unique(got.begin(), got.end()), got.end());
+    for (const std::vector<std::string> &item : got) {
+        ASSERT_EQ(item.size(), 1u);
+        EXPECT_NE(item[0], "excluded");
+    }
+
+    // Samples are reproducible with the same seed.
+    EXPECT_THAT(sample(1), ContainerEq(sample(1)));
+    EXPECT_THAT(sample(1), testing::Ne(sample(2)));
+}
+
+TEST(SampleMPDLoaderTest, SmallLibrary) {
+    fake::MPD mpd;
+    mpd.db.emplace_back("song_a");
+    mpd.db.emplace_back("song_b");
+    std::vector<Rule> ruleset;
+
+    ShuffleChain chain;
+    SampleMPDLoader(static_cast<mpd::MPD *>(&mpd), ruleset, {}, Weighting(),
+                    std::nullopt, Listing(), 10, 1)
+        .Load(&chain);
+
+    std::vector<std::vector<std::string>> want = {{"song_a"}, {"song_b"}};
+    EXPECT_THAT(chain.Items(), WhenSorted(ContainerEq(want)));
+}
+
+TEST(SampleMPDLoaderTest, WithGroup) {
+    fake::MPD mpd;
+    for (int i = 0; i < 70; i++) {
+        mpd.db.push_back(
+            fake::Song(absl::StrFormat("album_%d/song_%d", i % 7, i),
+                       {{MPD_TAG_ALBUM, absl::StrFormat("album_%d", i % 7)}}));
+    }
+    std::vector<enum mpd_tag_type> group_by = {MPD_TAG_ALBUM};
+    std::vector<Rule> ruleset;
+
+    ShuffleChain chain;
+    SampleMPDLoader(static_cast<mpd::MPD *>(&mpd), ruleset, group_by,
+                    Weighting(), std::nullopt, Listing(), 3, 1)
+        .Load(&chain);
+
+    // Sampled groups are complete, even though their songs are listed far
+    // apart.
+    std::vector<std::vector<std::string>> got = chain.Items();
+    ASSERT_EQ(got.size(), 3u);
+    for (const std::vector<std::string> &group : got) {
+        ASSERT_EQ(group.size(), 10u);
+        std::string album = group[0].substr(0, group[0].find('/'));
+        for (const std::string &uri : group) {
+            EXPECT_EQ(uri.substr(0, uri.find('/')), album);
+        }
+    }
+}
+
+TEST(SampleMPDLoaderTest, WithWeights) {
+    fake::MPD mpd;
+    for (int i = 0; i < 100; i++) {
+        mpd.db.emplace_back(absl::StrFormat("song_%d", i));
+    }
+    mpd.stickers["rating"] = {{"song_42", "10000"}};
+    std::vector<Rule> ruleset;
+
+    // song_42 has weight 10000 out of a total of 10099, so it should almost
+    // always be the one song sampled.
+    int heavy = 0;
+    for (uint64_t seed = 0; seed < 50; seed++) {
+        ShuffleChain chain;
+        SampleMPDLoader(static_cast<mpd::MPD *>(&mpd), ruleset, {},
+                        Weighting{"rating", 1}, std::nullopt, Listing(), 1,
+                        seed)
+            .Load(&chain);
+        ASSERT_EQ(chain.Len(), 1u);
+        if (chain.Items()[0][0] == "song_42") {
+            heavy++;
+        }
+    }
+    EXPECT_GE(heavy, 45);
+}
+
+TEST(IncrementalMPDLoaderTest, Basic) {
+    fake::MPD mpd;
+    mpd.db.push_back(fake::Song("artist_a/album_a/song_1",
+                                {{MPD_TAG_ARTIST, "artist_a"}}));
+    mpd.db.push_back(fake::Song("artist_a/album_b/song_2",
+                                {{MPD_TAG_ARTIST, "artist_a"}}));
+    mpd.db.push_back(fake::Song("artist_b/song_3",
+                                {{MPD_TAG_ARTIST, "artist_b"}}));
+    mpd.db.push_back(fake::Song("song_4", {{MPD_TAG_ARTIST, "__excluded__"}}));
+
+    std::vector<Rule> ruleset;
+    Rule rule;
+    rule.AddPattern(MPD_TAG_ARTIST, "__excluded__");
+    ruleset.push_back(rule);
+
+    IncrementalMPDLoader loader(static_cast<mpd::MPD *>(&mpd), ruleset, {},
+                                Weighting(), std::nullopt);
+
+    ShuffleChain chain;
+    loader.Load(&chain);
+    std::vector<std::vector<std::string>> want = {
+        {"artist_a/album_a/song_1"},
+        {"artist_a/album_b/song_2"},
+        {"artist_b/song_3"},
+    };
+    EXPECT_THAT(chain.Items(), ContainerEq(want));
+    EXPECT_THAT(mpd.listed_dirs,
+                WhenSorted(ElementsAre("", "artist_a", "artist_a/album_a",
+                                       "artist_a/album_b", "artist_b")));
+    EXPECT_THAT(mpd.restricted_tag_types,
+                ElementsAre(ElementsAre(MPD_TAG_ARTIST)));
+    EXPECT_FALSE(mpd.tag_types.has_value());
+
+    // Add a song to album_b, and remove artist_b entirely.
+    mpd.db.push_back(fake::Song("artist_a/album_b/song_5",
+                                {{MPD_TAG_ARTIST, "artist_a"}}));
+    mpd.db.erase(mpd.db.begin() + 2);
+    mpd.dir_mtimes["artist_a/album_b"] = absl::UnixEpoch() + absl::Seconds(1);
+    mpd.listed_dirs.clear();
+
+    ShuffleChain reloaded;
+    loader.Load(&reloaded);
+    want = {
+        {"artist_a/album_a/song_1"},
+        {"artist_a/album_b/song_2"},
+        {"artist_a/album_b/song_5"},
+    };
+    EXPECT_THAT(reloaded.Items(), ContainerEq(want));
+    // Directories with sub-directories are always listed, but the unchanged
+    // album is not.
+    EXPECT_THAT(mpd.listed_dirs,
+                WhenSorted(ElementsAre("", "artist_a", "artist_a/album_b")));
+}
+
+TEST(IncrementalMPDLoaderTest, WithGroup) {
+    fake::MPD mpd;
+    mpd.db.push_back(
+        fake::Song("album_a/song_1", {{MPD_TAG_ALBUM, "album_a"}}));
+    mpd.db.push_back(
+        fake::Song("album_a/song_2", {{MPD_TAG_ALBUM, "album_a"}}));
+    mpd.db.push_back(
+        fake::Song("album_b/song_3", {{MPD_TAG_ALBUM, "album_b"}}));
+
+    std::vector<Rule> ruleset;
+    IncrementalMPDLoader loader(static_cast<mpd::MPD *>(&mpd), ruleset,
+                                {MPD_TAG_ALBUM}, Weighting(), std::nullopt);
+
+    // Groups are built from cached tags on every load.
+    for (int i = 0; i < 2; i++) {
+        ShuffleChain chain;
+        loader.Load(&chain);
+        std::vector<std::vector<std::string>> want = {
+            {"album_a/song_1", "album_a/song_2"},
+            {"album_b/song_3"},
+        };
+        EXPECT_THAT(chain.Items(), WhenSorted(ContainerEq(want)));
+    }
+}
+
+// CountingLoader counts the songs it checks with Verify.
+class CountingLoader : public IncrementalMPDLoader {
+   public:
+    using IncrementalMPDLoader::IncrementalMPDLoader;
+
+    std::atomic<int> verified = 0;
+
+   protected:
+    bool Verify(const mpd::Song &song) override {
+        verified++;
+        return IncrementalMPDLoader::Verify(song);
+    }
+};
+
+TEST(IncrementalMPDLoaderTest, VerifiesOnce) {
+    fake::MPD mpd;
+    mpd.db.push_back(fake::Song("album_a/song_1"));
+    mpd.db.push_back(fake::Song("album_a/song_2"));
+    mpd.db.push_back(fake::Song("album_b/song_3"));
+
+    std::vector<Rule> ruleset;
+    CountingLoader loader(static_cast<mpd::MPD *>(&mpd), ruleset, {},
+                          Weighting(), std::nullopt);
+    ShuffleChain chain;
+    loader.Load(&chain);
+    EXPECT_EQ(chain.Len(), 3u);
+    EXPECT_EQ(loader.verified, 3);
+
+    // Only songs in changed directories are checked again.
+    mpd.dir_mtimes["album_b"] = absl::UnixEpoch() + absl::Seconds(1);
+    ShuffleChain reloaded;
+    loader.Load(&reloaded);
+    EXPECT_EQ(reloaded.Len(), 3u);
+    EXPECT_EQ(loader.verified, 4);
 }
 
 std::unique_ptr<std::istream> TestStream(std::vector<std::string> lines) {
@@ -96,6 +605,34 @@ TEST(FileLoaderTest, Basic) {
     EXPECT_THAT(chain.Items(), WhenSorted(ContainerEq(want)));
 }
 
+TEST(FileLoaderTest, Mapped) {
+    std::filesystem::path path =
+        std::filesystem::path(testing::TempDir()) / "file_loader_mapped";
+    // A blank line is loaded like any other, just as it is when reading
+    // from a stream.
+    std::ofstream(path) << "song_a\n\nsong_b\nsong_c";
+
+    absl::StatusOr<MappedFile> file = MappedFile::Open(path);
+    ASSERT_TRUE(file.ok()) << file.status();
+    FileLoader loader(std::move(*file));
+    ShuffleChain chain;
+    loader.Load(&chain);
+    std::filesystem::remove(path);
+
+    std::vector<std::vector<std::string>> want = {
+        {""}, {"song_a"}, {"song_b"}, {"song_c"}};
+    EXPECT_THAT(chain.Items(), WhenSorted(ContainerEq(want)));
+}
+
+TEST(FileLoaderTest, Contents) {
+    FileLoader loader(std::string("song_a\nsong_b\n"));
+    ShuffleChain chain;
+    loader.Load(&chain);
+
+    std::vector<std::vector<std::string>> want = {{"song_a"}, {"song_b"}};
+    EXPECT_THAT(chain.Items(), WhenSorted(ContainerEq(want)));
+}
+
 TEST(FileMPDLoaderTest, Basic) {
     // step 1. Initialize the MPD connection.
     fake::MPD mpd;
@@ -147,3 +684,150 @@ TEST(FileMPDLoaderTest, Basic) {
                                                   {song_c.URI()}};
     EXPECT_THAT(chain.Items(), WhenSorted(ContainerEq(want)));
 }
+
+TEST(FileMPDLoaderTest, Contents) {
+    fake::MPD mpd;
+    fake::Song song_a("song_a"), song_b("song_b"), song_c("song_c");
+    mpd.db.push_back(song_a);
+    mpd.db.push_back(song_b);
+    mpd.db.push_back(song_c);
+
+    // song_b is not in the list, and song_d is not in the library. The list
+    // contains song_a twice, and has no trailing newline.
+    std::string contents = "song_a\nsong_c\nsong_d\nsong_a";
+
+    std::vector<Rule> ruleset;
+    std::vector<enum mpd_tag_type> group_by;
+    FileMPDLoader loader(static_cast<mpd::MPD *>(&mpd), ruleset, group_by,
+                         contents);
+    ShuffleChain chain;
+    loader.Load(&chain);
+
+    std::vector<std::vector<std::string>> want = {{song_a.URI()},
+                                                  {song_c.URI()}};
+    EXPECT_THAT(chain.Items(), WhenSorted(ContainerEq(want)));
+}
+
+// BlockingLoader loads two songs, reporting progress after the first, and
+// waits for `release` before adding the second.
+class BlockingLoader : public Loader {
+   public:
+    explicit BlockingLoader(std::shared_future<void> release)
+        : release_(std::move(release)) {}
+
+    void Load(ShuffleChain *into) override {
+        into->Add("song_a");
+        if (progress_) {
+            progress_(*into);
+        }
+        release_.wait();
+        into->Add("song_b");
+    }
+
+   private:
+    std::shared_future<void> release_;
+};
+
+// FailingLoader reports progress after loading one song, and then fails.
+class FailingLoader : public Loader {
+   public:
+    void Load(ShuffleChain *into) override { TryLoad(into).IgnoreError(); }
+
+    absl::Status TryLoad(ShuffleChain *into) override {
+        into->Add("song_a");
+        if (progress_) {
+            progress_(*into);
+        }
+        return absl::UnavailableError("connection lost");
+    }
+};
+
+// Unwrap the result of ProgressiveLoad::First or Finish, failing the test
+// if loading failed.
+bool Finished(absl::StatusOr<bool> finished) {
+    EXPECT_TRUE(finished.ok()) << finished.status();
+    return finished.value_or(false);
+}
+
+// Return true if `fd` is readable.
+bool Readable(int fd) {
+    struct pollfd p = {.fd = fd, .events = POLLIN, .revents = 0};
+    return poll(&p, 1, 0) == 1;
+}
+
+TEST(ProgressiveLoadTest, Basic) {
+    std::promise<void> release;
+    ProgressiveLoad load(
+        nullptr,
+        std::make_unique<BlockingLoader>(release.get_future().share()), 1);
+
+    ShuffleChain chain;
+    EXPECT_FALSE(Finished(load.First(&chain)));
+    EXPECT_THAT(chain.Items(), ElementsAre(ElementsAre("song_a")));
+    // The rest of the library is still loading.
+    EXPECT_FALSE(Finished(load.Finish(&chain)));
+    EXPECT_THAT(chain.Pick(), ElementsAre("song_a"));
+
+    release.set_value();
+    EXPECT_TRUE(Finished(load.Finish(&chain, true)));
+    std::vector<std::vector<std::string>> want = {{"song_a"}, {"song_b"}};
+    EXPECT_THAT(chain.Items(), ContainerEq(want));
+    EXPECT_EQ(chain.Stats().picks, 1u);
+
+    // The library is only added once.
+    EXPECT_FALSE(Finished(load.Finish(&chain, true)));
+}
+
+TEST(ProgressiveLoadTest, FinishedBeforeFirst) {
+    fake::MPD mpd;
+    mpd.db.emplace_back("song_a");
+    mpd.db.emplace_back("song_b");
+    std::vector<Rule> ruleset;
+
+    // The library has fewer songs than needed to start early, so First
+    // waits for all of them.
+    ProgressiveLoad load(nullptr,
+                         std::make_unique<MPDLoader>(
+                             static_cast<mpd::MPD *>(&mpd), ruleset),
+                         10);
+    ShuffleChain chain;
+    EXPECT_TRUE(Finished(load.First(&chain)));
+
+    EXPECT_EQ(chain.Len(), 2u);
+    EXPECT_FALSE(Finished(load.Finish(&chain, true)));
+}
+
+TEST(ProgressiveLoadTest, Fd) {
+    std::promise<void> release;
+    ProgressiveLoad load(
+        nullptr,
+        std::make_unique<BlockingLoader>(release.get_future().share()), 1);
+    ASSERT_GE(load.Fd(), 0);
+
+    ShuffleChain chain;
+    EXPECT_FALSE(Finished(load.First(&chain)));
+    EXPECT_FALSE(Readable(load.Fd()));
+
+    // Readable once loading has finished, without calling Finish.
+    release.set_value();
+    struct pollfd p = {.fd = load.Fd(), .events = POLLIN, .revents = 0};
+    ASSERT_EQ(poll(&p, 1, -1), 1);
+    EXPECT_TRUE(Finished(load.Finish(&chain)));
+}
+
+TEST(ProgressiveLoadTest, Error) {
+    ProgressiveLoad load(nullptr, std::make_unique<FailingLoader>(), 1);
+
+    // First may see the song loaded before the error, but Finish must
+    // report the error, rather than apply a partial library.
+    ShuffleChain chain;
+    absl::StatusOr<bool> first = load.First(&chain);
+    if (first.ok()) {
+        EXPECT_FALSE(*first);
+        first = load.Finish(&chain, true);
+    }
+    EXPECT_TRUE(absl::IsUnavailable(first.status())) << first.status();
+
+    // The error is only reported once.
+    EXPECT_FALSE(Finished(load.Finish(&chain, true)));
+}
@@ -0,0 +1,119 @@
+#include "mapped_file.h"
+
+#include <sys/stat.h>
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <absl/status/status.h>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+using namespace ashuffle;
+
+using ::testing::ElementsAre;
+using ::testing::IsEmpty;
+
+namespace {
+
+std::filesystem::path TestPath(std::string_view name) {
+    std::filesystem::path path =
+        std::filesystem::path(testing::TempDir()) / name;
+    std::filesystem::remove(path);
+    return path;
+}
+
+std::vector<std::string> Lines(std::string_view contents) {
+    std::vector<std::string> lines;
+    ForEachLine(contents,
+                [&](std::string_view line) { lines.emplace_back(line); });
+    return lines;
+}
+
+}  // namespace
+
+TEST(MappedFileTest, Contents) {
+    std::filesystem::path path = TestPath("mapped_contents");
+    std::ofstream(path) << "song_a\nsong_b\n";
+
+    absl::StatusOr<MappedFile> file = MappedFile::Open(path);
+    ASSERT_TRUE(file.ok()) << file.status();
+    EXPECT_EQ(file->Contents(), "song_a\nsong_b\n");
+
+    // The mapping moves with the file.
+    MappedFile moved = std::move(*file);
+    EXPECT_EQ(moved.Contents(), "song_a\nsong_b\n");
+}
+
+TEST(MappedFileTest, Empty) {
+    std::filesystem::path path = TestPath("mapped_empty");
+    std::ofstream{path};
+
+    absl::StatusOr<MappedFile> file = MappedFile::Open(path);
+    ASSERT_TRUE(file.ok()) << file.status();
+    EXPECT_THAT(file->Contents(), IsEmpty());
+}
+
+TEST(MappedFileTest, NotRegular) {
+    std::filesystem::path path = TestPath("mapped_fifo");
+    ASSERT_EQ(mkfifo(path.c_str(), 0600), 0);
+
+    EXPECT_TRUE(absl::IsFailedPrecondition(MappedFile::Open(path).status()));
+    EXPECT_TRUE(absl::IsFailedPrecondition(
+        MappedFile::Open(testing::TempDir()).status()));
+}
+
+TEST(MappedFileTest, Missing) {
+    EXPECT_FALSE(MappedFile::Open(TestPath("mapped_missing")).ok());
+}
+
+TEST(ReadFileTest, Contents) {
+    std::filesystem::path path = TestPath("read_contents");
+    std::ofstream(path) << "song_a\nsong_b\n";
+
+    absl::StatusOr<std::string> contents = ReadFile(path);
+    ASSERT_TRUE(contents.ok()) << contents.status();
+    EXPECT_EQ(*contents, "song_a\nsong_b\n");
+
+    // The contents are a copy, so they are unaffected by the file being
+    // truncated.
+    std::filesystem::resize_file(path, 0);
+    EXPECT_EQ(*contents, "song_a\nsong_b\n");
+    contents = ReadFile(path);
+    ASSERT_TRUE(contents.ok()) << contents.status();
+    EXPECT_THAT(*contents, IsEmpty());
+}
+
+TEST(ReadFileTest, Large) {
+    // Larger than a single read.
+    std::filesystem::path path = TestPath("read_large");
+    std::string want;
+    for (int i = 0; i < 20000; i++) {
+        want += "artist/album/song_" + std::to_string(i) + ".mp3\n";
+    }
+    std::ofstream(path) << want;
+
+    absl::StatusOr<std::string> contents = ReadFile(path);
+    ASSERT_TRUE(contents.ok()) << contents.status();
+    EXPECT_EQ(*contents, want);
+}
+
+TEST(ReadFileTest, NotRegular) {
+    std::filesystem::path path = TestPath("read_fifo");
+    ASSERT_EQ(mkfifo(path.c_str(), 0600), 0);
+
+    EXPECT_TRUE(absl::IsFailedPrecondition(ReadFile(path).status()));
+    EXPECT_FALSE(ReadFile(TestPath("read_missing")).ok());
+}
+
+TEST(ForEachLineTest, Basic) {
+    EXPECT_THAT(Lines(""), IsEmpty());
+    EXPECT_THAT(Lines("a"), ElementsAre("a"));
+    EXPECT_THAT(Lines("a\n"), ElementsAre("a"));
+    EXPECT_THAT(Lines("a\nb"), ElementsAre("a", "b"));
+    EXPECT_THAT(Lines("a\n\nb\n"), ElementsAre("a", "", "b"));
+    EXPECT_THAT(Lines("\n"), ElementsAre(""));
+}
@@ -1,12 +1,18 @@
 #ifndef __ASHUFFLE_T_MPD_FAKE_H__
 #define __ASHUFFLE_T_MPD_FAKE_H__
 
+#include <algorithm>
 #include <fstream>
 #include <iostream>
+#include <optional>
 #include <ostream>
+#include <set>
 #include <string>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
+#include <absl/strings/match.h>
 #include <absl/strings/str_format.h>
 #include <absl/strings/str_join.h>
 #include <mpd/tag.h>
@@ -149,6 +155,29 @@ class MPD : public mpd::MPD {
 
     std::vector<Song> db;
     std::vector<Song> queue;
+    // stickers maps sticker name -> (song URI -> sticker value).
+    std::unordered_map<std::string,
+                       std::unordered_map<std::string, std::string>>
+        stickers;
+    absl::Time db_update = absl::UnixEpoch();
+    // dir_mtimes maps directory path -> last modified time. Directories
+    // (which are implied by song URIs) not in the map were last modified
+    // at the epoch.
+    std::unordered_map<std::string, absl::Time> dir_mtimes;
+    // listed_dirs records the path of every ListDirectory call.
+    std::vector<std::string> listed_dirs;
+    // tag_types is the set of tags sent with songs, if restricted by
+    // RestrictTagTypes.
+    std::optional<std::vector<enum mpd_tag_type>> tag_types;
+    // If false, ListMatching returns UNIMPLEMENTED, like an MPD too old to
+    // support filter expressions.
+    bool filter_support = true;
+    // filters records the filter of every ListMatching call.
+    std::vector<std::string> filters;
+    // windows records the window of every windowed ListMatching call.
+    std::vector<std::pair<unsigned, unsigned>> windows;
+    // restricted_tag_types records the tags of every RestrictTagTypes call.
+    std::vector<std::vector<enum mpd_tag_type>> restricted_tag_types;
     State state;
     mpd::IdleEventSet (*idle_f)() = [] { return mpd::IdleEventSet(); };
     std::string active_user;
@@ -191,11 +220,97 @@ class MPD : public mpd::MPD {
         }
         return std::unique_ptr<mpd::Song>(new Song(*found));
     };
+    absl::StatusOr<std::unordered_map<std::string, std::string>> SongStickers(
+        std::string_view name) override {
+        dbg() << "call:SongStickers(" << name << ")" << std::endl;
+        if (auto it = stickers.find(std::string(name)); it != stickers.end()) {
+            return it->second;
+        }
+        return std::unordered_map<std::string, std::string>();
+    };
+    // The fake does not evaluate filters, it lists all songs (in the
+    // window). Callers must still check the listed songs themselves.
+    absl::StatusOr<std::unique_ptr<mpd::SongReader>> ListMatching(
+        std::string_view filter,
+        std::optional<mpd::Window> window = std::nullopt) override;
+
+    absl::Status RestrictTagTypes(
+        const std::vector<enum mpd_tag_type>& tags) override {
+        dbg() << "call:RestrictTagTypes(" << tags.size() << " tags)"
+              << std::endl;
+        tag_types = tags;
+        restricted_tag_types.push_back(tags);
+        return absl::OkStatus();
+    };
+    absl::Status AllTagTypes() override {
+        dbg() << "call:AllTagTypes" << std::endl;
+        tag_types = std::nullopt;
+        return absl::OkStatus();
+    };
+
+    // Project returns a copy of the given song, with only the tags that
+    // are enabled on this connection.
+    Song Project(const Song& song) const {
+        if (!tag_types) {
+            return song;
+        }
+        Song projected(song.uri);
+        for (enum mpd_tag_type tag : *tag_types) {
+            if (auto it = song.tags.find(tag); it != song.tags.end()) {
+                projected.tags.insert(*it);
+            }
+        }
+        return projected;
+    };
+
+    absl::StatusOr<mpd::DirectoryListing> ListDirectory(
+        std::string_view path) override {
+        dbg() << "call:ListDirectory(" << path << ")" << std::endl;
+        listed_dirs.emplace_back(path);
+        std::string prefix = path.empty() ? "" : std::string(path) + "/";
+        mpd::DirectoryListing listing;
+        std::set<std::string> dirs;
+        for (const Song& song : db) {
+            if (!absl::StartsWith(song.uri, prefix)) {
+                continue;
+            }
+            size_t slash = song.uri.find('/', prefix.size());
+            if (slash == std::string::npos) {
+                listing.songs.emplace_back(new Song(Project(song)));
+            } else {
+                dirs.insert(song.uri.substr(0, slash));
+            }
+        }
+        for (const std::string& dir : dirs) {
+            auto mtime = dir_mtimes.find(dir);
+            listing.directories.push_back(mpd::Directory{
+                .path = dir,
+                .last_modified = mtime == dir_mtimes.end()
+                                     ? absl::UnixEpoch()
+                                     : mtime->second,
+            });
+        }
+        return listing;
+    };
+    absl::StatusOr<mpd::DBStats> DatabaseStats() override {
+        dbg() << "call:DatabaseStats" << std::endl;
+        return mpd::DBStats{
+            .last_update = db_update,
+            .songs = static_cast<unsigned>(db.size()),
+            .playtime = absl::ZeroDuration(),
+        };
+    };
     absl::StatusOr<mpd::IdleEventSet> Idle(__attribute__((unused))
                                            const mpd::IdleEventSet&) override {
         dbg() << "call:Idle" << std::endl;
         return idle_f();
     };
+    // The fake never blocks, so `fds` do not need to be waited on.
+    absl::StatusOr<mpd::IdleEventSet> IdleOrReadable(
+        const mpd::IdleEventSet& events,
+        __attribute__((unused)) absl::Span<const int> fds) override {
+        return Idle(events);
+    };
     absl::Status Add(const std::string& uri) override {
         dbg() << "call:Add(" << uri << ")" << std::endl;
         std::optional<Song> found = SearchInternal(uri);
@@ -263,8 +378,8 @@ class MPD : public mpd::MPD {
 
 inline bool operator==(const MPD& lhs, const MPD& rhs) {
     return (lhs.db == rhs.db && lhs.queue == rhs.queue &&
-            lhs.state == rhs.state && lhs.idle_f == rhs.idle_f &&
-            lhs.users == rhs.users);
+            lhs.stickers == rhs.stickers && lhs.state == rhs.state &&
+            lhs.idle_f == rhs.idle_f && lhs.users == rhs.users);
 }
 
 std::ostream& operator<<(std::ostream& st, const MPD& mpd) {
@@ -305,14 +420,26 @@ class SongReader : public mpd::SongReader {
     SongReader(const MPD& mpd)
         : SongReader(mpd, MPD::MetadataOption::kInclude) {}
     SongReader(const MPD& mpd, MPD::MetadataOption metadata)
-        : cur_(mpd.db.begin()), end_(mpd.db.end()), metadata_(metadata) {}
+        : mpd_(mpd),
+          cur_(mpd.db.begin()),
+          end_(mpd.db.end()),
+          metadata_(metadata) {}
+    // Only read the songs in the given window of the database.
+    SongReader(const MPD& mpd, mpd::Window window)
+        : SongReader(mpd, MPD::MetadataOption::kInclude) {
+        cur_ += std::min<size_t>(window.start, mpd.db.size());
+        end_ = mpd.db.begin() + std::min<size_t>(window.end, mpd.db.size());
+        if (cur_ > end_) {
+            cur_ = end_;
+        }
+    }
 
     absl::StatusOr<std::unique_ptr<mpd::Song>> Next() override {
         if (Done()) {
             return absl::OutOfRangeError("no more songs to read");
         }
 
-        Song* s = new Song(*cur_++);
+        Song* s = new Song(mpd_.Project(*cur_++));
         if (MPD::MetadataOption::kOmit == metadata_) {
             // If we're being asked to omit metadata, then clear out the
             // tags on our copied song, before sending it.
@@ -327,6 +454,7 @@ class SongReader : public mpd::SongReader {
     bool Done() override { return cur_ == end_; }
 
    private:
+    const MPD& mpd_;
     std::vector<Song>::const_iterator cur_;
     std::vector<Song>::const_iterator end_;
     MPD::MetadataOption metadata_;
@@ -338,6 +466,21 @@ absl::StatusOr<std::unique_ptr<mpd::SongReader>> MPD::ListAll(
     return std::unique_ptr<mpd::SongReader>(new SongReader(*this, metadata));
 }
 
+absl::StatusOr<std::unique_ptr<mpd::SongReader>> MPD::ListMatching(
+    std::string_view filter, std::optional<mpd::Window> window) {
+    dbg() << "call:ListMatching(" << filter << ")" << std::endl;
+    if (!filter_support) {
+        return absl::UnimplementedError("filters not supported");
+    }
+    filters.emplace_back(filter);
+    if (window) {
+        windows.emplace_back(window->start, window->end);
+        return std::unique_ptr<mpd::SongReader>(new SongReader(*this, *window));
+    }
+    return std::unique_ptr<mpd::SongReader>(
+        new SongReader(*this, MetadataOption::kInclude));
+}
+
 class Dialer : public mpd::Dialer {
    public:
     ~Dialer() override = default;
@@ -0,0 +1,84 @@
+#include "rng.h"
+
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+using namespace ashuffle;
+
+using ::testing::ElementsAre;
+
+TEST(Xoshiro256Test, ReferenceOutput) {
+    // Values from the reference xoshiro256** implementation, seeded with
+    // splitmix64 starting from zero.
+    Xoshiro256 rng(0);
+    std::vector<uint64_t> got;
+    for (int i = 0; i < 4; i++) {
+        got.push_back(rng());
+    }
+    EXPECT_THAT(got, ElementsAre(0x99ec5f36cb75f2b4, 0xbf6e1f784956452a,
+                                 0x1a5f849d4933e6e0, 0x6aa594f1262d2d2c));
+}
+
+TEST(Xoshiro256Test, Seed) {
+    Xoshiro256 a(42);
+    Xoshiro256 b;
+    b.seed(42);
+    for (int i = 0; i < 100; i++) {
+        ASSERT_EQ(a(), b());
+    }
+
+    Xoshiro256 c(43);
+    EXPECT_NE(a(), c()) << "different seeds should give different sequences";
+}
+
+TEST(UniformBelowTest, InRange) {
+    Xoshiro256 rng(1);
+    for (uint64_t n : {1ull, 2ull, 3ull, 7ull, 1000ull, 1ull << 40}) {
+        for (int i = 0; i < 1000; i++) {
+            ASSERT_LT(UniformBelow(rng, n), n) << "n = " << n;
+        }
+    }
+}
+
+TEST(UniformBelowTest, CoversRange) {
+    Xoshiro256 rng(1);
+    std::vector<int> counts(10);
+    for (int i = 0; i < 10000; i++) {
+        counts[UniformBelow(rng, counts.size())]++;
+    }
+    for (size_t i = 0; i < counts.size(); i++) {
+        // Expect ~1000 hits for each value, this is a very loose bound.
+        EXPECT_GT(counts[i], 800) << "value " << i << " picked too rarely";
+    }
+}
+
+TEST(UniformBelowTest, ThirtyTwoBitEngine) {
+    std::mt19937 rng(1);
+    std::vector<int> counts(3);
+    for (int i = 0; i < 3000; i++) {
+        counts[UniformBelow(rng, counts.size())]++;
+    }
+    EXPECT_THAT(counts, testing::Each(testing::Gt(800)));
+}
+
+TEST(StreamSeedTest, Streams) {
+    // The chain uses the seed itself, so seeded runs pick the same songs.
+    EXPECT_EQ(StreamSeed(42, SeedStream::kChain), 42u);
+    EXPECT_EQ(StreamSeed(42, SeedStream::kSample),
+              StreamSeed(42, SeedStream::kSample));
+
+    // Other streams draw unrelated numbers from the same seed.
+    Xoshiro256 chain(StreamSeed(42, SeedStream::kChain));
+    Xoshiro256 sample(StreamSeed(42, SeedStream::kSample));
+    Xoshiro256 picker(StreamSeed(42, SeedStream::kIndexPicker));
+    for (int i = 0; i < 100; i++) {
+        uint64_t c = chain(), s = sample(), p = picker();
+        EXPECT_NE(c, s);
+        EXPECT_NE(c, p);
+        EXPECT_NE(s, p);
+    }
+}
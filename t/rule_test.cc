@@ -1,7 +1,11 @@
 #include "rule.h"
 
 #include <memory>
+#include <optional>
+#include <string>
 #include <string_view>
+#include <utility>
+#include <vector>
 
 #include <mpd/tag.h>
 
@@ -13,6 +17,38 @@
 
 using namespace ashuffle;
 
+namespace {
+
+// MultiValueSong is a song whose tags may have several values, as MPD
+// reports for songs with, e.g., several artists.
+class MultiValueSong : public mpd::Song {
+   public:
+    MultiValueSong(enum mpd_tag_type tag, std::vector<std::string> values)
+        : tag_(tag), values_(std::move(values)){};
+
+    std::optional<std::string> Tag(enum mpd_tag_type tag) const override {
+        if (tag != tag_ || values_.empty()) {
+            return std::nullopt;
+        }
+        return values_[0];
+    }
+
+    std::vector<std::string> TagValues(enum mpd_tag_type tag) const override {
+        if (tag != tag_) {
+            return {};
+        }
+        return values_;
+    }
+
+    std::string URI() const override { return "song"; }
+
+   private:
+    enum mpd_tag_type tag_;
+    std::vector<std::string> values_;
+};
+
+}  // namespace
+
 TEST(Rule, Empty) {
     Rule rule;
     EXPECT_TRUE(rule.Empty()) << "rule with no matchers should be empty";
@@ -34,6 +70,25 @@ TEST(Rule, Accepts) {
     EXPECT_TRUE(rule.Accepts(non_matching));
 }
 
+TEST(Rule, AcceptsMultipleValues) {
+    Rule rule;
+    rule.AddPattern(MPD_TAG_ARTIST, "foo fighters");
+
+    // Any value of the tag can match, not just the first.
+    EXPECT_FALSE(rule.Accepts(MultiValueSong(
+        MPD_TAG_ARTIST, {"some randy", "Foo Fighters"})));
+    EXPECT_TRUE(rule.Accepts(MultiValueSong(
+        MPD_TAG_ARTIST, {"some randy", "another randy"})));
+    EXPECT_TRUE(rule.Accepts(MultiValueSong(MPD_TAG_ARTIST, {})));
+
+    // Every pattern must still match, each on any of its tag's values.
+    Rule both;
+    both.AddPattern(MPD_TAG_ARTIST, "foo fighters");
+    both.AddPattern(MPD_TAG_ALBUM, "__album__");
+    EXPECT_TRUE(both.Accepts(MultiValueSong(
+        MPD_TAG_ARTIST, {"some randy", "Foo Fighters"})));
+}
+
 TEST(Rule, PatternIsSubstring) {
     Rule rule;
     rule.AddPattern(MPD_TAG_ARTIST, "foo");
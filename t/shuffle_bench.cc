@@ -0,0 +1,146 @@
+#include "shuffle.h"
+
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <absl/strings/str_format.h>
+#include <benchmark/benchmark.h>
+
+using namespace ashuffle;
+
+namespace {
+
+// The window size used by ashuffle by default.
+constexpr size_t kWindowSize = 7;
+
+// Build `n` URIs shaped like a typical "artist/album/track" library.
+std::vector<std::string> MakeURIs(int64_t n) {
+    std::vector<std::string> uris;
+    uris.reserve(n);
+    for (int64_t i = 0; i < n; i++) {
+        uris.push_back(absl::StrFormat("artist %d/album %d/%02d track.mp3",
+                                       i / 30, i / 10, i % 10));
+    }
+    return uris;
+}
+
+template <typename Chain>
+void AddAll(Chain* chain, const std::vector<std::string>& uris) {
+    for (const std::string& uri : uris) {
+        chain->Add(uri);
+    }
+}
+
+// Pick single songs from a chain using the given engine.
+template <typename Engine>
+void BM_Pick(benchmark::State& state) {
+    BasicShuffleChain<Engine> chain(kWindowSize);
+    AddAll(&chain, MakeURIs(state.range(0)));
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(chain.Pick());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Pick single songs from a chain where songs have distinct weights.
+void BM_PickWeighted(benchmark::State& state) {
+    ShuffleChain chain(kWindowSize);
+    const std::vector<std::string> uris = MakeURIs(state.range(0));
+    for (size_t i = 0; i < uris.size(); i++) {
+        chain.Add(uris[i], 1 + i % 10);
+    }
+    // The first pick builds the weight tree, keep it out of the timing.
+    (void)chain.Pick();
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(chain.Pick());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Draw a bounded random index, the core of every pick. This compares the
+// engines directly, along with the std::uniform_int_distribution the chain
+// used to construct for every pick.
+template <typename Engine>
+void BM_Draw(benchmark::State& state) {
+    Engine rng(1);
+    const uint64_t n = state.range(0);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(UniformBelow(rng, n));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+void BM_DrawDistribution(benchmark::State& state) {
+    std::mt19937 rng(1);
+    const uint64_t n = state.range(0);
+    for (auto _ : state) {
+        std::uniform_int_distribution<unsigned long long> rd{0, n - 1};
+        benchmark::DoNotOptimize(rd(rng));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Pick a batch of 100,000 songs, as with `--only 100000`.
+void BM_PickN(benchmark::State& state) {
+    constexpr size_t kBatch = 100'000;
+    ShuffleChain chain(kWindowSize);
+    AddAll(&chain, MakeURIs(state.range(0)));
+    std::vector<std::string> picked;
+
+    for (auto _ : state) {
+        picked.clear();
+        chain.PickN(kBatch, &picked);
+        benchmark::DoNotOptimize(picked.data());
+    }
+    state.SetItemsProcessed(state.iterations() * kBatch);
+}
+
+void BM_Add(benchmark::State& state) {
+    const std::vector<std::string> uris = MakeURIs(state.range(0));
+    ShuffleChain chain(kWindowSize);
+
+    for (auto _ : state) {
+        state.PauseTiming();
+        chain.Clear();
+        state.ResumeTiming();
+        AddAll(&chain, uris);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+void BM_Clear(benchmark::State& state) {
+    const std::vector<std::string> uris = MakeURIs(state.range(0));
+    ShuffleChain chain(kWindowSize);
+
+    for (auto _ : state) {
+        state.PauseTiming();
+        AddAll(&chain, uris);
+        // Make sure the window is populated, so it has to be cleared too.
+        (void)chain.Pick();
+        state.ResumeTiming();
+        chain.Clear();
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+void LibrarySizes(benchmark::internal::Benchmark* b) {
+    b->Arg(1'000)->Arg(100'000)->Arg(1'000'000)->Arg(10'000'000);
+}
+
+}  // namespace
+
+BENCHMARK_TEMPLATE(BM_Pick, Xoshiro256)->Apply(LibrarySizes);
+BENCHMARK_TEMPLATE(BM_Pick, std::mt19937)->Apply(LibrarySizes);
+BENCHMARK(BM_PickWeighted)->Apply(LibrarySizes);
+BENCHMARK_TEMPLATE(BM_Draw, Xoshiro256)->Apply(LibrarySizes);
+BENCHMARK_TEMPLATE(BM_Draw, std::mt19937)->Apply(LibrarySizes);
+BENCHMARK(BM_DrawDistribution)->Apply(LibrarySizes);
+BENCHMARK(BM_PickN)->Apply(LibrarySizes)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_Add)->Apply(LibrarySizes)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_Clear)->Apply(LibrarySizes)->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
@@ -2,12 +2,18 @@
 
 #include <stdlib.h>
 #include <algorithm>
+#include <deque>
+#include <filesystem>
 #include <random>
+#include <sstream>
 #include <string>
+#include <string_view>
 #include <unordered_set>
 #include <vector>
 
+#include <absl/strings/match.h>
 #include <absl/strings/str_cat.h>
+#include <absl/strings/str_join.h>
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 
@@ -16,7 +22,10 @@ using namespace ashuffle;
 using ::testing::ContainerEq;
 using ::testing::Each;
 using ::testing::ElementsAre;
+using ::testing::ElementsAreArray;
+using ::testing::Ne;
 using ::testing::Range;
+using ::testing::SizeIs;
 using ::testing::Values;
 using ::testing::WhenSorted;
 
@@ -41,11 +50,65 @@ TEST(ShuffleChainTest, AddPickGroup) {
 
     EXPECT_EQ(chain.Len(), 1);
     EXPECT_EQ(chain.LenURIs(), 3);
-    EXPECT_THAT(chain.Pick(), ContainerEq(g));
-    EXPECT_THAT(chain.Pick(), ContainerEq(g))
+    EXPECT_THAT(chain.Pick(), ElementsAreArray(g));
+    EXPECT_THAT(chain.Pick(), ElementsAreArray(g))
         << "could not double-pick from the same 1-item chain.";
 }
 
+TEST(ShuffleChainTest, ClearAndReload) {
+    ShuffleChain chain;
+    chain.Add(std::vector<std::string>{"group a", "group b"});
+    chain.Add("old");
+    (void)chain.Pick();
+
+    chain.Clear();
+    EXPECT_EQ(chain.Len(), 0u);
+    EXPECT_EQ(chain.LenURIs(), 0u);
+
+    chain.Add("new");
+    EXPECT_EQ(chain.Len(), 1u);
+    EXPECT_EQ(chain.LenURIs(), 1u);
+    EXPECT_THAT(chain.Pick(), ElementsAre("new"));
+}
+
+TEST(ShuffleChainTest, Stats) {
+    ShuffleChain chain(2);
+    ChainStats stats = chain.Stats();
+    EXPECT_EQ(stats.items, 0u);
+    EXPECT_EQ(stats.uris, 0u);
+    EXPECT_EQ(stats.uri_bytes, 0u);
+    EXPECT_EQ(stats.window, 0u);
+    EXPECT_EQ(stats.pool, 0u);
+
+    chain.Add("a");
+    chain.Add("b");
+    chain.Add("c");
+    chain.Add(std::vector<std::string>{"d", "e"});
+    stats = chain.Stats();
+    EXPECT_EQ(stats.items, 4u);
+    EXPECT_EQ(stats.uris, 5u);
+    EXPECT_GT(stats.uri_bytes, 0u);
+    EXPECT_EQ(stats.window, 0u);
+    EXPECT_EQ(stats.pool, 4u);
+
+    // Picking fills the window (window size + 1 items, less the picked one),
+    // and returns the picked item to the pool.
+    (void)chain.Pick();
+    stats = chain.Stats();
+    EXPECT_EQ(stats.items, 4u);
+    EXPECT_EQ(stats.uris, 5u);
+    EXPECT_EQ(stats.window, 2u);
+    EXPECT_EQ(stats.pool, 2u);
+
+    chain.Clear();
+    stats = chain.Stats();
+    EXPECT_EQ(stats.items, 0u);
+    EXPECT_EQ(stats.uris, 0u);
+    EXPECT_EQ(stats.uri_bytes, 0u);
+    EXPECT_EQ(stats.window, 0u);
+    EXPECT_EQ(stats.pool, 0u);
+}
+
 MATCHER_P(IsInCollection, c, "") { return c.find(arg) != c.end(); }
 
 TEST(ShuffleChainTest, PickN) {
@@ -61,7 +124,7 @@ TEST(ShuffleChainTest, PickN) {
 
     std::vector<std::string> picked;
     for (int i = 0; i < test_rounds; i++) {
-        const std::vector<std::string>& got = chain.Pick();
+        ItemView got = chain.Pick();
         picked.insert(picked.end(), got.begin(), got.end());
     }
 
@@ -69,6 +132,32 @@ TEST(ShuffleChainTest, PickN) {
         << "ShuffleChain picked item not in chain!";
 }
 
+TEST(ShuffleChainTest, PickNMatchesPick) {
+    ShuffleChain batch(3, Xoshiro256(7));
+    ShuffleChain single(3, Xoshiro256(7));
+    for (int i = 0; i < 10; i++) {
+        batch.Add(absl::StrCat("item ", i));
+        single.Add(absl::StrCat("item ", i));
+    }
+    batch.Add(std::vector<std::string>{"group a", "group b"});
+    single.Add(std::vector<std::string>{"group a", "group b"});
+
+    std::vector<std::string> want;
+    for (int i = 0; i < 100; i++) {
+        ItemView got = single.Pick();
+        want.insert(want.end(), got.begin(), got.end());
+    }
+
+    // PickN appends to whatever is already in the output buffer.
+    std::vector<std::string> got{"existing"};
+    batch.PickN(60, &got);
+    batch.PickN(0, &got);
+    batch.PickN(40, &got);
+
+    want.insert(want.begin(), "existing");
+    EXPECT_THAT(got, ContainerEq(want));
+}
+
 class WindowTest : public testing::TestWithParam<int> {
    public:
     ShuffleChain chain_;
@@ -105,6 +194,31 @@ TEST_P(WindowTest, Repeats) {
         << "should have gotten a repeat by picking one more song";
 }
 
+TEST(ShuffleChainTest, NoRepeatsWithinWindow) {
+    constexpr int window_size = 7;
+    constexpr int test_rounds = 5000;
+    ShuffleChain chain(window_size);
+    for (int i = 0; i < 100; i++) {
+        chain.Add(absl::StrCat("item ", i));
+    }
+
+    std::deque<std::string> recent;
+    std::unordered_set<std::string> seen;
+    for (int i = 0; i < test_rounds; i++) {
+        auto got = chain.Pick();
+        ASSERT_THAT(got, SizeIs(1));
+        EXPECT_THAT(recent, Each(Ne(got[0])))
+            << "picked " << got[0] << " twice within the window";
+        recent.push_back(got[0]);
+        if (recent.size() > window_size) {
+            recent.pop_front();
+        }
+        seen.insert(got[0]);
+    }
+
+    EXPECT_EQ(seen.size(), 100u) << "every item should eventually be picked";
+}
+
 INSTANTIATE_TEST_SUITE_P(SmallWindows, WindowTest, Range(1, 25 + 1));
 INSTANTIATE_TEST_SUITE_P(BigWindows, WindowTest, Values(50, 99, 100, 1000));
 
@@ -118,7 +232,7 @@ INSTANTIATE_TEST_SUITE_P(BigWindows, WindowTest, Values(50, 99, 100, 1000));
 TEST(ShuffleChainTest, IsRandom) {
     std::mt19937 rnd_engine(4);
 
-    ShuffleChain chain(2, rnd_engine);
+    BasicShuffleChain<std::mt19937> chain(2, rnd_engine);
 
     chain.Add("test a");
     chain.Add("test b");
@@ -134,6 +248,463 @@ TEST(ShuffleChainTest, IsRandom) {
     EXPECT_THAT(got, ContainerEq(want));
 }
 
+TEST(ShuffleChainTest, SeedIsReproducible) {
+    ShuffleChain a(7, Xoshiro256(42));
+    ShuffleChain b(7, Xoshiro256(42));
+    ShuffleChain other(7, Xoshiro256(43));
+    for (int i = 0; i < 100; i++) {
+        a.Add(absl::StrCat("item ", i));
+        b.Add(absl::StrCat("item ", i));
+        other.Add(absl::StrCat("item ", i));
+    }
+
+    std::vector<std::string> got_a, got_b, got_other;
+    a.PickN(50, &got_a);
+    b.PickN(50, &got_b);
+    other.PickN(50, &got_other);
+
+    EXPECT_THAT(got_a, ContainerEq(got_b))
+        << "chains with the same seed should pick the same songs";
+    EXPECT_NE(got_a, got_other)
+        << "chains with different seeds should pick different songs";
+}
+
+TEST(ShuffleChainTest, Weighted) {
+    // Use a large pool, so the window has little effect on the distribution.
+    ShuffleChain chain(2, Xoshiro256(1));
+    for (int i = 0; i < 50; i++) {
+        chain.Add(absl::StrCat("light ", i));
+        chain.Add(absl::StrCat("heavy ", i), 4);
+    }
+
+    int heavy = 0;
+    constexpr int kRounds = 20000;
+    for (int i = 0; i < kRounds; i++) {
+        auto got = chain.Pick();
+        ASSERT_THAT(got, SizeIs(1));
+        if (absl::StartsWith(got[0], "heavy")) {
+            heavy++;
+        }
+    }
+    // Heavy items should be picked ~4/5ths of the time.
+    EXPECT_NEAR(static_cast<double>(heavy) / kRounds, 0.8, 0.03);
+}
+
+TEST(ShuffleChainTest, WeightedNoRepeatsWithinWindow) {
+    constexpr int window_size = 5;
+    ShuffleChain chain(window_size, Xoshiro256(2));
+    chain.Add("heavy", 1000);
+    for (int i = 0; i < 20; i++) {
+        chain.Add(absl::StrCat("item ", i));
+    }
+
+    std::deque<std::string> recent;
+    for (int i = 0; i < 1000; i++) {
+        auto got = chain.Pick();
+        ASSERT_THAT(got, SizeIs(1));
+        EXPECT_THAT(recent, Each(Ne(got[0])))
+            << "picked " << got[0] << " twice within the window";
+        recent.push_back(got[0]);
+        if (recent.size() > window_size) {
+            recent.pop_front();
+        }
+    }
+}
+
+TEST(ShuffleChainTest, SetWeight) {
+    ShuffleChain chain(1, Xoshiro256(3));
+    for (int i = 0; i < 10; i++) {
+        chain.Add(absl::StrCat("item ", i));
+    }
+    // Pick once so the chain is mid-shuffle when the weights change.
+    (void)chain.Pick();
+    for (size_t i = 1; i < chain.Len(); i++) {
+        chain.SetWeight(i, 1);
+    }
+    chain.SetWeight(0, 1'000'000);
+
+    int picked = 0;
+    for (int i = 0; i < 100; i++) {
+        auto got = chain.Pick();
+        if (got[0] == "item 0") {
+            picked++;
+        }
+    }
+    // Item 0 should be picked every time it is not held in the window.
+    EXPECT_GE(picked, 45);
+
+    ChainStats stats = chain.Stats();
+    EXPECT_EQ(stats.window + stats.pool, stats.items);
+}
+
+TEST(ShuffleChainTest, WeightedGroup) {
+    ShuffleChain chain;
+    chain.Add(ShuffleItem({"a", "b"}, 3));
+    chain.Add("c");
+    std::vector<std::vector<std::string>> want = {{"a", "b"}, {"c"}};
+    EXPECT_THAT(chain.Items(), ContainerEq(want));
+    EXPECT_THAT(chain.Pick(), SizeIs(testing::AnyOf(1u, 2u)));
+}
+
+TEST(ShuffleChainTest, Spread) {
+    constexpr size_t kSpread = 5;
+    constexpr int kArtists = 20;
+    ShuffleChain chain(7, Xoshiro256(4));
+    chain.SetSpread(kSpread);
+    for (int artist = 1; artist <= kArtists; artist++) {
+        for (int song = 0; song < 10; song++) {
+            chain.Add(absl::StrCat(artist, "/", song));
+            chain.SetSpreadKey(chain.Len() - 1, artist);
+        }
+    }
+
+    std::deque<std::string> recent;
+    for (int i = 0; i < 2000; i++) {
+        auto got = chain.Pick();
+        ASSERT_THAT(got, SizeIs(1));
+        std::string artist(got[0].substr(0, got[0].find('/')));
+        EXPECT_THAT(recent, Each(Ne(artist)))
+            << "picked artist " << artist << " twice within the spread";
+        recent.push_back(artist);
+        if (recent.size() > kSpread) {
+            recent.pop_front();
+        }
+    }
+}
+
+TEST(ShuffleChainTest, SpreadUnsatisfiable) {
+    // When every item has the same key, the constraint cannot be met, but
+    // the chain should still pick songs.
+    ShuffleChain chain(1, Xoshiro256(5));
+    chain.SetSpread(3);
+    for (int i = 0; i < 5; i++) {
+        chain.Add(absl::StrCat("item ", i));
+        chain.SetSpreadKey(i, 1);
+    }
+    for (int i = 0; i < 10; i++) {
+        EXPECT_THAT(chain.Pick(), SizeIs(1));
+    }
+}
+
+TEST(ShuffleChainTest, SaveRestore) {
+    std::filesystem::path path =
+        std::filesystem::path(testing::TempDir()) / "chain.snapshot";
+    ShuffleChain chain(3, Xoshiro256(6));
+    chain.SetSpread(2);
+    for (int i = 0; i < 40; i++) {
+        chain.Add(absl::StrCat("artist ", i % 4, "/song ", i), 1 + i % 3);
+        chain.SetSpreadKey(i, 1 + i % 4);
+    }
+    chain.Add(std::vector<std::string>{"group a", "group b"});
+    std::vector<std::string> ignored;
+    chain.PickN(10, &ignored);
+
+    auto writer = SnapshotWriter::Create(path, 1);
+    ASSERT_TRUE(writer.ok()) << writer.status();
+    chain.Save(&*writer);
+    ASSERT_TRUE(writer->Commit().ok());
+
+    ShuffleChain restored(3);
+    restored.SetSpread(2);
+    auto reader = SnapshotReader::Open(path, 1);
+    ASSERT_TRUE(reader.ok()) << reader.status();
+    ASSERT_TRUE(restored.Restore(&*reader));
+    EXPECT_TRUE(reader->Done());
+
+    EXPECT_THAT(restored.Items(), ContainerEq(chain.Items()));
+    ChainStats want = chain.Stats(), got = restored.Stats();
+    EXPECT_EQ(got.window, want.window);
+    EXPECT_EQ(got.pool, want.pool);
+    EXPECT_EQ(got.picks, want.picks);
+
+    // The restored chain should pick exactly what the original would have.
+    std::vector<std::string> want_picks, got_picks;
+    chain.PickN(100, &want_picks);
+    restored.PickN(100, &got_picks);
+    EXPECT_THAT(got_picks, ContainerEq(want_picks));
+}
+
+TEST(ShuffleChainTest, SaveRestoreItems) {
+    std::filesystem::path path =
+        std::filesystem::path(testing::TempDir()) / "items.snapshot";
+    ShuffleChain chain(2);
+    chain.Add("song_a");
+    chain.Add(ShuffleItem({"group_1", "group_2"}, 3));
+    chain.Add("song_b");
+    chain.Pick();
+
+    auto writer = SnapshotWriter::Create(path, 1);
+    ASSERT_TRUE(writer.ok()) << writer.status();
+    chain.SaveItems(&*writer);
+    ASSERT_TRUE(writer->Commit().ok());
+
+    ShuffleChain restored(2);
+    auto reader = SnapshotReader::Open(path, 1);
+    ASSERT_TRUE(reader.ok()) << reader.status();
+    ASSERT_TRUE(restored.RestoreItems(&*reader));
+    EXPECT_TRUE(reader->Done());
+
+    EXPECT_THAT(restored.Items(), ContainerEq(chain.Items()));
+    EXPECT_EQ(restored.Stats().window, 0u);
+    EXPECT_EQ(restored.Stats().picks, 0u);
+    std::unordered_set<std::string> picked;
+    for (int i = 0; i < 100; i++) {
+        picked.insert(restored.Pick()[0]);
+    }
+    EXPECT_THAT(picked, SizeIs(3));
+}
+
+TEST(ShuffleChainTest, RestoreItemsCorrupt) {
+    std::filesystem::path path =
+        std::filesystem::path(testing::TempDir()) / "corrupt.snapshot";
+    URIArena uris;
+    uris.Add("song_a");
+    uris.Add("song_b");
+    uris.Add("song_c");
+
+    // Item starts that are out of order, repeated, do not start at the
+    // first URI, or are missing entirely.
+    std::vector<std::vector<size_t>> bad_starts = {
+        {0, 2, 1},
+        {0, 1, 1},
+        {1, 2},
+        {},
+    };
+    for (const std::vector<size_t>& starts : bad_starts) {
+        auto writer = SnapshotWriter::Create(path, 1);
+        ASSERT_TRUE(writer.ok()) << writer.status();
+        writer->PutArray(starts);
+        uris.Save(&*writer);
+        writer->PutArray(std::vector<uint32_t>{});
+        writer->PutArray(std::vector<uint32_t>{});
+        ASSERT_TRUE(writer->Commit().ok());
+
+        ShuffleChain chain;
+        auto reader = SnapshotReader::Open(path, 1);
+        ASSERT_TRUE(reader.ok()) << reader.status();
+        EXPECT_FALSE(chain.RestoreItems(&*reader))
+            << "starts: " << absl::StrJoin(starts, ",");
+        EXPECT_EQ(chain.Len(), 0u);
+    }
+
+    // Weights of zero cannot be picked.
+    auto writer = SnapshotWriter::Create(path, 1);
+    ASSERT_TRUE(writer.ok()) << writer.status();
+    writer->PutArray(std::vector<size_t>{0, 1, 2});
+    uris.Save(&*writer);
+    writer->PutArray(std::vector<uint32_t>{1, 0, 1});
+    writer->PutArray(std::vector<uint32_t>{});
+    ASSERT_TRUE(writer->Commit().ok());
+    ShuffleChain chain;
+    auto reader = SnapshotReader::Open(path, 1);
+    ASSERT_TRUE(reader.ok()) << reader.status();
+    EXPECT_FALSE(chain.RestoreItems(&*reader));
+}
+
+TEST(ShuffleChainTest, RestoreCorrupt) {
+    std::filesystem::path path =
+        std::filesystem::path(testing::TempDir()) / "corrupt_state.snapshot";
+    ShuffleChain unweighted(2);
+    ShuffleChain weighted(2);
+    for (int i = 0; i < 3; i++) {
+        unweighted.Add(absl::StrCat("song_", i));
+        weighted.Add(absl::StrCat("song_", i), 1 + i);
+    }
+
+    struct Case {
+        const ShuffleChain* items;
+        std::vector<size_t> window;
+        std::vector<size_t> pool;
+    };
+    std::vector<Case> cases = {
+        // A repeated item.
+        {&unweighted, {0}, {0, 1}},
+        {&unweighted, {1, 1}, {0, 2}},
+        // An empty pool and window, with items in the chain.
+        {&unweighted, {}, {}},
+        // A missing item.
+        {&unweighted, {0}, {1}},
+        // An item that does not exist.
+        {&unweighted, {0}, {1, 3}},
+        // Weighted chains keep no index pool.
+        {&weighted, {0}, {1, 2}},
+        {&weighted, {0, 0}, {}},
+    };
+    for (const Case& c : cases) {
+        auto writer = SnapshotWriter::Create(path, 1);
+        ASSERT_TRUE(writer.ok()) << writer.status();
+        c.items->SaveItems(&*writer);
+        writer->PutArray(c.window);
+        writer->PutArray(c.pool);
+        writer->PutArray(std::vector<uint32_t>{});
+        writer->PutU64(0);
+        std::ostringstream rng;
+        rng << Xoshiro256();
+        writer->PutString(rng.str());
+        ASSERT_TRUE(writer->Commit().ok());
+
+        ShuffleChain chain(2);
+        auto reader = SnapshotReader::Open(path, 1);
+        ASSERT_TRUE(reader.ok()) << reader.status();
+        EXPECT_FALSE(chain.Restore(&*reader))
+            << "window: " << absl::StrJoin(c.window, ",")
+            << " pool: " << absl::StrJoin(c.pool, ",");
+        EXPECT_EQ(chain.Len(), 0u);
+    }
+}
+
+TEST(ShuffleChainTest, Update) {
+    ShuffleChain chain(3, Xoshiro256(2));
+    for (int i = 0; i < 10; i++) {
+        chain.Add(absl::StrCat("song_", i));
+    }
+    chain.Pick();
+
+    // Find out what the chain would pick next: these are in the window.
+    ShuffleChain copy = chain;
+    std::vector<std::string> window;
+    copy.PickN(3, &window);
+
+    // Remove one song from the window, and one from the pool, and add a
+    // new song.
+    std::string removed_pool;
+    for (int i = 0; i < 10; i++) {
+        std::string uri = absl::StrCat("song_", i);
+        if (std::find(window.begin(), window.end(), uri) == window.end()) {
+            removed_pool = uri;
+            break;
+        }
+    }
+    ShuffleChain next;
+    for (int i = 0; i < 10; i++) {
+        std::string uri = absl::StrCat("song_", i);
+        if (uri != window[1] && uri != removed_pool) {
+            next.Add(uri);
+        }
+    }
+    next.Add("song_new");
+
+    ChainDiff diff = chain.Update(std::move(next));
+    EXPECT_EQ(diff.added, 1u);
+    EXPECT_EQ(diff.removed, 2u);
+    EXPECT_EQ(chain.Len(), 9u);
+    EXPECT_EQ(chain.Stats().window, 2u);
+    EXPECT_EQ(chain.Stats().picks, 1u);
+
+    // The rest of the window is kept, in order.
+    EXPECT_THAT(chain.Pick(), ElementsAre(window[0]));
+    EXPECT_THAT(chain.Pick(), ElementsAre(window[2]));
+
+    std::unordered_set<std::string> picked;
+    for (int i = 0; i < 200; i++) {
+        picked.insert(chain.Pick()[0]);
+    }
+    EXPECT_THAT(picked, SizeIs(9));
+    EXPECT_TRUE(picked.count("song_new"));
+    EXPECT_FALSE(picked.count(window[1]));
+    EXPECT_FALSE(picked.count(removed_pool));
+}
+
+TEST(ShuffleChainTest, UpdateGroups) {
+    ShuffleChain chain(1);
+    chain.Add(std::vector<std::string>{"a_1", "a_2"});
+    chain.Add(std::vector<std::string>{"b_1"});
+
+    // A group whose songs changed is a different item.
+    ShuffleChain next;
+    next.Add(std::vector<std::string>{"a_1", "a_2", "a_3"});
+    next.Add(std::vector<std::string>{"b_1"});
+
+    ChainDiff diff = chain.Update(std::move(next));
+    EXPECT_EQ(diff.added, 1u);
+    EXPECT_EQ(diff.removed, 1u);
+    EXPECT_THAT(chain.Items(),
+                WhenSorted(ElementsAre(ElementsAre("a_1", "a_2", "a_3"),
+                                       ElementsAre("b_1"))));
+}
+
+TEST(ShuffleChainTest, UpdateWeightedSpread) {
+    ShuffleChain chain(2, Xoshiro256(4));
+    chain.SetSpread(1);
+    for (int i = 0; i < 20; i++) {
+        chain.Add(absl::StrCat("song_", i), 1 + i % 2);
+        chain.SetSpreadKey(i, 1 + i % 4);
+    }
+    chain.Pick();
+
+    // Re-load the same songs, but with shifted spread keys and new weights.
+    ShuffleChain next;
+    for (int i = 0; i < 20; i++) {
+        next.Add(absl::StrCat("song_", i), 5);
+        next.SetSpreadKey(i, 10 + i % 4);
+    }
+    ChainDiff diff = chain.Update(std::move(next));
+    EXPECT_EQ(diff.added, 0u);
+    EXPECT_EQ(diff.removed, 0u);
+    EXPECT_EQ(chain.Stats().window, 2u);
+
+    std::unordered_set<std::string> picked;
+    for (int i = 0; i < 500; i++) {
+        picked.insert(chain.Pick()[0]);
+    }
+    EXPECT_THAT(picked, SizeIs(20));
+}
+
+TEST(ShuffleChainTest, UpdateDuplicates) {
+    ShuffleChain chain(2, Xoshiro256(5));
+    chain.Add("song_a");
+    chain.Add("song_a");
+    chain.Add("song_b");
+
+    // Both copies of the duplicated song are kept.
+    ShuffleChain next;
+    next.Add("song_a");
+    next.Add("song_b");
+    next.Add("song_a");
+    ChainDiff diff = chain.Update(std::move(next));
+    EXPECT_EQ(diff.added, 0u);
+    EXPECT_EQ(diff.removed, 0u);
+
+    // Dropping one copy removes only that copy.
+    next = ShuffleChain();
+    next.Add("song_a");
+    next.Add("song_b");
+    diff = chain.Update(std::move(next));
+    EXPECT_EQ(diff.added, 0u);
+    EXPECT_EQ(diff.removed, 1u);
+    EXPECT_EQ(chain.Len(), 2u);
+}
+
+TEST(ShuffleChainTest, UpdateWeightedToUnweighted) {
+    ShuffleChain chain(3, Xoshiro256(6));
+    for (int i = 0; i < 10; i++) {
+        chain.Add(absl::StrCat("song_", i), 2);
+    }
+    chain.Pick();
+    ShuffleChain copy = chain;
+    std::vector<std::string> window;
+    copy.PickN(3, &window);
+
+    ShuffleChain next;
+    for (int i = 0; i < 10; i++) {
+        next.Add(absl::StrCat("song_", i));
+    }
+    ChainDiff diff = chain.Update(std::move(next));
+    EXPECT_EQ(diff.added, 0u);
+    EXPECT_EQ(diff.removed, 0u);
+    EXPECT_EQ(chain.Stats().window, 3u);
+
+    // The window is kept, and the rest of the songs make up the pool.
+    std::vector<std::string> next_picks;
+    chain.PickN(3, &next_picks);
+    EXPECT_THAT(next_picks, ContainerEq(window));
+    std::unordered_set<std::string> picked;
+    for (int i = 0; i < 200; i++) {
+        picked.insert(chain.Pick()[0]);
+    }
+    EXPECT_THAT(picked, SizeIs(10));
+}
+
 TEST(ShuffleChainTest, Items) {
     ShuffleChain chain(2);
 
@@ -161,3 +732,32 @@ TEST(ShuffleChainTest, Items) {
 
     EXPECT_THAT(got, WhenSorted(ContainerEq(want)));
 }
+
+TEST(ShuffleChainTest, ForEach) {
+    ShuffleChain chain(2);
+
+    // Enough URIs to span several restart points in the URI arena, with
+    // groups mixed in between single songs.
+    std::vector<std::vector<std::string>> want;
+    for (int i = 0; i < 40; i++) {
+        if (i % 5 == 0) {
+            std::vector<std::string> group{absl::StrCat("album/", i, "/a"),
+                                           absl::StrCat("album/", i, "/b")};
+            chain.Add(group);
+            want.push_back(group);
+        } else {
+            std::string uri = absl::StrCat("single/", i);
+            chain.Add(uri);
+            want.push_back({uri});
+        }
+    }
+    (void)chain.Pick();
+
+    std::vector<std::vector<std::string>> got;
+    chain.ForEach([&got](absl::Span<const std::string_view> uris) {
+        got.emplace_back(uris.begin(), uris.end());
+    });
+
+    // Unlike Items, ForEach visits items in the order they were added.
+    EXPECT_THAT(got, ContainerEq(want));
+}
@@ -0,0 +1,144 @@
+#include "snapshot.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <absl/status/status.h>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+using namespace ashuffle;
+
+using ::testing::ElementsAre;
+
+namespace {
+
+std::filesystem::path TestPath(std::string_view name) {
+    std::filesystem::path path =
+        std::filesystem::path(testing::TempDir()) / name;
+    std::filesystem::remove(path);
+    return path;
+}
+
+}  // namespace
+
+TEST(FingerprintTest, Stable) {
+    Fingerprint a, b;
+    a.Add("ab");
+    a.Add("c");
+    b.Add("a");
+    b.Add("bc");
+    EXPECT_NE(a.Value(), b.Value())
+        << "adjacent strings should not run together";
+
+    Fingerprint c;
+    c.Add("ab");
+    c.Add("c");
+    EXPECT_EQ(a.Value(), c.Value());
+}
+
+TEST(SnapshotTest, RoundTrip) {
+    std::filesystem::path path = TestPath("roundtrip.snapshot");
+    auto writer = SnapshotWriter::Create(path, 42);
+    ASSERT_TRUE(writer.ok()) << writer.status();
+    writer->PutU64(7);
+    writer->PutString("hello");
+    writer->PutArray(std::vector<uint32_t>{1, 2, 3});
+    writer->PutArray(std::vector<uint64_t>{});
+    ASSERT_TRUE(writer->Commit().ok());
+
+    auto reader = SnapshotReader::Open(path, 42);
+    ASSERT_TRUE(reader.ok()) << reader.status();
+    uint64_t v;
+    std::string s;
+    std::vector<uint32_t> a;
+    std::vector<uint64_t> empty = {1};
+    ASSERT_TRUE(reader->GetU64(&v));
+    ASSERT_TRUE(reader->GetString(&s));
+    ASSERT_TRUE(reader->GetArray(&a));
+    ASSERT_TRUE(reader->GetArray(&empty));
+    EXPECT_EQ(v, 7u);
+    EXPECT_EQ(s, "hello");
+    EXPECT_THAT(a, ElementsAre(1, 2, 3));
+    EXPECT_TRUE(empty.empty());
+    EXPECT_TRUE(reader->Done());
+    EXPECT_FALSE(reader->GetU64(&v)) << "reads past the end should fail";
+}
+
+TEST(SnapshotTest, ConcurrentWriters) {
+    std::filesystem::path dir =
+        std::filesystem::path(testing::TempDir()) / "writers";
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directory(dir);
+    std::filesystem::path path = dir / "shared.snapshot";
+
+    // Two writers to the same path do not clobber each other's temporary
+    // file, and the last to commit wins.
+    auto first = SnapshotWriter::Create(path, 1);
+    auto second = SnapshotWriter::Create(path, 2);
+    ASSERT_TRUE(first.ok()) << first.status();
+    ASSERT_TRUE(second.ok()) << second.status();
+    first->PutString("first");
+    second->PutString("second");
+    ASSERT_TRUE(first->Commit().ok());
+    ASSERT_TRUE(second->Commit().ok());
+
+    auto reader = SnapshotReader::Open(path, 2);
+    ASSERT_TRUE(reader.ok()) << reader.status();
+    std::string s;
+    ASSERT_TRUE(reader->GetString(&s));
+    EXPECT_EQ(s, "second");
+
+    // An abandoned writer leaves nothing behind.
+    {
+        auto abandoned = SnapshotWriter::Create(path, 3);
+        ASSERT_TRUE(abandoned.ok()) << abandoned.status();
+        abandoned->PutString("abandoned");
+    }
+    std::vector<std::filesystem::path> files;
+    for (const auto &entry : std::filesystem::directory_iterator(dir)) {
+        files.push_back(entry.path());
+    }
+    EXPECT_THAT(files, ElementsAre(path));
+}
+
+TEST(SnapshotTest, Missing) {
+    auto reader = SnapshotReader::Open(TestPath("missing.snapshot"), 1);
+    EXPECT_EQ(reader.status().code(), absl::StatusCode::kNotFound);
+}
+
+TEST(SnapshotTest, WrongKey) {
+    std::filesystem::path path = TestPath("key.snapshot");
+    auto writer = SnapshotWriter::Create(path, 1);
+    ASSERT_TRUE(writer.ok());
+    ASSERT_TRUE(writer->Commit().ok());
+
+    auto reader = SnapshotReader::Open(path, 2);
+    EXPECT_EQ(reader.status().code(), absl::StatusCode::kFailedPrecondition);
+}
+
+TEST(SnapshotTest, NotASnapshot) {
+    std::filesystem::path path = TestPath("garbage.snapshot");
+    std::ofstream(path) << "this is definitely not a snapshot file";
+
+    auto reader = SnapshotReader::Open(path, 1);
+    EXPECT_EQ(reader.status().code(), absl::StatusCode::kDataLoss);
+}
+
+TEST(SnapshotTest, Truncated) {
+    std::filesystem::path path = TestPath("truncated.snapshot");
+    auto writer = SnapshotWriter::Create(path, 1);
+    ASSERT_TRUE(writer.ok());
+    writer->PutArray(std::vector<uint64_t>(100, 1));
+    ASSERT_TRUE(writer->Commit().ok());
+    std::filesystem::resize_file(path,
+                                 std::filesystem::file_size(path) - 8);
+
+    auto reader = SnapshotReader::Open(path, 1);
+    ASSERT_TRUE(reader.ok());
+    std::vector<uint64_t> got;
+    EXPECT_FALSE(reader->GetArray(&got));
+}
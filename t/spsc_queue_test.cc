@@ -0,0 +1,52 @@
+#include "spsc_queue.h"
+
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+using namespace ashuffle;
+
+TEST(SPSCQueueTest, FirstInFirstOut) {
+    SPSCQueue<int> queue(4);
+    queue.Push(1);
+    queue.Push(2);
+    queue.Push(3);
+    EXPECT_EQ(queue.Pop(), 1);
+    queue.Push(4);
+    queue.Push(5);
+    EXPECT_EQ(queue.Pop(), 2);
+    EXPECT_EQ(queue.Pop(), 3);
+    EXPECT_EQ(queue.Pop(), 4);
+    EXPECT_EQ(queue.Pop(), 5);
+}
+
+TEST(SPSCQueueTest, MoveOnly) {
+    SPSCQueue<std::unique_ptr<int>> queue(1);
+    queue.Push(std::make_unique<int>(7));
+    std::unique_ptr<int> got = queue.Pop();
+    ASSERT_NE(got, nullptr);
+    EXPECT_EQ(*got, 7);
+}
+
+TEST(SPSCQueueTest, Threads) {
+    constexpr int kValues = 100000;
+    // A small queue, so both Push and Pop have to wait.
+    SPSCQueue<int> queue(3);
+
+    std::thread producer([&] {
+        for (int i = 0; i < kValues; i++) {
+            queue.Push(i);
+        }
+    });
+    std::vector<int> got;
+    for (int i = 0; i < kValues; i++) {
+        got.push_back(queue.Pop());
+    }
+    producer.join();
+
+    for (int i = 0; i < kValues; i++) {
+        ASSERT_EQ(got[i], i) << "value " << i << " out of order";
+    }
+}
@@ -0,0 +1,70 @@
+#include "thread_pool.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+using namespace ashuffle;
+
+namespace {
+
+// Run ParallelFor on the given pool, and check every index in [0, n) is
+// visited exactly once.
+void CheckCoverage(ThreadPool& pool, size_t n, size_t grain) {
+    std::vector<std::atomic<int>> visits(n);
+    pool.ParallelFor(n, grain, [&](size_t begin, size_t end) {
+        ASSERT_LE(end - begin, grain);
+        for (size_t i = begin; i < end; i++) {
+            visits[i]++;
+        }
+    });
+    for (size_t i = 0; i < n; i++) {
+        ASSERT_EQ(visits[i].load(), 1) << "index " << i << " of " << n;
+    }
+}
+
+}  // namespace
+
+TEST(ThreadPoolTest, Serial) {
+    ThreadPool pool(1);
+    CheckCoverage(pool, 0, 4);
+    CheckCoverage(pool, 1, 4);
+    CheckCoverage(pool, 100, 4);
+}
+
+TEST(ThreadPoolTest, Parallel) {
+    ThreadPool pool(4);
+    CheckCoverage(pool, 0, 4);
+    CheckCoverage(pool, 3, 4);
+    CheckCoverage(pool, 1000, 1);
+    CheckCoverage(pool, 1001, 16);
+}
+
+TEST(ThreadPoolTest, ManyLoops) {
+    // Start many short loops, so threads from one loop are often still
+    // looking for work when the next starts.
+    ThreadPool pool(4);
+    for (int i = 0; i < 2000; i++) {
+        CheckCoverage(pool, 64, 2);
+    }
+}
+
+TEST(ThreadPoolTest, UnevenWork) {
+    ThreadPool pool(4);
+    std::atomic<size_t> sum = 0;
+    // The first tasks are much slower than the rest. Without stealing, the
+    // thread that queued them would be left with all the slow work.
+    pool.ParallelFor(64, 1, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            if (i < 4) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+            sum += i;
+        }
+    });
+    EXPECT_EQ(sum.load(), 64u * 63u / 2u);
+}
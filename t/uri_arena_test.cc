@@ -0,0 +1,182 @@
+#include "uri_arena.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include <absl/strings/str_cat.h>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include "snapshot.h"
+
+using namespace ashuffle;
+
+namespace {
+
+std::vector<std::string> GetAll(const URIArena& arena) {
+    std::vector<std::string> result(arena.Size());
+    for (size_t i = 0; i < arena.Size(); i++) {
+        arena.Get(i, &result[i]);
+    }
+    return result;
+}
+
+// Write the fields of an arena, as URIArena::Save would, and restore them
+// into `arena`.
+bool RestoreFields(const std::string& data, const std::vector<size_t>& restarts,
+                   const std::string& last, uint64_t size, URIArena* arena) {
+    std::filesystem::path path =
+        std::filesystem::path(testing::TempDir()) / "arena.snapshot";
+    auto writer = SnapshotWriter::Create(path, 1);
+    EXPECT_TRUE(writer.ok()) << writer.status();
+    writer->PutString(data);
+    writer->PutArray(restarts);
+    writer->PutString(last);
+    writer->PutU64(size);
+    EXPECT_TRUE(writer->Commit().ok());
+    auto reader = SnapshotReader::Open(path, 1);
+    EXPECT_TRUE(reader.ok()) << reader.status();
+    return arena->Restore(&*reader);
+}
+
+}  // namespace
+
+TEST(URIArenaTest, Empty) {
+    URIArena arena;
+    EXPECT_EQ(arena.Size(), 0u);
+    EXPECT_EQ(arena.Bytes(), 0u);
+}
+
+TEST(URIArenaTest, AddGet) {
+    URIArena arena;
+    EXPECT_EQ(arena.Add("artist/album/a.mp3"), 0u);
+    EXPECT_EQ(arena.Add("artist/album/b.mp3"), 1u);
+    EXPECT_EQ(arena.Add("other/x.mp3"), 2u);
+    EXPECT_EQ(arena.Add(""), 3u);
+    EXPECT_EQ(arena.Add("other/x.mp3 (2)"), 4u);
+
+    EXPECT_THAT(GetAll(arena),
+                testing::ElementsAre("artist/album/a.mp3", "artist/album/b.mp3",
+                                     "other/x.mp3", "", "other/x.mp3 (2)"));
+}
+
+TEST(URIArenaTest, AcrossRestarts) {
+    URIArena arena;
+    std::vector<std::string> want;
+    // Use enough URIs to span several restart points, with URIs that are
+    // long enough to need multi-byte lengths.
+    for (size_t i = 0; i < URIArena::kRestartInterval * 5 + 3; i++) {
+        want.push_back(absl::StrCat(std::string(200, 'a'), "/album ", i / 7,
+                                    "/track ", i, ".flac"));
+        arena.Add(want.back());
+    }
+    EXPECT_THAT(GetAll(arena), testing::ContainerEq(want));
+}
+
+TEST(URIArenaTest, SharedPrefixesAreCompressed) {
+    URIArena arena;
+    const std::string prefix(100, 'p');
+    for (int i = 0; i < 1000; i++) {
+        arena.Add(absl::StrCat(prefix, "/", i));
+    }
+    // Without front-coding this would need > 100 bytes per URI.
+    EXPECT_LT(arena.Bytes(), 1000u * 20);
+}
+
+TEST(URIArenaTest, LibraryBytesPerURI) {
+    // A library shaped like the one used by the TestMaxMemoryUsage
+    // integration test: "artist/album/track" URIs, listed in directory
+    // order. This keeps the memory savings of front-coding checked by the
+    // unit tests, since the benchmarks are not run automatically.
+    constexpr size_t kURIs = 100'000;
+    URIArena arena;
+    size_t raw = 0;
+    for (size_t i = 0; i < kURIs; i++) {
+        std::string uri = absl::StrCat("artist ", i / 30, "/album ", i / 10,
+                                       "/", i % 10, " track.mp3");
+        raw += uri.size();
+        arena.Add(uri);
+    }
+    // Stored as std::strings, each URI would take at least its own length
+    // (and usually a heap allocation on top).
+    EXPECT_LT(arena.Bytes() * 2, raw);
+}
+
+TEST(URIArenaTest, Clear) {
+    URIArena arena;
+    arena.Add("a");
+    arena.Add("b");
+    arena.Clear();
+    EXPECT_EQ(arena.Size(), 0u);
+
+    EXPECT_EQ(arena.Add("c"), 0u);
+    EXPECT_THAT(GetAll(arena), testing::ElementsAre("c"));
+}
+
+TEST(URIArenaTest, SaveRestore) {
+    URIArena arena;
+    std::vector<std::string> want;
+    for (int i = 0; i < 40; i++) {
+        want.push_back(absl::StrCat("artist/album/", i));
+        arena.Add(want.back());
+    }
+    std::filesystem::path path =
+        std::filesystem::path(testing::TempDir()) / "arena.snapshot";
+    auto writer = SnapshotWriter::Create(path, 1);
+    ASSERT_TRUE(writer.ok()) << writer.status();
+    arena.Save(&*writer);
+    ASSERT_TRUE(writer->Commit().ok());
+
+    URIArena restored;
+    auto reader = SnapshotReader::Open(path, 1);
+    ASSERT_TRUE(reader.ok()) << reader.status();
+    ASSERT_TRUE(restored.Restore(&*reader));
+    EXPECT_THAT(GetAll(restored), testing::ContainerEq(want));
+
+    // The arena can still be added to, sharing a prefix with the last URI.
+    restored.Add("artist/album/40");
+    EXPECT_EQ(GetAll(restored).back(), "artist/album/40");
+}
+
+TEST(URIArenaTest, RestoreCorrupt) {
+    URIArena arena;
+    // A well-formed arena holding "ab" and "ac".
+    ASSERT_TRUE(RestoreFields(std::string("\x00\x02" "ab" "\x01\x01" "c", 7),
+                              {0}, "ac", 2, &arena));
+    EXPECT_THAT(GetAll(arena), testing::ElementsAre("ab", "ac"));
+
+    // A suffix running past the end of the data.
+    EXPECT_FALSE(RestoreFields(std::string("\x00\x05" "ab", 4), {0}, "ab", 1,
+                               &arena));
+    // A prefix longer than the previous URI.
+    EXPECT_FALSE(RestoreFields(std::string("\x00\x01" "a" "\x05\x01" "b", 6),
+                               {0}, "aaaaab", 2, &arena));
+    // A prefix at a restart point.
+    EXPECT_FALSE(RestoreFields(std::string("\x01\x01" "a", 3), {0}, "a", 1,
+                               &arena));
+    // A restart point at the wrong offset.
+    EXPECT_FALSE(RestoreFields(std::string("\x00\x01" "a", 3), {1}, "a", 1,
+                               &arena));
+    // An unterminated length.
+    EXPECT_FALSE(RestoreFields(std::string("\x80\x80", 2), {0}, "", 1,
+                               &arena));
+    // Fewer entries than the size.
+    EXPECT_FALSE(RestoreFields(std::string("\x00\x01" "a", 3), {0}, "a", 2,
+                               &arena));
+    // Data left over after the last entry.
+    EXPECT_FALSE(RestoreFields(std::string("\x00\x01" "a" "\x00", 4), {0},
+                               "a", 1, &arena));
+    // A size that overflows the restart count.
+    EXPECT_FALSE(RestoreFields(std::string("\x00\x01" "a", 3), {},
+                               "a", std::numeric_limits<uint64_t>::max(),
+                               &arena));
+    // A last URI that does not match the last entry.
+    EXPECT_FALSE(RestoreFields(std::string("\x00\x01" "a", 3), {0}, "abc", 1,
+                               &arena));
+
+    // Failed restores leave the arena empty.
+    EXPECT_EQ(arena.Size(), 0u);
+}
@@ -0,0 +1,117 @@
+#include "uri_set.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <absl/strings/str_format.h>
+#include <benchmark/benchmark.h>
+
+#include "mapped_file.h"
+
+using namespace ashuffle;
+
+namespace {
+
+// The length of the `--file` list used by every benchmark.
+constexpr int64_t kListSize = 500'000;
+
+// Build `n` URIs shaped like a typical "artist/album/track" library.
+std::vector<std::string> MakeURIs(int64_t n) {
+    std::vector<std::string> uris;
+    uris.reserve(n);
+    for (int64_t i = 0; i < n; i++) {
+        uris.push_back(absl::StrFormat("artist %d/album %d/%02d track.mp3",
+                                       i / 30, i / 10, i % 10));
+    }
+    return uris;
+}
+
+// Write every other URI of a library twice the size of the list to a file,
+// so half of the library is in the list, and return its path.
+std::filesystem::path WriteList() {
+    std::filesystem::path path =
+        std::filesystem::temp_directory_path() / "ashuffle_uri_set_bench";
+    std::ofstream out(path);
+    std::vector<std::string> uris = MakeURIs(2 * kListSize);
+    for (size_t i = 0; i < uris.size(); i += 2) {
+        out << uris[i] << "\n";
+    }
+    return path;
+}
+
+// SortedURIs is the set FileMPDLoader used before URISet: a sorted vector,
+// read from the list with std::getline, and searched with binary search.
+struct SortedURIs {
+    explicit SortedURIs(const std::filesystem::path& path) {
+        std::ifstream in(path);
+        for (std::string uri; std::getline(in, uri);) {
+            uris.emplace_back(uri);
+        }
+        std::sort(uris.begin(), uris.end());
+    }
+
+    bool Contains(const std::string& uri) const {
+        return std::binary_search(uris.begin(), uris.end(), uri);
+    }
+
+    std::vector<std::string> uris;
+};
+
+// MappedURIs is a URISet read from a mapped list.
+struct MappedURIs {
+    explicit MappedURIs(const std::filesystem::path& path) {
+        absl::StatusOr<MappedFile> file = MappedFile::Open(path);
+        std::string_view contents = file->Contents();
+        uris.Reserve(std::count(contents.begin(), contents.end(), '\n') + 1);
+        ForEachLine(contents,
+                    [this](std::string_view uri) { uris.Insert(uri); });
+    }
+
+    bool Contains(const std::string& uri) const { return uris.Contains(uri); }
+
+    URISet uris;
+};
+
+// Read the list into a set.
+template <typename Set>
+void BM_Load(benchmark::State& state) {
+    const std::filesystem::path path = WriteList();
+    for (auto _ : state) {
+        Set set(path);
+        benchmark::DoNotOptimize(&set);
+    }
+    state.SetItemsProcessed(state.iterations() * kListSize);
+    std::filesystem::remove(path);
+}
+
+// Check every song of the library against the list, as FileMPDLoader does.
+template <typename Set>
+void BM_Contains(benchmark::State& state) {
+    const std::filesystem::path path = WriteList();
+    const Set set(path);
+    std::filesystem::remove(path);
+    const std::vector<std::string> library = MakeURIs(2 * kListSize);
+
+    for (auto _ : state) {
+        size_t found = 0;
+        for (const std::string& uri : library) {
+            found += set.Contains(uri);
+        }
+        benchmark::DoNotOptimize(found);
+    }
+    state.SetItemsProcessed(state.iterations() * library.size());
+}
+
+}  // namespace
+
+BENCHMARK_TEMPLATE(BM_Load, SortedURIs)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_Load, MappedURIs)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_Contains, SortedURIs)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_Contains, MappedURIs)->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
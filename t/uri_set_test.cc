@@ -0,0 +1,74 @@
+#include "uri_set.h"
+
+#include <string>
+#include <vector>
+
+#include <absl/strings/str_cat.h>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+using namespace ashuffle;
+
+TEST(URISetTest, Empty) {
+    URISet set;
+    EXPECT_EQ(set.Size(), 0u);
+    EXPECT_EQ(set.Bytes(), 0u);
+    EXPECT_FALSE(set.Contains(""));
+    EXPECT_FALSE(set.Contains("artist/album/a.mp3"));
+}
+
+TEST(URISetTest, InsertContains) {
+    URISet set;
+    set.Insert("artist/album/a.mp3");
+    set.Insert("artist/album/b.mp3");
+    set.Insert("");
+
+    EXPECT_EQ(set.Size(), 3u);
+    EXPECT_TRUE(set.Contains("artist/album/a.mp3"));
+    EXPECT_TRUE(set.Contains("artist/album/b.mp3"));
+    EXPECT_TRUE(set.Contains(""));
+    EXPECT_FALSE(set.Contains("artist/album/c.mp3"));
+    // Prefixes of a URI are not in the set.
+    EXPECT_FALSE(set.Contains("artist/album/a.mp"));
+    EXPECT_FALSE(set.Contains("artist/album/a.mp3 "));
+}
+
+TEST(URISetTest, Duplicates) {
+    URISet set;
+    set.Insert("a");
+    set.Insert("b");
+    set.Insert("a");
+    EXPECT_EQ(set.Size(), 2u);
+    EXPECT_TRUE(set.Contains("a"));
+    EXPECT_TRUE(set.Contains("b"));
+}
+
+TEST(URISetTest, Reserve) {
+    URISet set;
+    set.Insert("a");
+    set.Reserve(1000);
+    for (int i = 0; i < 999; i++) {
+        set.Insert(absl::StrCat(i));
+    }
+    EXPECT_EQ(set.Size(), 1000u);
+    // URIs added before the table was resized are kept.
+    EXPECT_TRUE(set.Contains("a"));
+    EXPECT_TRUE(set.Contains("998"));
+    EXPECT_FALSE(set.Contains("999"));
+}
+
+TEST(URISetTest, Large) {
+    // Enough URIs to grow the table several times.
+    constexpr int kURIs = 10000;
+    URISet set;
+    for (int i = 0; i < kURIs; i++) {
+        set.Insert(absl::StrCat("artist ", i / 30, "/album ", i / 10, "/", i));
+    }
+    EXPECT_EQ(set.Size(), static_cast<size_t>(kURIs));
+    for (int i = 0; i < kURIs; i++) {
+        std::string uri =
+            absl::StrCat("artist ", i / 30, "/album ", i / 10, "/", i);
+        EXPECT_TRUE(set.Contains(uri)) << uri;
+        EXPECT_FALSE(set.Contains(absl::StrCat(uri, ".mp3"))) << uri;
+    }
+}